@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <span>
 
 class VidDriver;
 
@@ -17,6 +19,11 @@ class Display {
 
   void* GetContext() const;
 
+  // Shows R8G8B8A8 pixels rendered on CPU, by backends without a swap chain
+  void ShowFrame(std::span<const uint32_t> pixels,
+                 uint32_t width,
+                 uint32_t height);
+
   void Resize(uint32_t width, uint32_t height);
 
   const uint32_t Width() const { return width; }
@@ -24,7 +31,7 @@ class Display {
 
  private:
   struct Impl;
-  std::unique_ptr<Impl> impl = nullptr;
+  std::unique_ptr<Impl> impl;
 
   std::function<void()> drawCallback = []() {};
 
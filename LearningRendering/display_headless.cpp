@@ -0,0 +1,103 @@
+#include "display.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "viddriver.h"
+
+// Display without a window: Loop() draws DISPLAY_FRAMES frames (1 by default)
+// and every shown frame is written to DISPLAY_OUTPUT_DIR (the current directory
+// by default, nowhere if empty) as <name>_<frame>.ppm
+struct Display::Impl {
+  std::string name;
+  std::filesystem::path outputDir;
+  bool writeFrames = true;
+  uint64_t numFrames = 1;
+  uint64_t frameNumber = 0;
+
+  std::weak_ptr<VidDriver> vidDriver;
+};
+
+Display::Display(const char* name, uint32_t width, uint32_t height)
+    : width(width), height(height) {
+  impl = std::make_unique<Impl>();
+  impl->name = name;
+
+  if (const char* frames = std::getenv("DISPLAY_FRAMES")) {
+    impl->numFrames = std::strtoull(frames, nullptr, 10);
+  }
+  if (const char* outputDir = std::getenv("DISPLAY_OUTPUT_DIR")) {
+    impl->outputDir = outputDir;
+    impl->writeFrames = !impl->outputDir.empty();
+  }
+  if (impl->writeFrames && !impl->outputDir.empty()) {
+    std::filesystem::create_directories(impl->outputDir);
+  }
+}
+
+Display::~Display() {}
+
+Display& Display::Init(std::weak_ptr<VidDriver> vidDriver) {
+  impl->vidDriver = vidDriver;
+  return *this;
+}
+
+Display& Display::Show() {
+  return *this;
+}
+
+Display& Display::Loop() {
+  for (uint64_t i = 0; i < impl->numFrames; ++i) {
+    drawCallback();
+  }
+  return *this;
+}
+
+Display& Display::SetDrawCallback(std::function<void()>&& drawCallback) {
+  this->drawCallback = std::move(drawCallback);
+  return *this;
+}
+
+void* Display::GetContext() const {
+  return nullptr;
+}
+
+void Display::ShowFrame(std::span<const uint32_t> pixels,
+                        uint32_t width,
+                        uint32_t height) {
+  const uint64_t frameNumber = impl->frameNumber++;
+  if (!impl->writeFrames) {
+    return;
+  }
+
+  char fileName[32];
+  std::snprintf(fileName, sizeof(fileName), "_%05llu.ppm",
+                static_cast<unsigned long long>(frameNumber));
+  const std::filesystem::path path = impl->outputDir / (impl->name + fileName);
+
+  // Binary PPM has no alpha
+  std::vector<char> rgb(static_cast<size_t>(width) * height * 3);
+  for (size_t i = 0; i < pixels.size() && 3 * i < rgb.size(); ++i) {
+    rgb[3 * i] = static_cast<char>(pixels[i] & 0xff);
+    rgb[3 * i + 1] = static_cast<char>((pixels[i] >> 8) & 0xff);
+    rgb[3 * i + 2] = static_cast<char>((pixels[i] >> 16) & 0xff);
+  }
+
+  std::ofstream ofs(path, std::ios::out | std::ios::binary);
+  ofs << "P6\n" << width << " " << height << "\n255\n";
+  ofs.write(rgb.data(), rgb.size());
+  if (!ofs) {
+    throw std::runtime_error("Writing frame failed: " + path.string());
+  }
+}
+
+void Display::Resize(uint32_t width, uint32_t height) {
+  this->width = width;
+  this->height = height;
+  impl->vidDriver.lock()->ResizeSwapChain(width, height);
+}
@@ -2,8 +2,10 @@
 
 #include <windows.h>
 
+#include <algorithm>
 #include <format>
 #include <system_error>
+#include <vector>
 
 #include "viddriver.h"
 
@@ -108,6 +110,32 @@ void* Display::GetContext() const {
   return impl->hwnd;
 }
 
+void Display::ShowFrame(std::span<const uint32_t> pixels,
+                        uint32_t width,
+                        uint32_t height) {
+  // GDI takes BGRA
+  std::vector<uint32_t> bgra(pixels.size());
+  std::transform(pixels.begin(), pixels.end(), bgra.begin(), [](uint32_t rgba) {
+    return (rgba & 0xff00ff00) | ((rgba & 0xff) << 16) | ((rgba >> 16) & 0xff);
+  });
+
+  BITMAPINFO info = {
+      .bmiHeader =
+          {
+              .biSize = sizeof(BITMAPINFOHEADER),
+              .biWidth = static_cast<LONG>(width),
+              .biHeight = -static_cast<LONG>(height),
+              .biPlanes = 1,
+              .biBitCount = 32,
+              .biCompression = BI_RGB,
+          },
+  };
+  HDC hdc = GetDC(impl->hwnd);
+  SetDIBitsToDevice(hdc, 0, 0, width, height, 0, 0, 0, height, bgra.data(),
+                    &info, DIB_RGB_COLORS);
+  ReleaseDC(impl->hwnd, hdc);
+}
+
 void Display::Resize(uint32_t width, uint32_t height) {
   this->width = width;
   this->height = height;
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+
+// Sub-allocates one upload buffer, written by CPU and read by GPU, as a ring.
+// Ranges are handed out in order and given back a frame at a time: Close()
+// ends a frame with the fence value GPU signals once it is done with the
+// frame, Reclaim() frees the frames whose fence values were reached. It only
+// deals in offsets, mapping and fences are up to the backend.
+class UploadRingAllocator {
+ public:
+  // capacity has to be a multiple of every alignment asked for
+  explicit UploadRingAllocator(uint64_t capacity) : capacity(capacity) {}
+
+  // Offset of sizeInBytes aligned to alignment, a power of two. Nothing if
+  // they don't fit beside ranges still in use.
+  std::optional<uint64_t> Allocate(uint64_t sizeInBytes, uint64_t alignment) {
+    uint64_t begin = (head + alignment - 1) & ~(alignment - 1);
+    // a range never wraps around the end of the buffer
+    if (begin % capacity + sizeInBytes > capacity) {
+      begin = (begin / capacity + 1) * capacity;
+    }
+    if (sizeInBytes > capacity || begin + sizeInBytes - tail > capacity) {
+      return std::nullopt;
+    }
+
+    head = begin + sizeInBytes;
+    return begin % capacity;
+  }
+
+  // Ranges allocated since the last Close() are in use till fenceValue,
+  // which doesn't decrease from call to call
+  void Close(uint64_t fenceValue) {
+    const uint64_t closed = frames.empty() ? tail : frames.back().end;
+    if (head != closed) {
+      frames.push_back({fenceValue, head});
+    }
+  }
+
+  void Reclaim(uint64_t completedFenceValue) {
+    while (!frames.empty() &&
+           frames.front().fenceValue <= completedFenceValue) {
+      tail = frames.front().end;
+      frames.pop_front();
+    }
+    if (tail == head) {
+      Rewind();
+    }
+  }
+
+  // GPU is idle, so every range is free, closed or not
+  void Reset() {
+    frames.clear();
+    Rewind();
+  }
+
+  uint64_t Capacity() const { return capacity; }
+  uint64_t UsedSize() const { return head - tail; }
+
+ private:
+  // An empty ring starts over at offset 0, so a range of up to capacity fits
+  // again wherever the last one ended
+  void Rewind() {
+    head = 0;
+    tail = 0;
+  }
+
+  struct Frame {
+    uint64_t fenceValue;
+    uint64_t end;
+  };
+
+  const uint64_t capacity;
+  // Positions only grow, offsets are positions modulo capacity
+  uint64_t head = 0;
+  uint64_t tail = 0;
+  std::deque<Frame> frames;
+};
@@ -0,0 +1,74 @@
+#include "upload_ring_allocator.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// Times UploadRingAllocator the way the D3D12 backend drives it: uploads of
+// mixed sizes every frame, closed at the end of it and reclaimed once GPU is
+// kFramesInFlight frames behind. Prints one JSON object per scenario inside a
+// JSON array:
+//   upload_ring_allocator_benchmark
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kCapacity = 64 << 20;
+constexpr uint64_t kAlignment = 256;
+constexpr uint64_t kFramesInFlight = 2;
+constexpr uint64_t kFrames = 100000;
+
+struct Result {
+  uint64_t allocations = 0;
+  uint64_t failures = 0;
+  double seconds = 0;
+};
+
+Result Run(uint64_t uploadsPerFrame, uint64_t maxUploadSize) {
+  UploadRingAllocator allocator(kCapacity);
+  Result result;
+  // xorshift, so sizes don't depend on the standard library
+  uint64_t state = 88172645463325252ull;
+
+  const auto start = Clock::now();
+  for (uint64_t frame = 1; frame <= kFrames; ++frame) {
+    for (uint64_t i = 0; i < uploadsPerFrame; ++i) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      if (allocator.Allocate(state % maxUploadSize + 1, kAlignment)) {
+        ++result.allocations;
+      } else {
+        ++result.failures;
+      }
+    }
+    allocator.Close(frame);
+    if (frame > kFramesInFlight) {
+      allocator.Reclaim(frame - kFramesInFlight);
+    }
+  }
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+void Report(const char* name, const Result& result, bool first) {
+  const uint64_t calls = result.allocations + result.failures;
+  std::printf(
+      "%s\n  {\"name\": \"%s\", \"allocations\": %llu, \"failures\": %llu, "
+      "\"seconds\": %.6f, \"ns_per_allocate\": %.2f}",
+      first ? "[" : ",", name,
+      static_cast<unsigned long long>(result.allocations),
+      static_cast<unsigned long long>(result.failures), result.seconds,
+      calls != 0 ? result.seconds * 1e9 / calls : 0.0);
+}
+
+}  // namespace
+
+int main() {
+  Report("constants", Run(64, 256), true);
+  Report("meshes", Run(8, 1 << 20), false);
+  Report("textures", Run(2, 16 << 20), false);
+  std::printf("\n]\n");
+  return 0;
+}
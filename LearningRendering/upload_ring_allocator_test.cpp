@@ -0,0 +1,108 @@
+#include "upload_ring_allocator.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+
+// Checks UploadRingAllocator on its own, it doesn't need a GPU. Returns 0 if
+// every case passed.
+
+namespace {
+
+#define CHECK(condition)                                                 \
+  do {                                                                   \
+    if (!(condition)) {                                                  \
+      std::fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__,     \
+                   #condition);                                          \
+      return false;                                                      \
+    }                                                                    \
+  } while (0)
+
+constexpr uint64_t kCapacity = 1024;
+
+bool AlignsRanges() {
+  UploadRingAllocator allocator(kCapacity);
+  CHECK(allocator.Allocate(3, 1) == 0);
+  CHECK(allocator.Allocate(16, 256) == 256);
+  CHECK(allocator.Allocate(1, 4) == 272);
+  CHECK(allocator.UsedSize() == 273);
+  return true;
+}
+
+bool KeepsRangesTillFenceIsReached() {
+  UploadRingAllocator allocator(kCapacity);
+  CHECK(allocator.Allocate(512, 256) == 0);
+  allocator.Close(1);
+  CHECK(allocator.Allocate(512, 256) == 512);
+  allocator.Close(2);
+  CHECK(!allocator.Allocate(256, 256));
+
+  allocator.Reclaim(0);
+  CHECK(!allocator.Allocate(256, 256));
+  allocator.Reclaim(1);
+  CHECK(allocator.Allocate(256, 256) == 0);
+  CHECK(allocator.UsedSize() == 768);
+  return true;
+}
+
+bool NeverWrapsRanges() {
+  UploadRingAllocator allocator(kCapacity);
+  CHECK(allocator.Allocate(768, 256) == 0);
+  allocator.Close(1);
+  CHECK(allocator.Allocate(128, 1) == 768);
+  allocator.Close(2);
+  allocator.Reclaim(1);
+
+  // 128 bytes are left at the end, so 512 go to the start and the 128 are
+  // skipped till the range is reclaimed
+  CHECK(allocator.Allocate(512, 256) == 0);
+  CHECK(allocator.UsedSize() == 128 + 128 + 512);
+  return true;
+}
+
+bool FitsWholeCapacityOnceEmpty() {
+  UploadRingAllocator allocator(kCapacity);
+  CHECK(allocator.Allocate(kCapacity + 1, 1) == std::nullopt);
+  CHECK(allocator.Allocate(kCapacity, 256) == 0);
+  allocator.Close(1);
+  CHECK(!allocator.Allocate(1, 1));
+  allocator.Reclaim(1);
+  CHECK(allocator.UsedSize() == 0);
+  CHECK(allocator.Allocate(kCapacity, 256) == 0);
+
+  // ranges that ended midway through the buffer
+  allocator.Reset();
+  CHECK(allocator.Allocate(100, 1) == 0);
+  allocator.Close(2);
+  allocator.Reclaim(2);
+  CHECK(allocator.Allocate(kCapacity, 256) == 0);
+
+  allocator.Reset();
+  CHECK(allocator.UsedSize() == 0);
+  CHECK(allocator.Allocate(100, 1) == 0);
+  allocator.Reset();
+  CHECK(allocator.Allocate(kCapacity, 256) == 0);
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  const struct {
+    const char* name;
+    bool (*test)();
+  } tests[] = {
+      {"AlignsRanges", AlignsRanges},
+      {"KeepsRangesTillFenceIsReached", KeepsRangesTillFenceIsReached},
+      {"NeverWrapsRanges", NeverWrapsRanges},
+      {"FitsWholeCapacityOnceEmpty", FitsWholeCapacityOnceEmpty},
+  };
+
+  int failed = 0;
+  for (const auto& [name, test] : tests) {
+    const bool passed = test();
+    std::printf("%s %s\n", passed ? "passed" : "FAILED", name);
+    failed += passed ? 0 : 1;
+  }
+  return failed == 0 ? 0 : 1;
+}
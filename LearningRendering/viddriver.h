@@ -168,7 +168,7 @@ class VidDriver {
 
  private:
   struct Impl;
-  std::unique_ptr<Impl> impl = nullptr;
+  std::unique_ptr<Impl> impl;
 
   uint64_t frameNumber = 0;
 };
@@ -8,10 +8,12 @@
 #include <comdef.h>
 #include <array>
 #include <format>
+#include <optional>
 #include <system_error>
 #include <vector>
 
 #include "display.h"
+#include "upload_ring_allocator.h"
 
 #if defined(_DEBUG)
 #define THROW_IF_FAILED(expr)                                   \
@@ -89,6 +91,52 @@ struct DescriptorAllocator {
   uint32_t incrementSize = 0;
 };
 
+struct Buffer::Impl {
+  void CreateBuffer(Microsoft::WRL::ComPtr<ID3D12Device4> device,
+                    uint64_t sizeInBytes,
+                    D3D12_HEAP_TYPE heapType,
+                    D3D12_RESOURCE_STATES initialState =
+                        D3D12_RESOURCE_STATE_COMMON) {
+    D3D12_RESOURCE_DESC resourceDesc = {
+        .Dimension = D3D12_RESOURCE_DIMENSION_BUFFER,
+        .Alignment = 0,
+        .Width = sizeInBytes,
+        .Height = 1,
+        .DepthOrArraySize = 1,
+        .MipLevels = 1,
+        .Format = DXGI_FORMAT_UNKNOWN,
+        .SampleDesc =
+            {
+                .Count = 1,
+                .Quality = 0,
+            },
+        .Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
+        .Flags = D3D12_RESOURCE_FLAG_NONE,
+    };
+
+    D3D12_HEAP_PROPERTIES heapProps = {
+        .Type = heapType,
+        .CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+        .MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
+        .CreationNodeMask = 1,
+        .VisibleNodeMask = 1,
+    };
+
+    THROW_IF_FAILED(device->CreateCommittedResource(
+        &heapProps, D3D12_HEAP_FLAG_NONE, &resourceDesc, initialState,
+        nullptr, IID_PPV_ARGS(resource.GetAddressOf())));
+    state = initialState;
+  }
+
+  Microsoft::WRL::ComPtr<ID3D12Resource2> resource;
+  D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_COMMON;
+};
+
+// Uploads are copied through one persistently mapped UPLOAD buffer
+static constexpr uint64_t kUploadRingSize = 64 << 20;
+static constexpr uint64_t kUploadAlignment =
+    D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT;
+
 struct VidDriver::Impl {
   std::weak_ptr<Display> display;
 
@@ -122,8 +170,13 @@ struct VidDriver::Impl {
 
   Microsoft::WRL::ComPtr<IDxcCompiler3> compiler;
   Microsoft::WRL::ComPtr<ID3D12RootSignature> rootSignature;
+  // Last one set, FlushAndWait() resets the command list with it
+  Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState;
 
-  // TODO: make reusable
+  Buffer uploadRing;
+  uint8_t* uploadRingData = nullptr;
+  UploadRingAllocator uploadRingAllocator{kUploadRingSize};
+  // Uploads the ring had no room for, kept till their frame slot comes around
   std::array<std::vector<std::unique_ptr<Buffer>>, kMaxGpuFramesInFlight>
       uploadBuffers;
 
@@ -249,6 +302,17 @@ void VidDriver::InitAPI(std::weak_ptr<Display> display) {
   THROW_IF_FAILED(impl->device->CreateFence(
       0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(impl->flushFence.GetAddressOf())));
 
+  impl->uploadRing.impl->CreateBuffer(impl->device, kUploadRingSize,
+                                     D3D12_HEAP_TYPE_UPLOAD,
+                                     D3D12_RESOURCE_STATE_GENERIC_READ);
+  // Upload heaps may stay mapped for their whole lifetime
+  D3D12_RANGE readRange = {
+      .Begin = 0,
+      .End = 0,
+  };
+  THROW_IF_FAILED(impl->uploadRing.impl->resource->Map(
+      0, &readRange, reinterpret_cast<void**>(&impl->uploadRingData)));
+
   impl->descriptorAllocator_CBV_SRV_UAV.Init(impl->device);
   impl->descriptorAllocator_SAMPLER.Init(impl->device);
   impl->descriptorAllocator_RTV.Init(impl->device);
@@ -337,6 +401,7 @@ void VidDriver::EndFrame() {
 
   THROW_IF_FAILED(
       impl->presentQueue->Signal(impl->frameFence.Get(), nextFrameNumber));
+  impl->uploadRingAllocator.Close(nextFrameNumber);
   if (impl->frameFence->GetCompletedValue() < currentFrameNumber) {
     THROW_IF_FAILED(
         impl->frameFence->SetEventOnCompletion(currentFrameNumber, nullptr));
@@ -347,6 +412,7 @@ void VidDriver::EndFrame() {
   THROW_IF_FAILED(impl->graphicsCommandList->Reset(
       impl->commandAllocators[bufferIndex].Get(), nullptr));
 
+  impl->uploadRingAllocator.Reclaim(impl->frameFence->GetCompletedValue());
   impl->uploadBuffers[bufferIndex].clear();
 }
 
@@ -355,45 +421,6 @@ Buffer::Buffer() {
 }
 Buffer::~Buffer() {}
 
-struct Buffer::Impl {
-  void CreateBuffer(Microsoft::WRL::ComPtr<ID3D12Device4> device,
-                    uint64_t sizeInBytes,
-                    D3D12_HEAP_TYPE heapType) {
-    D3D12_RESOURCE_DESC resourceDesc = {
-        .Dimension = D3D12_RESOURCE_DIMENSION_BUFFER,
-        .Alignment = 0,
-        .Width = sizeInBytes,
-        .Height = 1,
-        .DepthOrArraySize = 1,
-        .MipLevels = 1,
-        .Format = DXGI_FORMAT_UNKNOWN,
-        .SampleDesc =
-            {
-                .Count = 1,
-                .Quality = 0,
-            },
-        .Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
-        .Flags = D3D12_RESOURCE_FLAG_NONE,
-    };
-
-    D3D12_HEAP_PROPERTIES heapProps = {
-        .Type = heapType,
-        .CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
-        .MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
-        .CreationNodeMask = 1,
-        .VisibleNodeMask = 1,
-    };
-
-    THROW_IF_FAILED(device->CreateCommittedResource(
-        &heapProps, D3D12_HEAP_FLAG_NONE, &resourceDesc,
-        D3D12_RESOURCE_STATE_COMMON, nullptr,
-        IID_PPV_ARGS(resource.GetAddressOf())));
-  }
-
-  Microsoft::WRL::ComPtr<ID3D12Resource2> resource;
-  D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_COMMON;
-};
-
 VertexBuffer::VertexBuffer() {
   impl = std::make_unique<Impl>();
 }
@@ -435,78 +462,58 @@ struct ShaderResourceViewBuffer::Impl {
 void VidDriver::UploadBuffer(void* data,
                              uint64_t sizeInBytes,
                              std::reference_wrapper<Buffer> dstBuffer) {
-  const uint32_t bufferIndex = frameNumber % kMaxGpuFramesInFlight;
-  Buffer& uploadBuffer = *impl->uploadBuffers[bufferIndex]
-                              .emplace_back(std::make_unique<Buffer>())
-                              .get();
-  uploadBuffer.impl->CreateBuffer(impl->device, sizeInBytes,
-                                  D3D12_HEAP_TYPE_UPLOAD);
+  const std::optional<uint64_t> offset =
+      impl->uploadRingAllocator.Allocate(sizeInBytes, kUploadAlignment);
+
+  ID3D12Resource* srcResource = impl->uploadRing.impl->resource.Get();
+  uint64_t srcOffset = 0;
+  if (offset) {
+    memcpy(impl->uploadRingData + *offset, data, sizeInBytes);
+    srcOffset = *offset;
+  } else {
+    // Larger than the ring, or the ring is full of uploads GPU hasn't copied
+    // yet. Waiting for them would mean submitting the frame's command list
+    // halfway, so this upload gets a buffer of its own instead.
+    const uint32_t bufferIndex = frameNumber % kMaxGpuFramesInFlight;
+    Buffer& uploadBuffer = *impl->uploadBuffers[bufferIndex]
+                                .emplace_back(std::make_unique<Buffer>())
+                                .get();
+    uploadBuffer.impl->CreateBuffer(impl->device, sizeInBytes,
+                                    D3D12_HEAP_TYPE_UPLOAD,
+                                    D3D12_RESOURCE_STATE_GENERIC_READ);
+
+    D3D12_RANGE range = {
+        .Begin = 0,
+        .End = 0,
+    };
+    uint8_t* dataBegin;
+    THROW_IF_FAILED(uploadBuffer.impl->resource->Map(
+        0, &range, reinterpret_cast<void**>(&dataBegin)));
+    memcpy(dataBegin, data, sizeInBytes);
+    uploadBuffer.impl->resource->Unmap(0, nullptr);
 
-  D3D12_RANGE range = {
-      .Begin = 0,
-      .End = 0,
-  };
-  uint8_t* dataBegin;
-  THROW_IF_FAILED(uploadBuffer.impl->resource->Map(
-      0, &range, reinterpret_cast<void**>(&dataBegin)));
-  memcpy(dataBegin, data, sizeInBytes);
-  uploadBuffer.impl->resource->Unmap(0, nullptr);
-
-  std::array<D3D12_RESOURCE_BARRIER, 2> barriers = {
-      D3D12_RESOURCE_BARRIER{
-          .Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
-          .Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
-          .Transition =
-              {
-                  .pResource = uploadBuffer.impl->resource.Get(),
-                  .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
-                  .StateBefore = uploadBuffer.impl->state,
-                  .StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE,
-              },
-      },
-      D3D12_RESOURCE_BARRIER{
-          .Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
-          .Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
-          .Transition =
-              {
-                  .pResource = dstBuffer.get().impl->resource.Get(),
-                  .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
-                  .StateBefore = dstBuffer.get().impl->state,
-                  .StateAfter = D3D12_RESOURCE_STATE_COPY_DEST,
-              },
-      },
-  };
+    srcResource = uploadBuffer.impl->resource.Get();
+  }
 
-  impl->graphicsCommandList->ResourceBarrier(2, barriers.data());
-  impl->graphicsCommandList->CopyResource(dstBuffer.get().impl->resource.Get(),
-                                          uploadBuffer.impl->resource.Get());
-
-  barriers = {
-      D3D12_RESOURCE_BARRIER{
-          .Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
-          .Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
-          .Transition =
-              {
-                  .pResource = uploadBuffer.impl->resource.Get(),
-                  .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
-                  .StateBefore = D3D12_RESOURCE_STATE_COPY_SOURCE,
-                  .StateAfter = uploadBuffer.impl->state,
-              },
-      },
-      D3D12_RESOURCE_BARRIER{
-          .Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
-          .Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
-          .Transition =
-              {
-                  .pResource = dstBuffer.get().impl->resource.Get(),
-                  .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
-                  .StateBefore = D3D12_RESOURCE_STATE_COPY_DEST,
-                  .StateAfter = dstBuffer.get().impl->state,
-              },
-      },
+  D3D12_RESOURCE_BARRIER barrier = {
+      .Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+      .Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+      .Transition =
+          {
+              .pResource = dstBuffer.get().impl->resource.Get(),
+              .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+              .StateBefore = dstBuffer.get().impl->state,
+              .StateAfter = D3D12_RESOURCE_STATE_COPY_DEST,
+          },
   };
 
-  impl->graphicsCommandList->ResourceBarrier(2, barriers.data());
+  impl->graphicsCommandList->ResourceBarrier(1, &barrier);
+  impl->graphicsCommandList->CopyBufferRegion(
+      dstBuffer.get().impl->resource.Get(), 0, srcResource, srcOffset,
+      sizeInBytes);
+
+  std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
+  impl->graphicsCommandList->ResourceBarrier(1, &barrier);
 }
 
 std::unique_ptr<VertexBuffer> VidDriver::CreateVertexBuffer(
@@ -747,20 +754,30 @@ void VidDriver::FlushAndWait() {
   impl->presentQueue->ExecuteCommandLists(1, commandLists);
 
   const uint32_t bufferIndex = frameNumber % kMaxGpuFramesInFlight;
-  // TODO: cache PSO and reset it here
   impl->graphicsCommandList->Reset(impl->commandAllocators[bufferIndex].Get(),
-                                   nullptr);
+                                   impl->pipelineState.Get());
+  if (impl->rootSignature) {
+    impl->graphicsCommandList->SetGraphicsRootSignature(
+        impl->rootSignature.Get());
+  }
 
   static uint64_t flushValue = 0;
   THROW_IF_FAILED(
       impl->presentQueue->Signal(impl->flushFence.Get(), ++flushValue));
   THROW_IF_FAILED(impl->flushFence->SetEventOnCompletion(flushValue, nullptr));
+
+  // GPU is idle, every upload is copied
+  impl->uploadRingAllocator.Reset();
+  for (std::vector<std::unique_ptr<Buffer>>& uploadBuffers :
+       impl->uploadBuffers) {
+    uploadBuffers.clear();
+  }
 }
 
 void VidDriver::SetPipelineState(
     std::reference_wrapper<PipelineState> pipelineState) {
-  impl->graphicsCommandList->SetPipelineState(
-      pipelineState.get().impl->pipelineState.Get());
+  impl->pipelineState = pipelineState.get().impl->pipelineState;
+  impl->graphicsCommandList->SetPipelineState(impl->pipelineState.Get());
 }
 
 void VidDriver::BindShaderResourceViewBuffers(
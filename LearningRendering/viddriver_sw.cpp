@@ -0,0 +1,1349 @@
+#include "viddriver.h"
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include "display.h"
+#include "viddriver_sw.h"
+
+// 8 lanes of int32 and float: one register with AVX2, a pair with SSE2 and
+// plain arrays elsewhere
+static_assert(kSwPixelLanes == 8);
+
+#if defined(__AVX2__)
+
+struct VecI {
+  __m256i v;
+};
+
+struct VecF {
+  __m256 v;
+};
+
+static inline VecI LoadI(const int32_t* p) {
+  return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))};
+}
+static inline void StoreI(int32_t* p, VecI a) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.v);
+}
+static inline VecI SplatI(int32_t x) {
+  return {_mm256_set1_epi32(x)};
+}
+static inline VecI operator+(VecI a, VecI b) {
+  return {_mm256_add_epi32(a.v, b.v)};
+}
+static inline VecI operator|(VecI a, VecI b) {
+  return {_mm256_or_si256(a.v, b.v)};
+}
+template <int Bits>
+static inline VecI ShiftLeft(VecI a) {
+  return {_mm256_slli_epi32(a.v, Bits)};
+}
+// bit per lane, set where the lane is negative
+static inline uint32_t SignMask(VecI a) {
+  return _mm256_movemask_ps(_mm256_castsi256_ps(a.v));
+}
+
+static inline VecF LoadF(const float* p) {
+  return {_mm256_loadu_ps(p)};
+}
+static inline void StoreF(float* p, VecF a) {
+  _mm256_storeu_ps(p, a.v);
+}
+static inline VecF SplatF(float x) {
+  return {_mm256_set1_ps(x)};
+}
+static inline VecF operator+(VecF a, VecF b) {
+  return {_mm256_add_ps(a.v, b.v)};
+}
+static inline VecF operator*(VecF a, VecF b) {
+  return {_mm256_mul_ps(a.v, b.v)};
+}
+static inline VecF operator/(VecF a, VecF b) {
+  return {_mm256_div_ps(a.v, b.v)};
+}
+static inline VecF Min(VecF a, VecF b) {
+  return {_mm256_min_ps(a.v, b.v)};
+}
+static inline VecF Max(VecF a, VecF b) {
+  return {_mm256_max_ps(a.v, b.v)};
+}
+static inline VecI RoundToInt(VecF a) {
+  return {_mm256_cvtps_epi32(a.v)};
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+struct VecI {
+  __m128i lo;
+  __m128i hi;
+};
+
+struct VecF {
+  __m128 lo;
+  __m128 hi;
+};
+
+static inline VecI LoadI(const int32_t* p) {
+  return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)),
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4))};
+}
+static inline void StoreI(int32_t* p, VecI a) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a.lo);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 4), a.hi);
+}
+static inline VecI SplatI(int32_t x) {
+  return {_mm_set1_epi32(x), _mm_set1_epi32(x)};
+}
+static inline VecI operator+(VecI a, VecI b) {
+  return {_mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi)};
+}
+static inline VecI operator|(VecI a, VecI b) {
+  return {_mm_or_si128(a.lo, b.lo), _mm_or_si128(a.hi, b.hi)};
+}
+template <int Bits>
+static inline VecI ShiftLeft(VecI a) {
+  return {_mm_slli_epi32(a.lo, Bits), _mm_slli_epi32(a.hi, Bits)};
+}
+static inline uint32_t SignMask(VecI a) {
+  return _mm_movemask_ps(_mm_castsi128_ps(a.lo)) |
+         (_mm_movemask_ps(_mm_castsi128_ps(a.hi)) << 4);
+}
+
+static inline VecF LoadF(const float* p) {
+  return {_mm_loadu_ps(p), _mm_loadu_ps(p + 4)};
+}
+static inline void StoreF(float* p, VecF a) {
+  _mm_storeu_ps(p, a.lo);
+  _mm_storeu_ps(p + 4, a.hi);
+}
+static inline VecF SplatF(float x) {
+  return {_mm_set1_ps(x), _mm_set1_ps(x)};
+}
+static inline VecF operator+(VecF a, VecF b) {
+  return {_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)};
+}
+static inline VecF operator*(VecF a, VecF b) {
+  return {_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)};
+}
+static inline VecF operator/(VecF a, VecF b) {
+  return {_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)};
+}
+static inline VecF Min(VecF a, VecF b) {
+  return {_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi)};
+}
+static inline VecF Max(VecF a, VecF b) {
+  return {_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)};
+}
+static inline VecI RoundToInt(VecF a) {
+  return {_mm_cvtps_epi32(a.lo), _mm_cvtps_epi32(a.hi)};
+}
+
+#else
+
+struct VecI {
+  int32_t v[8];
+};
+
+struct VecF {
+  float v[8];
+};
+
+template <typename Vec, typename Function>
+static inline Vec PerLane(Function function) {
+  Vec result;
+  for (uint32_t lane = 0; lane < 8; ++lane) {
+    result.v[lane] = function(lane);
+  }
+  return result;
+}
+
+static inline VecI LoadI(const int32_t* p) {
+  return PerLane<VecI>([&](uint32_t i) { return p[i]; });
+}
+static inline void StoreI(int32_t* p, VecI a) {
+  std::memcpy(p, a.v, sizeof(a.v));
+}
+static inline VecI SplatI(int32_t x) {
+  return PerLane<VecI>([&](uint32_t) { return x; });
+}
+static inline VecI operator+(VecI a, VecI b) {
+  return PerLane<VecI>([&](uint32_t i) {
+    return static_cast<int32_t>(static_cast<uint32_t>(a.v[i]) +
+                                static_cast<uint32_t>(b.v[i]));
+  });
+}
+static inline VecI operator|(VecI a, VecI b) {
+  return PerLane<VecI>([&](uint32_t i) { return a.v[i] | b.v[i]; });
+}
+template <int Bits>
+static inline VecI ShiftLeft(VecI a) {
+  return PerLane<VecI>([&](uint32_t i) {
+    return static_cast<int32_t>(static_cast<uint32_t>(a.v[i]) << Bits);
+  });
+}
+static inline uint32_t SignMask(VecI a) {
+  uint32_t mask = 0;
+  for (uint32_t lane = 0; lane < 8; ++lane) {
+    mask |= (a.v[lane] < 0 ? 1u : 0u) << lane;
+  }
+  return mask;
+}
+
+static inline VecF LoadF(const float* p) {
+  return PerLane<VecF>([&](uint32_t i) { return p[i]; });
+}
+static inline void StoreF(float* p, VecF a) {
+  std::memcpy(p, a.v, sizeof(a.v));
+}
+static inline VecF SplatF(float x) {
+  return PerLane<VecF>([&](uint32_t) { return x; });
+}
+static inline VecF operator+(VecF a, VecF b) {
+  return PerLane<VecF>([&](uint32_t i) { return a.v[i] + b.v[i]; });
+}
+static inline VecF operator*(VecF a, VecF b) {
+  return PerLane<VecF>([&](uint32_t i) { return a.v[i] * b.v[i]; });
+}
+static inline VecF operator/(VecF a, VecF b) {
+  return PerLane<VecF>([&](uint32_t i) { return a.v[i] / b.v[i]; });
+}
+static inline VecF Min(VecF a, VecF b) {
+  return PerLane<VecF>([&](uint32_t i) { return std::min(a.v[i], b.v[i]); });
+}
+static inline VecF Max(VecF a, VecF b) {
+  return PerLane<VecF>([&](uint32_t i) { return std::max(a.v[i], b.v[i]); });
+}
+static inline VecI RoundToInt(VecF a) {
+  return PerLane<VecI>(
+      [&](uint32_t i) { return static_cast<int32_t>(std::lrint(a.v[i])); });
+}
+
+#endif
+
+// Positions are snapped to 1/16 of a pixel
+static constexpr int32_t kSubpixelBits = 4;
+static constexpr int32_t kSubpixelScale = 1 << kSubpixelBits;
+static constexpr int32_t kHalfPixel = kSubpixelScale / 2;
+
+// Triangles are clipped to kGuardBand times the viewport around its center
+// instead of to the viewport, which keeps snapped positions within 2^20 and
+// edge functions of a block of pixels within int32
+static constexpr float kGuardBand = 2.f;
+static constexpr float kMinW = 1e-6f;
+static constexpr uint32_t kNumClipPlanes = 7;
+static constexpr uint32_t kMaxClipVertices = 3 + kNumClipPlanes;
+
+static constexpr int32_t kTileSize = 64;
+static constexpr uint32_t kVertexBatch = 1024;
+static constexpr uint32_t kTriangleBatch = 1024;
+
+// Bin entries are indices of triangles, or of clear colors with this bit set
+static constexpr uint32_t kClearEntry = 0x80000000u;
+
+static constexpr float kLaneOffsets[kSwPixelLanes] = {0.f, 1.f, 2.f, 3.f,
+                                                      4.f, 5.f, 6.f, 7.f};
+
+// Pixels [left, right) x [top, bottom)
+struct PixelRect {
+  int32_t left;
+  int32_t top;
+  int32_t right;
+  int32_t bottom;
+};
+
+// Attribute as a function of pixel position: value at vertex 0 plus gradient
+struct Plane {
+  float value;
+  float dx;
+  float dy;
+};
+
+struct Triangle {
+  // edge functions at center of pixel (0, 0), biased by the top-left rule so
+  // that a pixel is covered where all three are >= 0
+  int64_t edgeOrigins[3];
+  int32_t edgeStepsX[3];
+  int32_t edgeStepsY[3];
+  PixelRect rect;  // bounding box clipped to scissor rect and render target
+
+  float x0;  // vertex 0, in pixels
+  float y0;
+  Plane invW;
+  Plane varyings[kSwMaxVaryings];  // divided by w
+  uint32_t numVaryings;
+  SwPixelShader pixelShader;
+};
+
+// Triangles set up by one worker, binned once all of them are done so that
+// bins keep the order of submission
+struct TriangleBatch {
+  std::vector<Triangle> triangles;
+  std::vector<std::pair<uint32_t, uint32_t>> binEntries;  // tile, triangle
+};
+
+struct SetupContext {
+  Viewport viewport;
+  PixelRect rect;
+  uint32_t numVaryings;
+  SwPixelShader pixelShader;
+  uint32_t tilesX;
+};
+
+// Pixel with the first center at or after a snapped position
+static inline int32_t FirstPixelCenterFrom(int32_t position) {
+  return (position - kHalfPixel + kSubpixelScale - 1) >> kSubpixelBits;
+}
+
+// Pixel with the last center at or before a snapped position
+static inline int32_t LastPixelCenterTo(int32_t position) {
+  return (position - kHalfPixel) >> kSubpixelBits;
+}
+
+static void SetupTriangle(const SwVertexOutput* vertices[3],
+                          const SetupContext& context,
+                          TriangleBatch& batch) {
+  const Viewport& viewport = context.viewport;
+
+  int32_t x[3];
+  int32_t y[3];
+  float invW[3];
+  for (uint32_t i = 0; i < 3; ++i) {
+    const float* position = vertices[i]->position;
+    invW[i] = 1.f / position[3];
+    const float screenX = viewport.topLeftX + (position[0] * invW[i] + 1.f) *
+                                                  .5f * viewport.width;
+    const float screenY = viewport.topLeftY + (1.f - position[1] * invW[i]) *
+                                                  .5f * viewport.height;
+    x[i] = static_cast<int32_t>(std::lrint(screenX * kSubpixelScale));
+    y[i] = static_cast<int32_t>(std::lrint(screenY * kSubpixelScale));
+  }
+
+  int64_t area = static_cast<int64_t>(x[1] - x[0]) * (y[2] - y[0]) -
+                 static_cast<int64_t>(x[2] - x[0]) * (y[1] - y[0]);
+  if (area == 0) {
+    return;
+  }
+  // Nothing is culled, so both windings are turned into the same one
+  const SwVertexOutput* v1 = vertices[1];
+  const SwVertexOutput* v2 = vertices[2];
+  if (area < 0) {
+    std::swap(x[1], x[2]);
+    std::swap(y[1], y[2]);
+    std::swap(invW[1], invW[2]);
+    std::swap(v1, v2);
+    area = -area;
+  }
+
+  // Pixels with centers inside of the bounding box
+  const auto [minX, maxX] = std::minmax({x[0], x[1], x[2]});
+  const auto [minY, maxY] = std::minmax({y[0], y[1], y[2]});
+  const PixelRect rect = {
+      .left = std::max(context.rect.left, FirstPixelCenterFrom(minX)),
+      .top = std::max(context.rect.top, FirstPixelCenterFrom(minY)),
+      .right = std::min(context.rect.right, LastPixelCenterTo(maxX) + 1),
+      .bottom = std::min(context.rect.bottom, LastPixelCenterTo(maxY) + 1),
+  };
+  if (rect.left >= rect.right || rect.top >= rect.bottom) {
+    return;
+  }
+
+  Triangle& triangle = batch.triangles.emplace_back();
+  triangle.rect = rect;
+
+  // Edge i is opposite of vertex i and positive towards it
+  int64_t edgeX[3];
+  int64_t edgeY[3];
+  for (uint32_t i = 0; i < 3; ++i) {
+    const uint32_t a = (i + 1) % 3;
+    const uint32_t b = (i + 2) % 3;
+    const int64_t stepX = y[a] - y[b];
+    const int64_t stepY = x[b] - x[a];
+    const int64_t origin = -(stepX * x[a] + stepY * y[a]);
+    const bool topLeft = stepX > 0 || (stepX == 0 && stepY > 0);
+
+    triangle.edgeOrigins[i] =
+        origin + (stepX + stepY) * kHalfPixel - (topLeft ? 0 : 1);
+    triangle.edgeStepsX[i] = static_cast<int32_t>(stepX * kSubpixelScale);
+    triangle.edgeStepsY[i] = static_cast<int32_t>(stepY * kSubpixelScale);
+    edgeX[i] = stepX;
+    edgeY[i] = stepY;
+  }
+
+  // Barycentrics of vertices 1 and 2 are 0 at vertex 0, so planes only need
+  // their gradients
+  const double scale = static_cast<double>(kSubpixelScale) / area;
+  const double l1dx = edgeX[1] * scale;
+  const double l1dy = edgeY[1] * scale;
+  const double l2dx = edgeX[2] * scale;
+  const double l2dy = edgeY[2] * scale;
+  auto plane = [&](float q0, float q1, float q2) {
+    const double d1 = static_cast<double>(q1) - q0;
+    const double d2 = static_cast<double>(q2) - q0;
+    return Plane{
+        .value = q0,
+        .dx = static_cast<float>(d1 * l1dx + d2 * l2dx),
+        .dy = static_cast<float>(d1 * l1dy + d2 * l2dy),
+    };
+  };
+
+  triangle.x0 = static_cast<float>(x[0]) / kSubpixelScale;
+  triangle.y0 = static_cast<float>(y[0]) / kSubpixelScale;
+  triangle.invW = plane(invW[0], invW[1], invW[2]);
+  for (uint32_t i = 0; i < context.numVaryings; ++i) {
+    triangle.varyings[i] = plane(vertices[0]->varyings[i] * invW[0],
+                                 v1->varyings[i] * invW[1],
+                                 v2->varyings[i] * invW[2]);
+  }
+  triangle.numVaryings = context.numVaryings;
+  triangle.pixelShader = context.pixelShader;
+
+  const uint32_t index = static_cast<uint32_t>(batch.triangles.size() - 1);
+  for (int32_t tileY = rect.top / kTileSize;
+       tileY <= (rect.bottom - 1) / kTileSize; ++tileY) {
+    for (int32_t tileX = rect.left / kTileSize;
+         tileX <= (rect.right - 1) / kTileSize; ++tileX) {
+      batch.binEntries.emplace_back(tileY * context.tilesX + tileX, index);
+    }
+  }
+}
+
+// Signed distance to clip plane, inside where >= 0
+static float ClipDistance(const SwVertexOutput& vertex, uint32_t plane) {
+  const auto [x, y, z, w] = vertex.position;
+  switch (plane) {
+    case 0:
+      return w - kMinW;
+    case 1:
+      return z;
+    case 2:
+      return w - z;
+    case 3:
+      return kGuardBand * w - x;
+    case 4:
+      return kGuardBand * w + x;
+    case 5:
+      return kGuardBand * w - y;
+    default:
+      return kGuardBand * w + y;
+  }
+}
+
+static uint32_t OutsideClipPlanes(const SwVertexOutput& vertex) {
+  uint32_t outside = 0;
+  for (uint32_t plane = 0; plane < kNumClipPlanes; ++plane) {
+    outside |= (ClipDistance(vertex, plane) < 0.f ? 1u : 0u) << plane;
+  }
+  return outside;
+}
+
+static void ClipAndSetupTriangle(const SwVertexOutput* vertices[3],
+                                 const SetupContext& context,
+                                 TriangleBatch& batch) {
+  const uint32_t outside[3] = {OutsideClipPlanes(*vertices[0]),
+                               OutsideClipPlanes(*vertices[1]),
+                               OutsideClipPlanes(*vertices[2])};
+  const uint32_t crossed = outside[0] | outside[1] | outside[2];
+  if (crossed == 0) {
+    SetupTriangle(vertices, context, batch);
+    return;
+  }
+  if ((outside[0] & outside[1] & outside[2]) != 0) {
+    return;
+  }
+
+  // Sutherland-Hodgman against the crossed planes only
+  SwVertexOutput polygons[2][kMaxClipVertices];
+  for (uint32_t i = 0; i < 3; ++i) {
+    polygons[0][i] = *vertices[i];
+  }
+  uint32_t count = 3;
+  uint32_t current = 0;
+
+  for (uint32_t plane = 0; plane < kNumClipPlanes; ++plane) {
+    if ((crossed & (1u << plane)) == 0) {
+      continue;
+    }
+
+    const SwVertexOutput* in = polygons[current];
+    SwVertexOutput* out = polygons[current ^ 1];
+    uint32_t outCount = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      const SwVertexOutput& a = in[i];
+      const SwVertexOutput& b = in[(i + 1) % count];
+      const float da = ClipDistance(a, plane);
+      const float db = ClipDistance(b, plane);
+      if (da >= 0.f) {
+        out[outCount++] = a;
+      }
+      if ((da >= 0.f) != (db >= 0.f)) {
+        const float t = da / (da - db);
+        SwVertexOutput& vertex = out[outCount++];
+        for (uint32_t j = 0; j < 4; ++j) {
+          vertex.position[j] =
+              a.position[j] + t * (b.position[j] - a.position[j]);
+        }
+        for (uint32_t j = 0; j < context.numVaryings; ++j) {
+          vertex.varyings[j] =
+              a.varyings[j] + t * (b.varyings[j] - a.varyings[j]);
+        }
+      }
+    }
+
+    count = outCount;
+    current ^= 1;
+    if (count < 3) {
+      return;
+    }
+  }
+
+  for (uint32_t i = 1; i + 1 < count; ++i) {
+    const SwVertexOutput* fan[3] = {&polygons[current][0],
+                                    &polygons[current][i],
+                                    &polygons[current][i + 1]};
+    SetupTriangle(fan, context, batch);
+  }
+}
+
+// Clamped to where adding 7 steps of at most 2^25 can neither overflow nor
+// change the sign
+static inline int32_t ClampEdge(int64_t edge) {
+  return static_cast<int32_t>(std::clamp<int64_t>(edge, -(1 << 30), 1 << 30));
+}
+
+static void RasterizeTriangle(const Triangle& triangle,
+                              const PixelRect& tile,
+                              uint32_t* pixels,
+                              uint32_t pitch) {
+  const int32_t left = std::max(triangle.rect.left, tile.left);
+  const int32_t top = std::max(triangle.rect.top, tile.top);
+  const int32_t right = std::min(triangle.rect.right, tile.right);
+  const int32_t bottom = std::min(triangle.rect.bottom, tile.bottom);
+  if (left >= right || top >= bottom) {
+    return;
+  }
+
+  int32_t laneSteps[3][kSwPixelLanes];
+  for (uint32_t i = 0; i < 3; ++i) {
+    for (uint32_t lane = 0; lane < kSwPixelLanes; ++lane) {
+      laneSteps[i][lane] = triangle.edgeStepsX[i] * static_cast<int32_t>(lane);
+    }
+  }
+  const VecI laneSteps0 = LoadI(laneSteps[0]);
+  const VecI laneSteps1 = LoadI(laneSteps[1]);
+  const VecI laneSteps2 = LoadI(laneSteps[2]);
+  const VecF laneOffsets = LoadF(kLaneOffsets);
+
+  SwPixelBlock block;
+  int32_t colors[kSwPixelLanes];
+
+  for (int32_t y = top; y < bottom; ++y) {
+    int64_t edges[3];
+    for (uint32_t i = 0; i < 3; ++i) {
+      edges[i] = triangle.edgeOrigins[i] +
+                 static_cast<int64_t>(triangle.edgeStepsX[i]) * left +
+                 static_cast<int64_t>(triangle.edgeStepsY[i]) * y;
+    }
+    const float dy = static_cast<float>(y) + .5f - triangle.y0;
+    uint32_t* row = pixels + static_cast<size_t>(y) * pitch;
+
+    for (int32_t x = left; x < right; x += kSwPixelLanes) {
+      const VecI edge0 = SplatI(ClampEdge(edges[0])) + laneSteps0;
+      const VecI edge1 = SplatI(ClampEdge(edges[1])) + laneSteps1;
+      const VecI edge2 = SplatI(ClampEdge(edges[2])) + laneSteps2;
+      const uint32_t inRect =
+          right - x >= static_cast<int32_t>(kSwPixelLanes)
+              ? (1u << kSwPixelLanes) - 1
+              : (1u << (right - x)) - 1;
+      uint32_t covered = ~SignMask(edge0 | edge1 | edge2) & inRect;
+      for (uint32_t i = 0; i < 3; ++i) {
+        edges[i] +=
+            static_cast<int64_t>(triangle.edgeStepsX[i]) * kSwPixelLanes;
+      }
+      if (covered == 0) {
+        continue;
+      }
+
+      // Perspective-correct varyings: planes hold v / w, interpolated 1 / w
+      // turns them back
+      const float dx = static_cast<float>(x) + .5f - triangle.x0;
+      auto interpolate = [&](const Plane& plane) {
+        return SplatF(plane.value + plane.dx * dx + plane.dy * dy) +
+               laneOffsets * SplatF(plane.dx);
+      };
+      const VecF w = SplatF(1.f) / interpolate(triangle.invW);
+      for (uint32_t i = 0; i < triangle.numVaryings; ++i) {
+        StoreF(block.varyings[i], interpolate(triangle.varyings[i]) * w);
+      }
+
+      triangle.pixelShader(block);
+
+      // R8G8B8A8_UNORM
+      auto channel = [&](uint32_t i) {
+        return RoundToInt(
+            Min(Max(LoadF(block.color[i]), SplatF(0.f)), SplatF(1.f)) *
+            SplatF(255.f));
+      };
+      StoreI(colors, channel(0) | ShiftLeft<8>(channel(1)) |
+                         ShiftLeft<16>(channel(2)) | ShiftLeft<24>(channel(3)));
+
+      for (; covered != 0; covered &= covered - 1) {
+        const uint32_t lane = std::countr_zero(covered);
+        row[x + lane] = static_cast<uint32_t>(colors[lane]);
+      }
+    }
+  }
+}
+
+static void ClearTile(uint32_t color,
+                      const PixelRect& tile,
+                      uint32_t* pixels,
+                      uint32_t pitch) {
+  for (int32_t y = tile.top; y < tile.bottom; ++y) {
+    uint32_t* row = pixels + static_cast<size_t>(y) * pitch;
+    std::fill(row + tile.left, row + tile.right, color);
+  }
+}
+
+// Runs ParallelFor() jobs on its workers and the calling thread together, one
+// job at a time. Items are handed out one by one, so uneven ones balance out.
+class ThreadPool {
+ public:
+  explicit ThreadPool(uint32_t numThreads) {
+    for (uint32_t i = 1; i < numThreads; ++i) {
+      workers.emplace_back([this]() { Run(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+  }
+
+  void ParallelFor(uint32_t count,
+                   const std::function<void(uint32_t)>& function) {
+    if (workers.empty() || count < 2) {
+      for (uint32_t i = 0; i < count; ++i) {
+        function(i);
+      }
+      return;
+    }
+
+    {
+      std::lock_guard lock(mutex);
+      job = &function;
+      jobSize = count;
+      next.store(0, std::memory_order_relaxed);
+      pending = static_cast<uint32_t>(workers.size());
+      ++generation;
+    }
+    wakeup.notify_all();
+
+    Work();
+
+    std::unique_lock lock(mutex);
+    finished.wait(lock, [&]() { return pending == 0; });
+    job = nullptr;
+  }
+
+ private:
+  void Work() {
+    for (uint32_t i = next.fetch_add(1, std::memory_order_relaxed);
+         i < jobSize; i = next.fetch_add(1, std::memory_order_relaxed)) {
+      (*job)(i);
+    }
+  }
+
+  void Run() {
+    uint64_t seenGeneration = 0;
+    for (;;) {
+      {
+        std::unique_lock lock(mutex);
+        wakeup.wait(lock, [&]() {
+          return stopping || generation != seenGeneration;
+        });
+        if (stopping) {
+          return;
+        }
+        seenGeneration = generation;
+      }
+
+      Work();
+
+      std::lock_guard lock(mutex);
+      if (--pending == 0) {
+        finished.notify_one();
+      }
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::condition_variable finished;
+  const std::function<void(uint32_t)>* job = nullptr;
+  uint32_t jobSize = 0;
+  std::atomic<uint32_t> next = 0;
+  uint32_t pending = 0;
+  uint64_t generation = 0;
+  bool stopping = false;
+
+  std::vector<std::jthread> workers;
+};
+
+struct ShaderRegistry {
+  std::map<std::string, std::pair<SwVertexShader, uint32_t>, std::less<>>
+      vertexShaders;
+  std::map<std::string, SwPixelShader, std::less<>> pixelShaders;
+};
+
+// triangle.vs.hlsl
+static void TriangleVS(const SwVertexInput& input, SwVertexOutput& output) {
+  const float* vertex = reinterpret_cast<const float*>(input.vertices[0]);
+  output.position[0] = vertex[0];
+  output.position[1] = vertex[1];
+  output.position[2] = vertex[2];
+  output.position[3] = 1.f;
+  output.varyings[0] = vertex[3];
+  output.varyings[1] = vertex[4];
+  output.varyings[2] = vertex[5];
+}
+
+// triangle.ps.hlsl
+static void TrianglePS(SwPixelBlock& block) {
+  for (uint32_t i = 0; i < 3; ++i) {
+    std::copy_n(block.varyings[i], kSwPixelLanes, block.color[i]);
+  }
+  std::fill_n(block.color[3], kSwPixelLanes, 1.f);
+}
+
+static ShaderRegistry& GetShaderRegistry() {
+  static ShaderRegistry registry = {
+      .vertexShaders = {{"main_VS", {TriangleVS, 3}}},
+      .pixelShaders = {{"main_PS", TrianglePS}},
+  };
+  return registry;
+}
+
+void RegisterSwVertexShader(std::string_view entryPoint,
+                            SwVertexShader shader,
+                            uint32_t numVaryings) {
+  if (numVaryings > kSwMaxVaryings) {
+    throw std::runtime_error("Too many varyings in " + std::string(entryPoint));
+  }
+  GetShaderRegistry().vertexShaders.insert_or_assign(
+      std::string(entryPoint), std::pair{shader, numVaryings});
+}
+
+void RegisterSwPixelShader(std::string_view entryPoint, SwPixelShader shader) {
+  GetShaderRegistry().pixelShaders.insert_or_assign(std::string(entryPoint),
+                                                    shader);
+}
+
+struct Buffer::Impl {
+  std::vector<std::byte> data;
+};
+
+Buffer::Buffer() {
+  impl = std::make_unique<Impl>();
+}
+Buffer::~Buffer() {}
+
+struct VertexBuffer::Impl {
+  uint32_t strideInBytes = 0;
+};
+
+VertexBuffer::VertexBuffer() {
+  impl = std::make_unique<Impl>();
+}
+VertexBuffer::~VertexBuffer() {}
+
+// Indices are R32_UINT, as with D3D12
+struct IndexBuffer::Impl {};
+
+IndexBuffer::IndexBuffer() {
+  impl = std::make_unique<Impl>();
+}
+IndexBuffer::~IndexBuffer() {}
+
+struct ConstantBuffer::Impl {
+  const Buffer* buffer = nullptr;
+};
+
+ConstantBuffer::ConstantBuffer() {
+  impl = std::make_unique<Impl>();
+}
+ConstantBuffer::~ConstantBuffer() {}
+
+struct ShaderResourceViewBuffer::Impl {
+  const Buffer* buffer = nullptr;
+};
+
+ShaderResourceViewBuffer::ShaderResourceViewBuffer() {
+  impl = std::make_unique<Impl>();
+}
+ShaderResourceViewBuffer::~ShaderResourceViewBuffer() {}
+
+struct Shader::Impl {};
+
+Shader::Shader() {
+  impl = std::make_unique<Impl>();
+}
+Shader::~Shader() {}
+
+struct PipelineState::Impl {
+  SwVertexShader vertexShader = nullptr;
+  SwPixelShader pixelShader = nullptr;
+  uint32_t numVaryings = 0;
+};
+
+PipelineState::PipelineState() {
+  impl = std::make_unique<Impl>();
+}
+PipelineState::~PipelineState() {}
+
+struct VertexStream {
+  const std::byte* data;
+  uint32_t sizeInBytes;
+  uint32_t strideInBytes;
+};
+
+// Commands are recorded like into a command list and only run by Present()
+// or FlushAndWait(), so buffers have to stay alive until then
+struct ClearCommand {
+  std::vector<uint32_t>* renderTarget;
+  uint32_t color;
+};
+
+struct DrawCommand {
+  std::vector<uint32_t>* renderTarget;
+  const PipelineState::Impl* pipelineState;
+  Viewport viewport;
+  SurfaceSize scissorRect;
+  PrimitiveTopology primitiveTopology;
+  std::vector<VertexStream> vertexBuffers;
+  std::span<const uint32_t> indices;
+  std::vector<std::span<const std::byte>> resources;
+
+  uint32_t indexCountPerInstance;
+  uint32_t instanceCount;
+  uint32_t startIndexLocation;
+  int32_t baseVertexLocation;
+  uint32_t startInstanceLocation;
+};
+
+using Command = std::variant<ClearCommand, DrawCommand>;
+
+struct VidDriver::Impl {
+  void Execute();
+  void BeginBinning(std::vector<uint32_t>* renderTarget);
+  void BinDraw(const DrawCommand& draw);
+  void RasterizeBins();
+
+  std::weak_ptr<Display> display;
+  std::unique_ptr<ThreadPool> threadPool;
+
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::array<std::vector<uint32_t>, kMaxGpuFramesInFlight> backBuffers;
+
+  // Bound state, copied into every recorded draw
+  std::vector<uint32_t>* renderTarget = nullptr;
+  const PipelineState::Impl* pipelineState = nullptr;
+  Viewport viewport;
+  SurfaceSize scissorRect = {0, 0, INT32_MAX, INT32_MAX};
+  PrimitiveTopology primitiveTopology = PrimitiveTopology::Undefined;
+  std::vector<VertexStream> vertexBuffers;
+  std::span<const uint32_t> indices;
+  std::vector<std::span<const std::byte>> resources;
+
+  std::vector<Command> commands;
+
+  // Commands for one render target are binned into tiles first, then tiles
+  // are rasterized in parallel, each by one thread and in submission order
+  std::vector<uint32_t>* binnedTarget = nullptr;
+  uint32_t tilesX = 0;
+  uint32_t tilesY = 0;
+  std::vector<std::vector<uint32_t>> bins;
+  std::vector<Triangle> triangles;
+  std::vector<uint32_t> clearColors;
+
+  std::vector<SwVertexOutput> vertices;
+  std::vector<TriangleBatch> triangleBatches;
+  std::vector<std::byte> zeroVertex;  // fetched for indices out of bounds
+};
+
+VidDriver::VidDriver() {
+  impl = std::make_unique<Impl>();
+}
+VidDriver::~VidDriver() {}
+
+void VidDriver::Impl::Execute() {
+  for (const Command& command : commands) {
+    std::vector<uint32_t>* target = std::visit(
+        [](const auto& command) { return command.renderTarget; }, command);
+    if (target != binnedTarget) {
+      RasterizeBins();
+      BeginBinning(target);
+    }
+
+    if (const ClearCommand* clear = std::get_if<ClearCommand>(&command)) {
+      const uint32_t entry =
+          kClearEntry | static_cast<uint32_t>(clearColors.size());
+      clearColors.push_back(clear->color);
+      for (std::vector<uint32_t>& bin : bins) {
+        bin.push_back(entry);
+      }
+    } else {
+      BinDraw(std::get<DrawCommand>(command));
+    }
+  }
+
+  RasterizeBins();
+  commands.clear();
+}
+
+void VidDriver::Impl::BeginBinning(std::vector<uint32_t>* renderTarget) {
+  binnedTarget = renderTarget;
+  tilesX = (width + kTileSize - 1) / kTileSize;
+  tilesY = (height + kTileSize - 1) / kTileSize;
+  bins.resize(tilesX * tilesY);
+}
+
+void VidDriver::Impl::BinDraw(const DrawCommand& draw) {
+  const bool strip =
+      draw.primitiveTopology == PrimitiveTopology::Trianglestrip;
+  // TODO: support points and lines
+  if (draw.pipelineState == nullptr ||
+      (!strip && draw.primitiveTopology != PrimitiveTopology::Trianglelist)) {
+    return;
+  }
+
+  const size_t startIndex =
+      std::min<size_t>(draw.startIndexLocation, draw.indices.size());
+  const std::span<const uint32_t> drawIndices = draw.indices.subspan(
+      startIndex, std::min<size_t>(draw.indexCountPerInstance,
+                                   draw.indices.size() - startIndex));
+  const uint32_t numTriangles = static_cast<uint32_t>(
+      strip ? std::max<size_t>(drawIndices.size(), 2) - 2
+            : drawIndices.size() / 3);
+  if (numTriangles == 0) {
+    return;
+  }
+
+  const SetupContext context = {
+      .viewport = draw.viewport,
+      .rect =
+          {
+              .left = std::max(draw.scissorRect.left, 0),
+              .top = std::max(draw.scissorRect.top, 0),
+              .right = std::min(draw.scissorRect.right,
+                                static_cast<int32_t>(width)),
+              .bottom = std::min(draw.scissorRect.bottom,
+                                 static_cast<int32_t>(height)),
+          },
+      .numVaryings = draw.pipelineState->numVaryings,
+      .pixelShader = draw.pipelineState->pixelShader,
+      .tilesX = tilesX,
+  };
+  if (context.rect.left >= context.rect.right ||
+      context.rect.top >= context.rect.bottom) {
+    return;
+  }
+
+  // Every vertex in the range of the indices is shaded once per instance
+  const auto [minIndex, maxIndex] =
+      std::minmax_element(drawIndices.begin(), drawIndices.end());
+  const uint32_t firstIndex = *minIndex;
+  const uint32_t numVertices = *maxIndex - *minIndex + 1;
+  const uint32_t numVertexBatches =
+      (numVertices + kVertexBatch - 1) / kVertexBatch;
+  const uint32_t numTriangleBatches =
+      (numTriangles + kTriangleBatch - 1) / kTriangleBatch;
+  const size_t numVertexBuffers =
+      std::min<size_t>(draw.vertexBuffers.size(), kSwMaxVertexBuffers);
+
+  uint32_t maxStride = 0;
+  for (const VertexStream& stream : draw.vertexBuffers) {
+    maxStride = std::max(maxStride, stream.strideInBytes);
+  }
+  if (zeroVertex.size() < maxStride) {
+    zeroVertex.resize(maxStride);
+  }
+  vertices.resize(numVertices);
+  if (triangleBatches.size() < numTriangleBatches) {
+    triangleBatches.resize(numTriangleBatches);
+  }
+
+  for (uint32_t instance = 0; instance < draw.instanceCount; ++instance) {
+    threadPool->ParallelFor(numVertexBatches, [&](uint32_t batch) {
+      const std::byte* elements[kSwMaxVertexBuffers];
+      const uint32_t end = std::min(numVertices, (batch + 1) * kVertexBatch);
+      for (uint32_t i = batch * kVertexBatch; i < end; ++i) {
+        const int64_t vertexId =
+            static_cast<int64_t>(firstIndex) + i + draw.baseVertexLocation;
+        for (size_t j = 0; j < numVertexBuffers; ++j) {
+          const VertexStream& stream = draw.vertexBuffers[j];
+          const int64_t offset = vertexId * stream.strideInBytes;
+          elements[j] = vertexId >= 0 && offset + stream.strideInBytes <=
+                                             stream.sizeInBytes
+                            ? stream.data + offset
+                            : zeroVertex.data();
+        }
+
+        const SwVertexInput input = {
+            .vertices = std::span(elements, numVertexBuffers),
+            .resources = draw.resources,
+            .vertexId = static_cast<uint32_t>(vertexId),
+            .instanceId = draw.startInstanceLocation + instance,
+        };
+        draw.pipelineState->vertexShader(input, vertices[i]);
+      }
+    });
+
+    threadPool->ParallelFor(numTriangleBatches, [&](uint32_t batch) {
+      TriangleBatch& triangleBatch = triangleBatches[batch];
+      triangleBatch.triangles.clear();
+      triangleBatch.binEntries.clear();
+
+      const uint32_t end = std::min(numTriangles, (batch + 1) * kTriangleBatch);
+      for (uint32_t i = batch * kTriangleBatch; i < end; ++i) {
+        uint32_t corners[3] = {3 * i, 3 * i + 1, 3 * i + 2};
+        if (strip) {
+          // every other triangle of a strip is flipped back to keep winding
+          corners[0] = i;
+          corners[1] = i + 1 + (i & 1);
+          corners[2] = i + 2 - (i & 1);
+        }
+
+        const SwVertexOutput* triangle[3];
+        for (uint32_t j = 0; j < 3; ++j) {
+          triangle[j] = &vertices[drawIndices[corners[j]] - firstIndex];
+        }
+        ClipAndSetupTriangle(triangle, context, triangleBatch);
+      }
+    });
+
+    for (uint32_t batch = 0; batch < numTriangleBatches; ++batch) {
+      TriangleBatch& triangleBatch = triangleBatches[batch];
+      const uint32_t base = static_cast<uint32_t>(triangles.size());
+      triangles.insert(triangles.end(), triangleBatch.triangles.begin(),
+                       triangleBatch.triangles.end());
+      for (auto [tile, triangle] : triangleBatch.binEntries) {
+        bins[tile].push_back(base + triangle);
+      }
+    }
+  }
+}
+
+void VidDriver::Impl::RasterizeBins() {
+  if (binnedTarget == nullptr) {
+    return;
+  }
+
+  uint32_t* pixels = binnedTarget->data();
+  threadPool->ParallelFor(
+      static_cast<uint32_t>(bins.size()), [&](uint32_t tileIndex) {
+        const int32_t tileX = static_cast<int32_t>(tileIndex % tilesX);
+        const int32_t tileY = static_cast<int32_t>(tileIndex / tilesX);
+        const PixelRect tile = {
+            .left = tileX * kTileSize,
+            .top = tileY * kTileSize,
+            .right = std::min((tileX + 1) * kTileSize,
+                              static_cast<int32_t>(width)),
+            .bottom = std::min((tileY + 1) * kTileSize,
+                               static_cast<int32_t>(height)),
+        };
+
+        std::vector<uint32_t>& bin = bins[tileIndex];
+        for (uint32_t entry : bin) {
+          if (entry & kClearEntry) {
+            ClearTile(clearColors[entry & ~kClearEntry], tile, pixels, width);
+          } else {
+            RasterizeTriangle(triangles[entry], tile, pixels, width);
+          }
+        }
+        bin.clear();
+      });
+
+  triangles.clear();
+  clearColors.clear();
+  binnedTarget = nullptr;
+}
+
+void VidDriver::InitAPI(std::weak_ptr<Display> display) {
+  impl->display = display;
+
+  uint32_t numThreads = std::thread::hardware_concurrency();
+  if (const char* threads = std::getenv("VIDDRIVER_SW_THREADS")) {
+    numThreads = static_cast<uint32_t>(std::strtoul(threads, nullptr, 10));
+  }
+  impl->threadPool = std::make_unique<ThreadPool>(std::max(numThreads, 1u));
+
+  std::shared_ptr<Display> displayPtr = display.lock();
+  impl->width = displayPtr->Width();
+  impl->height = displayPtr->Height();
+  CreateBackBuffers();
+}
+
+void VidDriver::ResizeSwapChain(uint32_t width, uint32_t height) {
+  FlushAndWait();
+
+  impl->width = width;
+  impl->height = height;
+  CreateBackBuffers();
+}
+
+void VidDriver::CreateBackBuffers() {
+  for (std::vector<uint32_t>& backBuffer : impl->backBuffers) {
+    backBuffer.assign(static_cast<size_t>(impl->width) * impl->height, 0);
+  }
+}
+
+void VidDriver::BeginFrame() {}
+
+void VidDriver::Present() {
+  impl->Execute();
+
+  const uint32_t bufferIndex = frameNumber % kMaxGpuFramesInFlight;
+  impl->display.lock()->ShowFrame(impl->backBuffers[bufferIndex], impl->width,
+                                  impl->height);
+}
+
+void VidDriver::EndFrame() {
+  ++frameNumber;
+}
+
+// Buffers live in system memory, so there is nothing to stage
+void VidDriver::UploadBuffer(void* data,
+                             uint64_t sizeInBytes,
+                             std::reference_wrapper<Buffer> dstBuffer) {
+  std::vector<std::byte>& dst = dstBuffer.get().impl->data;
+  dst.resize(sizeInBytes);
+  std::memcpy(dst.data(), data, sizeInBytes);
+}
+
+std::unique_ptr<VertexBuffer> VidDriver::CreateVertexBuffer(
+    std::span<float> vertices,
+    uint32_t strideInBytes) {
+  std::unique_ptr<VertexBuffer> vertexBuffer = std::make_unique<VertexBuffer>();
+  vertexBuffer->buffer.sizeInBytes = vertices.size_bytes();
+
+  UploadBuffer(vertices.data(), vertices.size_bytes(), vertexBuffer->buffer);
+
+  vertexBuffer->impl->strideInBytes = strideInBytes;
+
+  return vertexBuffer;
+}
+
+std::unique_ptr<IndexBuffer> VidDriver::CreateIndexBuffer(
+    std::span<uint32_t> indices) {
+  std::unique_ptr<IndexBuffer> indexBuffer = std::make_unique<IndexBuffer>();
+  indexBuffer->buffer.sizeInBytes = indices.size_bytes();
+
+  UploadBuffer(indices.data(), indices.size_bytes(), indexBuffer->buffer);
+
+  return indexBuffer;
+}
+
+std::unique_ptr<ConstantBuffer> VidDriver::CreateConstantBuffer(
+    std::reference_wrapper<Buffer> buffer) {
+  std::unique_ptr<ConstantBuffer> constantBuffer =
+      std::make_unique<ConstantBuffer>();
+  constantBuffer->impl->buffer = &buffer.get();
+  return constantBuffer;
+}
+
+// TODO: make normal bind parameters
+std::unique_ptr<ShaderResourceViewBuffer>
+VidDriver::CreateShaderResourceViewBuffer(std::reference_wrapper<Buffer> buffer,
+                                          bool /*isIndexBuffer*/,
+                                          uint32_t /*numElements*/,
+                                          uint32_t /*structureByteStride*/) {
+  std::unique_ptr<ShaderResourceViewBuffer> srvBuffer =
+      std::make_unique<ShaderResourceViewBuffer>();
+  srvBuffer->impl->buffer = &buffer.get();
+  return srvBuffer;
+}
+
+// The "binary" of a software shader is its entry point, looked up by
+// CreatePipelineState() among registered shaders
+std::unique_ptr<Shader> VidDriver::CompileShaderFromSource(
+    std::string_view /*shaderSource*/,
+    std::span<const wchar_t*> args) {
+  std::string entryPoint;
+  for (size_t i = 0; i < args.size(); ++i) {
+    std::wstring_view arg = args[i];
+    if (!arg.starts_with(L"-E")) {
+      continue;
+    }
+    arg.remove_prefix(2);
+    if (arg.empty() && i + 1 < args.size()) {
+      arg = args[++i];
+    }
+    arg.remove_prefix(std::min(arg.find_first_not_of(L' '), arg.size()));
+    // entry points are ASCII identifiers
+    for (wchar_t c : arg) {
+      entryPoint.push_back(static_cast<char>(c));
+    }
+  }
+  if (entryPoint.empty()) {
+    throw std::runtime_error("Shader entry point is not given with -E");
+  }
+
+  std::unique_ptr<Shader> shader = std::make_unique<Shader>();
+  shader->binary.resize(entryPoint.size());
+  std::memcpy(shader->binary.data(), entryPoint.data(), entryPoint.size());
+  return shader;
+}
+
+// TODO: support more options
+std::unique_ptr<PipelineState> VidDriver::CreatePipelineState(
+    std::span<std::byte> vsShaderByteCode,
+    std::span<std::byte> psShaderByteCode) {
+  const ShaderRegistry& registry = GetShaderRegistry();
+  const std::string_view vsEntryPoint(
+      reinterpret_cast<const char*>(vsShaderByteCode.data()),
+      vsShaderByteCode.size());
+  const std::string_view psEntryPoint(
+      reinterpret_cast<const char*>(psShaderByteCode.data()),
+      psShaderByteCode.size());
+
+  auto vertexShader = registry.vertexShaders.find(vsEntryPoint);
+  if (vertexShader == registry.vertexShaders.end()) {
+    throw std::runtime_error("Unknown software vertex shader: " +
+                             std::string(vsEntryPoint));
+  }
+  auto pixelShader = registry.pixelShaders.find(psEntryPoint);
+  if (pixelShader == registry.pixelShaders.end()) {
+    throw std::runtime_error("Unknown software pixel shader: " +
+                             std::string(psEntryPoint));
+  }
+
+  std::unique_ptr<PipelineState> pso = std::make_unique<PipelineState>();
+  pso->impl->vertexShader = vertexShader->second.first;
+  pso->impl->numVaryings = vertexShader->second.second;
+  pso->impl->pixelShader = pixelShader->second;
+  return pso;
+}
+
+void VidDriver::FlushAndWait() {
+  impl->Execute();
+}
+
+void VidDriver::SetPipelineState(
+    std::reference_wrapper<PipelineState> pipelineState) {
+  impl->pipelineState = pipelineState.get().impl.get();
+}
+
+void VidDriver::BindShaderResourceViewBuffers(
+    std::vector<std::reference_wrapper<ShaderResourceViewBuffer>> buffers) {
+  impl->resources.clear();
+  for (std::reference_wrapper<ShaderResourceViewBuffer> buffer : buffers) {
+    impl->resources.emplace_back(buffer.get().impl->buffer->impl->data);
+  }
+}
+
+// Only the first viewport and scissor rect are used, there is no
+// SV_ViewportArrayIndex
+void VidDriver::SetViewports(std::span<Viewport> viewports) {
+  if (!viewports.empty()) {
+    impl->viewport = viewports.front();
+  }
+}
+
+void VidDriver::SetScissorRects(std::span<SurfaceSize> surfaceSizes) {
+  if (!surfaceSizes.empty()) {
+    impl->scissorRect = surfaceSizes.front();
+  }
+}
+
+// TODO: implement texture
+void VidDriver::SetRenderTargets() {
+  const uint32_t bufferIndex = frameNumber % kMaxGpuFramesInFlight;
+  impl->renderTarget = &impl->backBuffers[bufferIndex];
+}
+
+// TODO: implement texture
+void VidDriver::ClearRenderTarget(const float clearColor[4]) {
+  if (impl->renderTarget == nullptr) {
+    return;
+  }
+
+  uint32_t color = 0;
+  for (uint32_t i = 0; i < 4; ++i) {
+    const float channel = std::clamp(clearColor[i], 0.f, 1.f);
+    color |= static_cast<uint32_t>(std::lrint(channel * 255.f)) << (8 * i);
+  }
+  impl->commands.emplace_back(ClearCommand{impl->renderTarget, color});
+}
+
+void VidDriver::SetPrimitiveTopology(PrimitiveTopology primitiveTopology) {
+  impl->primitiveTopology = primitiveTopology;
+}
+
+void VidDriver::SetVertexBuffers(
+    std::span<std::reference_wrapper<VertexBuffer>> vertexBuffers) {
+  impl->vertexBuffers.clear();
+  for (std::reference_wrapper<VertexBuffer> vertexBuffer : vertexBuffers) {
+    const std::vector<std::byte>& data = vertexBuffer.get().buffer.impl->data;
+    impl->vertexBuffers.push_back({
+        .data = data.data(),
+        .sizeInBytes = static_cast<uint32_t>(data.size()),
+        .strideInBytes = vertexBuffer.get().impl->strideInBytes,
+    });
+  }
+}
+
+void VidDriver::SetIndexBuffer(
+    std::reference_wrapper<IndexBuffer> indexBuffer) {
+  const std::vector<std::byte>& data = indexBuffer.get().buffer.impl->data;
+  impl->indices = std::span(reinterpret_cast<const uint32_t*>(data.data()),
+                            data.size() / sizeof(uint32_t));
+}
+
+void VidDriver::DrawIndexedInstanced(uint32_t indexCountPerInstance,
+                                     uint32_t instanceCount,
+                                     uint32_t startIndexLocation,
+                                     int32_t baseVertexLocation,
+                                     uint32_t startInstanceLocation) {
+  if (impl->renderTarget == nullptr) {
+    return;
+  }
+
+  impl->commands.emplace_back(DrawCommand{
+      .renderTarget = impl->renderTarget,
+      .pipelineState = impl->pipelineState,
+      .viewport = impl->viewport,
+      .scissorRect = impl->scissorRect,
+      .primitiveTopology = impl->primitiveTopology,
+      .vertexBuffers = impl->vertexBuffers,
+      .indices = impl->indices,
+      .resources = impl->resources,
+      .indexCountPerInstance = indexCountPerInstance,
+      .instanceCount = instanceCount,
+      .startIndexLocation = startIndexLocation,
+      .baseVertexLocation = baseVertexLocation,
+      .startInstanceLocation = startInstanceLocation,
+  });
+}
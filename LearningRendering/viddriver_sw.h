@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// Shaders of the software backend (viddriver_sw.cpp). It can't run HLSL, so
+// VidDriver::CompileShaderFromSource only picks the "-E" entry point among the
+// shaders registered here; main_VS and main_PS of triangle.*.hlsl are built in.
+
+inline constexpr uint32_t kSwMaxVertexBuffers = 16;
+inline constexpr uint32_t kSwMaxVaryings = 16;
+inline constexpr uint32_t kSwPixelLanes = 8;
+
+struct SwVertexInput {
+  // element of the vertex in each bound vertex buffer
+  std::span<const std::byte* const> vertices;
+  // bound shader resource view buffers
+  std::span<const std::span<const std::byte>> resources;
+  uint32_t vertexId;
+  uint32_t instanceId;
+};
+
+struct SwVertexOutput {
+  float position[4];  // SV_Position, in clip space
+  float varyings[kSwMaxVaryings];
+};
+
+// kSwPixelLanes pixels of a row at once, laid out by component so that loops
+// over lanes vectorize. Lanes outside of the triangle are shaded too and thrown
+// away afterwards.
+struct SwPixelBlock {
+  float varyings[kSwMaxVaryings][kSwPixelLanes];
+  float color[4][kSwPixelLanes];  // SV_Target0, RGBA
+};
+
+using SwVertexShader = void (*)(const SwVertexInput& input,
+                                SwVertexOutput& output);
+using SwPixelShader = void (*)(SwPixelBlock& block);
+
+void RegisterSwVertexShader(std::string_view entryPoint,
+                            SwVertexShader shader,
+                            uint32_t numVaryings);
+void RegisterSwPixelShader(std::string_view entryPoint, SwPixelShader shader);
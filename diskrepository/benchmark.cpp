@@ -0,0 +1,466 @@
+#include "diskrepository.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// Prints one JSON object per scenario inside a JSON array, so results can be collected
+// by a script and compared between runs:
+//   diskrepository_benchmark [directory for spill files]
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Result
+{
+    std::string name;
+    size_t records{0};
+    size_t bytes{0};
+    double seconds{0};
+    std::vector<double> latencies; // microseconds, empty if scenario doesn't measure them
+};
+
+class Reporter final
+{
+public:
+    ~Reporter()
+    {
+        std::printf("%s]\n", first ? "[" : "\n");
+    }
+
+    void report(Result result)
+    {
+        std::printf("%s\n  {\"name\": \"%s\", \"records\": %zu, \"bytes\": %zu, \"seconds\": %.6f, "
+                    "\"records_per_sec\": %.1f, \"mb_per_sec\": %.2f",
+            first ? "[" : ",", result.name.c_str(), result.records, result.bytes, result.seconds,
+            result.records / result.seconds, result.bytes / result.seconds / (1 << 20));
+
+        if (!result.latencies.empty())
+        {
+            auto &latencies = result.latencies;
+            std::sort(latencies.begin(), latencies.end());
+            auto percentile = [&](double p) {
+                return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+            };
+            std::printf(", \"latency_us\": {\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, "
+                        "\"max\": %.2f}",
+                percentile(.5), percentile(.9), percentile(.99), latencies.back());
+        }
+
+        std::printf("}");
+        std::fflush(stdout);
+        first = false;
+    }
+
+private:
+    bool first{true};
+};
+
+double since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void check(std::error_code ec, const char *what)
+{
+    if (ec)
+    {
+        std::fprintf(stderr, "%s: %s\n", what, ec.message().c_str());
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+size_t recordSize(uint64_t)
+{
+    return sizeof(uint64_t);
+}
+
+size_t recordSize(const std::string &value)
+{
+    return sizeof(size_t) + value.size();
+}
+
+// fills ring up and drains it back, many times
+template<typename... Args>
+Result pushPull(const char *name, size_t ringSize, size_t rounds, const Args &...args)
+{
+    DiskRepository<false, Args...> repository("", ringSize);
+    check(repository.open(), "open");
+
+    Result result;
+    result.name = name;
+    size_t record = (recordSize(args) + ...);
+    std::tuple<Args...> out;
+
+    auto start = Clock::now();
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        while (repository.push(args...))
+        {
+            ++result.records;
+        }
+
+        while (std::apply([&](auto &...fields) { return repository.pull(fields...); }, out))
+        {
+        }
+    }
+    result.seconds = since(start);
+    result.bytes = result.records * record;
+
+    check(repository.close(), "close");
+    return result;
+}
+
+// Routes records of an ingest ring to per-tenant rings by a key field, either pulling and
+// pushing every record again or moving their bytes with transferIf()
+template<bool Transfer>
+Result route(const char *name, size_t rounds)
+{
+    constexpr size_t tenants = 4;
+    using Repository = DiskRepository<false, uint32_t, std::string, uint64_t>;
+    Repository ingest("", 1 << 20);
+    check(ingest.open(), "open");
+    std::vector<std::unique_ptr<Repository>> queues;
+    for (size_t tenant = 0; tenant < tenants; ++tenant)
+    {
+        queues.push_back(std::make_unique<Repository>("", 1 << 20));
+        check(queues.back()->open(), "open");
+    }
+
+    Result result;
+    result.name = name;
+    std::string value = "tenant-0042/host-0007/metric";
+    uint32_t key{0};
+    std::tuple<uint32_t, std::string, uint64_t> record;
+
+    auto start = Clock::now();
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        while (ingest.push(key, value, uint64_t(key) * 7))
+        {
+            ++key;
+            ++result.records;
+            result.bytes += sizeof(uint32_t) + sizeof(uint64_t) * 2 + value.size();
+        }
+
+        if constexpr (Transfer)
+        {
+            for (size_t tenant = 0; tenant < tenants; ++tenant)
+            {
+                auto [ec, moved] = ingest.template transferIf<0>(
+                    *queues[tenant], [&](uint32_t id) { return id % tenants == tenant; });
+                check(ec, "transferIf");
+            }
+        }
+        else
+        {
+            while (std::apply([&](auto &...fields) { return ingest.pull(fields...); }, record))
+            {
+                auto &queue = *queues[std::get<0>(record) % tenants];
+                if (!std::apply([&](auto &...fields) { return queue.push(fields...); }, record))
+                {
+                    std::fprintf(stderr, "route: tenant queue full\n");
+                    std::exit(EXIT_FAILURE);
+                }
+            }
+        }
+
+        for (auto &queue : queues)
+        {
+            queue->reset();
+        }
+    }
+    result.seconds = since(start);
+
+    check(ingest.close(), "close");
+    for (auto &queue : queues)
+    {
+        check(queue->close(), "close");
+    }
+    return result;
+}
+
+// ring is kept half full with records that don't divide its capacity, so every few
+// operations a record crosses the end of the first mapping
+Result wrapAround(size_t operations)
+{
+    DiskRepository<false, uint64_t, std::string> repository("", 4096);
+    check(repository.open(), "open");
+
+    Result result;
+    result.name = "wrap_around";
+    std::string value(77, 'w');
+    uint64_t key{0};
+    std::string out;
+
+    while (repository.push(key, value) && key < 25)
+    {
+        ++key;
+    }
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < operations; ++i)
+    {
+        if (!repository.push(key, value) || !repository.pull(key, out))
+        {
+            std::fprintf(stderr, "wrap_around: unexpected full or empty ring\n");
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    result.seconds = since(start);
+    result.records = operations;
+    result.bytes = operations * (sizeof(uint64_t) + sizeof(size_t) + value.size());
+
+    check(repository.close(), "close");
+    return result;
+}
+
+// spills whole ring and brings it back, each flush() and refill() is timed
+Result flushRefill(const char *name, const std::filesystem::path &directory,
+    DiskRepositoryOptions options, size_t chunks)
+{
+    auto filename = directory / "diskrepository_benchmark.spill";
+    std::filesystem::remove(filename);
+    std::filesystem::remove(std::filesystem::path(filename).concat(".idx"));
+
+    DiskRepository<true, uint64_t, std::string> repository(filename, 1 << 20, options);
+    check(repository.open(), "open");
+
+    Result result;
+    result.name = name;
+    std::string value = "tenant-0042/host-0007/metric";
+    uint64_t key{0};
+
+    auto start = Clock::now();
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+        while (repository.push(key, value))
+        {
+            ++key;
+        }
+
+        auto flushStart = Clock::now();
+        check(repository.flush(), "flush");
+        result.latencies.push_back(since(flushStart) * 1e6);
+    }
+
+    // paced flushes may have written more chunks than flush() calls
+    for (;;)
+    {
+        auto refillStart = Clock::now();
+        auto [ec, size] = repository.tellDataSize();
+        check(ec, "tellDataSize");
+        if (size == 0)
+        {
+            break;
+        }
+        check(repository.refill(size), "refill");
+        result.latencies.push_back(since(refillStart) * 1e6);
+        result.bytes += size * 2;
+    }
+    result.seconds = since(start);
+    result.records = key * 2;
+
+    check(repository.close(), "close");
+    std::filesystem::remove(filename);
+    std::filesystem::remove(std::filesystem::path(filename).concat(".idx"));
+    return result;
+}
+
+// counts and sums one integral field over spilled chunks, row-wise or columnar ones
+Result spillScan(const char *name, const std::filesystem::path &directory,
+    DiskRepositoryOptions options, size_t chunks, size_t scans)
+{
+    auto filename = directory / "diskrepository_benchmark.spill";
+    std::filesystem::remove(filename);
+    std::filesystem::remove(std::filesystem::path(filename).concat(".idx"));
+
+    DiskRepository<true, uint64_t, std::string, uint32_t> repository(filename, 1 << 20, options);
+    check(repository.open(), "open");
+
+    Result result;
+    result.name = name;
+    std::string value = "tenant-0042/host-0007/metric";
+    uint64_t key{0};
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+        while (repository.push(key, value, uint32_t(key * 2654435761u)))
+        {
+            ++key;
+        }
+        check(repository.flush(), "flush");
+    }
+
+    auto [ec, size] = repository.tellDataSize();
+    check(ec, "tellDataSize");
+    uint64_t matched{0};
+    auto start = Clock::now();
+    for (size_t scan = 0; scan < scans; ++scan)
+    {
+        auto scanStart = Clock::now();
+        auto [countEc, count] = repository.scanCount<2>(ColumnCompare::Less, 1u << 31);
+        check(countEc, "scanCount");
+        auto [sumEc, sum] = repository.scanSum<2>();
+        check(sumEc, "scanSum");
+        matched += count + (sum & 1);
+        result.latencies.push_back(since(scanStart) * 1e6);
+    }
+    result.seconds = since(start);
+    result.records = key * scans * 2;
+    result.bytes = size * scans * 2;
+
+    if (matched == 0)
+    {
+        std::fprintf(stderr, "scan matched nothing\n");
+    }
+
+    check(repository.close(), "close");
+    std::filesystem::remove(filename);
+    std::filesystem::remove(std::filesystem::path(filename).concat(".idx"));
+    return result;
+}
+
+// DiskRepository itself is not synchronized, so pairs share one instance under a mutex,
+// which is how it has to be used across threads. Each side holds the mutex for a batch of
+// up to batchSize records and sleeps on a condition variable while ring is full or empty,
+// so the figure is that of the repository handing records over, not of the lock bouncing
+// between threads.
+Result producerConsumer(size_t pairs, size_t recordsPerPair, size_t batchSize)
+{
+    struct Pair
+    {
+        DiskRepository<false, uint64_t, std::string> repository{"", 1 << 16};
+        std::mutex mutex;
+        std::condition_variable pushed;
+        std::condition_variable pulled;
+    };
+
+    std::vector<std::unique_ptr<Pair>> instances;
+    for (size_t i = 0; i < pairs; ++i)
+    {
+        instances.push_back(std::make_unique<Pair>());
+        check(instances.back()->repository.open(), "open");
+    }
+
+    Result result;
+    result.name = "producer_consumer_x" + std::to_string(pairs);
+    std::string value(24, 'p');
+    std::vector<std::thread> threads;
+
+    auto start = Clock::now();
+    for (auto &instance : instances)
+    {
+        threads.emplace_back([&, pair = instance.get()] {
+            for (uint64_t key = 0; key < recordsPerPair;)
+            {
+                std::unique_lock lock(pair->mutex);
+                uint64_t batchEnd = std::min<uint64_t>(key + batchSize, recordsPerPair);
+                uint64_t first = key;
+                while (key < batchEnd && pair->repository.push(key, value))
+                {
+                    ++key;
+                }
+
+                if (key == first)
+                {
+                    pair->pulled.wait(lock);
+                    continue;
+                }
+                lock.unlock();
+                pair->pushed.notify_one();
+            }
+        });
+        threads.emplace_back([&, pair = instance.get()] {
+            uint64_t key;
+            std::string out;
+            for (size_t pulled = 0; pulled < recordsPerPair;)
+            {
+                std::unique_lock lock(pair->mutex);
+                size_t first = pulled;
+                while (pulled - first < batchSize && pair->repository.pull(key, out))
+                {
+                    ++pulled;
+                }
+
+                if (pulled == first)
+                {
+                    pair->pushed.wait(lock);
+                    continue;
+                }
+                lock.unlock();
+                pair->pulled.notify_one();
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    result.seconds = since(start);
+    result.records = pairs * recordsPerPair;
+    result.bytes = result.records * (sizeof(uint64_t) + sizeof(size_t) + value.size());
+
+    for (auto &instance : instances)
+    {
+        check(instance->repository.close(), "close");
+    }
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::filesystem::path directory =
+        argc > 1 ? std::filesystem::path(argv[1]) : std::filesystem::temp_directory_path();
+
+    Reporter reporter;
+    reporter.report(pushPull("push_pull_integral", 1 << 20, 64, uint64_t{1}, uint64_t{2}));
+    reporter.report(pushPull("push_pull_short_string", 1 << 20, 64, uint64_t{1},
+        std::string("short-string")));
+    reporter.report(pushPull("push_pull_long_string", 1 << 20, 64, uint64_t{1},
+        std::string(1024, 'l')));
+    reporter.report(wrapAround(1 << 22));
+    reporter.report(route<false>("route_pull_push", 64));
+    reporter.report(route<true>("route_transfer_if", 64));
+    DiskRepositoryOptions options;
+    reporter.report(flushRefill("flush_refill_sync", directory, options, 16));
+    options.directSpill = true;
+    reporter.report(flushRefill("flush_refill_sync_direct", directory, options, 16));
+    options.directSpill = false;
+    options.spillLatencyTarget = 1000000;
+    reporter.report(flushRefill("flush_refill_sync_paced", directory, options, 16));
+    options.spillLatencyTarget = 0;
+    options.syncSpill = false;
+    reporter.report(flushRefill("flush_refill_nosync", directory, options, 16));
+    options.spillCodec = &lzSpillCodec;
+    reporter.report(flushRefill("flush_refill_nosync_lz", directory, options, 16));
+    options.spillCodec = nullptr;
+    options.stringDictionary = 1024;
+    reporter.report(flushRefill("flush_refill_nosync_dictionary", directory, options, 16));
+    options.stringDictionary = 0;
+    reporter.report(spillScan("spill_scan_rows", directory, options, 16, 8));
+    options.columnarSpill = true;
+    reporter.report(spillScan("spill_scan_columnar", directory, options, 16, 8));
+    options.columnarSpill = false;
+
+    reporter.report(producerConsumer(1, 1 << 20, 256));
+    if (size_t pairs = std::thread::hardware_concurrency() / 2; pairs > 1)
+    {
+        reporter.report(producerConsumer(pairs, 1 << 20, 256));
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Everything DiskRepository stores, records in ring and spilled chunks, trailers and headers,
+// is little-endian. On little-endian hosts all of this compiles to plain copies.
+struct ByteOrder
+{
+    static constexpr bool hostLittle = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+    // converts between host order and little-endian, the same operation both ways
+    template<typename T>
+    static constexpr T little(T value) noexcept
+    {
+        static_assert(std::is_integral_v<T>);
+        if constexpr (hostLittle || sizeof(T) == 1)
+        {
+            return value;
+        }
+        else
+        {
+            return static_cast<T>(swap(static_cast<std::make_unsigned_t<T>>(value)));
+        }
+    }
+
+    // unaligned little-endian value at ptr
+    template<typename T>
+    static T load(const char *ptr) noexcept
+    {
+        T value;
+        std::memcpy(&value, ptr, sizeof(T));
+        return little(value);
+    }
+
+    template<typename T>
+    static void store(T value, char *ptr) noexcept
+    {
+        value = little(value);
+        std::memcpy(ptr, &value, sizeof(T));
+    }
+
+    // converts count values of type T at ptr in place, see swapArray()
+    template<typename T>
+    static void littleArray(char *ptr, size_t count) noexcept
+    {
+        static_assert(std::is_integral_v<T>);
+        if constexpr (!hostLittle && sizeof(T) != 1)
+        {
+            swapArray<sizeof(T)>(ptr, count);
+        }
+    }
+
+    // Reverses bytes of each of count Size-byte values at ptr, which may be unaligned. Bulk of
+    // them is done by byte shuffles of whole vectors: pshufb with SSSE3 or AVX2 on x86 (AVX2
+    // is picked at runtime), vperm, tbl and the like elsewhere.
+    template<size_t Size>
+    static void swapArray(char *ptr, size_t count) noexcept
+    {
+        static_assert(Size == 2 || Size == 4 || Size == 8);
+#if defined(__x86_64__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2)
+        {
+            swapArrayAvx2<Size>(ptr, count);
+            return;
+        }
+#endif
+        swapArrayImpl<Size>(ptr, count);
+    }
+
+private:
+    static constexpr size_t vectorSize = 32;
+
+    typedef uint8_t Bytes __attribute__((vector_size(vectorSize)));
+
+    static constexpr uint16_t swap(uint16_t value) noexcept
+    {
+        return __builtin_bswap16(value);
+    }
+
+    static constexpr uint32_t swap(uint32_t value) noexcept
+    {
+        return __builtin_bswap32(value);
+    }
+
+    static constexpr uint64_t swap(uint64_t value) noexcept
+    {
+        return __builtin_bswap64(value);
+    }
+
+#if defined(__x86_64__)
+    template<size_t Size>
+    __attribute__((target("avx2"))) static void swapArrayAvx2(char *ptr, size_t count) noexcept
+    {
+        swapArrayImpl<Size>(ptr, count);
+    }
+#endif
+
+    template<size_t Size>
+    __attribute__((always_inline)) static inline void swapArrayImpl(
+        char *ptr, size_t count) noexcept
+    {
+        using Value = std::conditional_t<Size == 2, uint16_t,
+            std::conditional_t<Size == 4, uint32_t, uint64_t>>;
+        constexpr size_t lanes = vectorSize / Size;
+
+        // byte i of a vector takes byte of the same value mirrored within it
+        Bytes mask;
+        for (size_t byte = 0; byte < vectorSize; ++byte)
+        {
+            mask[byte] = static_cast<uint8_t>(byte / Size * Size + Size - 1 - byte % Size);
+        }
+
+        size_t index{0};
+        for (; count - index >= lanes; index += lanes)
+        {
+            Bytes values;
+            std::memcpy(&values, ptr + index * Size, vectorSize);
+            values = __builtin_shuffle(values, mask);
+            std::memcpy(ptr + index * Size, &values, vectorSize);
+        }
+
+        for (; index < count; ++index)
+        {
+            Value value;
+            std::memcpy(&value, ptr + index * Size, Size);
+            value = swap(value);
+            std::memcpy(ptr + index * Size, &value, Size);
+        }
+    }
+};
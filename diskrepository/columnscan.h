@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+enum class ColumnCompare
+{
+    Equal,
+    NotEqual,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+};
+
+// Predicate and aggregate scans over a column of integers, i.e. a plain array of them that
+// may be unaligned. Loops are written once with GCC vector extensions and compiled twice:
+// for AVX2, used when CPU has it, and for the baseline (SSE2 on x86_64). Both give identical
+// results, sums wrap around like scalar 64-bit arithmetic.
+class ColumnScan final
+{
+public:
+    template<typename T>
+    using Sum = std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>;
+
+    // values among size ones at column that compare to value as given
+    template<typename T>
+    static uint64_t count(
+        const char *column, size_t size, ColumnCompare compare, T value) noexcept
+    {
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>);
+        switch (compare)
+        {
+            case ColumnCompare::Equal:
+                return dispatchCount<T, ColumnCompare::Equal>(column, size, value);
+            case ColumnCompare::NotEqual:
+                return dispatchCount<T, ColumnCompare::NotEqual>(column, size, value);
+            case ColumnCompare::Less:
+                return dispatchCount<T, ColumnCompare::Less>(column, size, value);
+            case ColumnCompare::LessEqual:
+                return dispatchCount<T, ColumnCompare::LessEqual>(column, size, value);
+            case ColumnCompare::Greater:
+                return dispatchCount<T, ColumnCompare::Greater>(column, size, value);
+            case ColumnCompare::GreaterEqual:
+                return dispatchCount<T, ColumnCompare::GreaterEqual>(column, size, value);
+        }
+        return 0;
+    }
+
+    template<typename T>
+    static Sum<T> sum(const char *column, size_t size) noexcept
+    {
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>);
+#if defined(__x86_64__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2)
+        {
+            return sumAvx2<T>(column, size);
+        }
+#endif
+        return sumImpl<T>(column, size);
+    }
+
+    template<ColumnCompare Compare, typename T>
+    static bool matches(T a, T b) noexcept
+    {
+        if constexpr (Compare == ColumnCompare::Equal)
+        {
+            return a == b;
+        }
+        else if constexpr (Compare == ColumnCompare::NotEqual)
+        {
+            return a != b;
+        }
+        else if constexpr (Compare == ColumnCompare::Less)
+        {
+            return a < b;
+        }
+        else if constexpr (Compare == ColumnCompare::LessEqual)
+        {
+            return a <= b;
+        }
+        else if constexpr (Compare == ColumnCompare::Greater)
+        {
+            return a > b;
+        }
+        else
+        {
+            return a >= b;
+        }
+    }
+
+    template<typename T>
+    static bool matches(ColumnCompare compare, T a, T b) noexcept
+    {
+        switch (compare)
+        {
+            case ColumnCompare::Equal:
+                return a == b;
+            case ColumnCompare::NotEqual:
+                return a != b;
+            case ColumnCompare::Less:
+                return a < b;
+            case ColumnCompare::LessEqual:
+                return a <= b;
+            case ColumnCompare::Greater:
+                return a > b;
+            case ColumnCompare::GreaterEqual:
+                return a >= b;
+        }
+        return false;
+    }
+
+private:
+    static constexpr size_t vectorSize = 32;
+
+    // GCC drops vector_size from alias templates of dependent types, but not from typedefs
+    template<typename T, size_t Bytes = vectorSize>
+    struct VectorOf
+    {
+        typedef T type __attribute__((vector_size(Bytes)));
+    };
+
+    template<typename T>
+    using Vector = typename VectorOf<T>::type;
+
+    template<typename T, ColumnCompare Compare>
+    static uint64_t dispatchCount(const char *column, size_t size, T value) noexcept
+    {
+#if defined(__x86_64__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2)
+        {
+            return countAvx2<T, Compare>(column, size, value);
+        }
+#endif
+        return countImpl<T, Compare>(column, size, value);
+    }
+
+#if defined(__x86_64__)
+    template<typename T, ColumnCompare Compare>
+    __attribute__((target("avx2"))) static uint64_t countAvx2(
+        const char *column, size_t size, T value) noexcept
+    {
+        return countImpl<T, Compare>(column, size, value);
+    }
+
+    template<typename T>
+    __attribute__((target("avx2"))) static Sum<T> sumAvx2(
+        const char *column, size_t size) noexcept
+    {
+        return sumImpl<T>(column, size);
+    }
+#endif
+
+    // Lanes of a comparison are all ones when true, so subtracting them counts matches. Lane
+    // counters are as wide as values and are folded into the total before they can overflow.
+    template<typename T, ColumnCompare Compare>
+    __attribute__((always_inline)) static inline uint64_t countImpl(
+        const char *column, size_t size, T value) noexcept
+    {
+        using V = Vector<T>;
+        using Mask = decltype(V() == V());
+        constexpr size_t lanes = sizeof(V) / sizeof(T);
+        constexpr size_t block =
+            std::min<uint64_t>((uint64_t(1) << (8 * sizeof(T) - 1)) - 1, 1 << 16);
+
+        V needle = V() + value;
+        uint64_t total{0};
+        size_t index{0};
+
+        while (size - index >= lanes)
+        {
+            Mask counters{};
+            size_t end = index + std::min(block, (size - index) / lanes) * lanes;
+            for (; index < end; index += lanes)
+            {
+                V values;
+                std::memcpy(&values, column + index * sizeof(T), sizeof(V));
+                countMatches<Compare>(counters, values, needle);
+            }
+
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                total += static_cast<uint64_t>(counters[lane]);
+            }
+        }
+
+        for (; index < size; ++index)
+        {
+            T current;
+            std::memcpy(&current, column + index * sizeof(T), sizeof(T));
+            total += matches<Compare>(current, value);
+        }
+        return total;
+    }
+
+    template<typename T>
+    __attribute__((always_inline)) static inline Sum<T> sumImpl(
+        const char *column, size_t size) noexcept
+    {
+        using V = Vector<T>;
+        constexpr size_t lanes = sizeof(V) / sizeof(T);
+        using Wide = typename VectorOf<Sum<T>, lanes * sizeof(uint64_t)>::type;
+        // lanes are summed unsigned, so overflow wraps instead of being undefined
+        using Sums = typename VectorOf<uint64_t, lanes * sizeof(uint64_t)>::type;
+
+        Sums sums{};
+        size_t index{0};
+        for (; size - index >= lanes; index += lanes)
+        {
+            V values;
+            std::memcpy(&values, column + index * sizeof(T), sizeof(V));
+            sums += reinterpret_cast<Sums>(__builtin_convertvector(values, Wide));
+        }
+
+        uint64_t total{0};
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            total += static_cast<uint64_t>(sums[lane]);
+        }
+
+        for (; index < size; ++index)
+        {
+            T current;
+            std::memcpy(&current, column + index * sizeof(T), sizeof(T));
+            total += static_cast<uint64_t>(static_cast<Sum<T>>(current));
+        }
+        return static_cast<Sum<T>>(total);
+    }
+
+    // vectors are passed by reference, passing them by value changes ABI with AVX enabled
+    template<ColumnCompare Compare, typename V, typename Mask>
+    __attribute__((always_inline)) static inline void countMatches(
+        Mask &counters, const V &a, const V &b) noexcept
+    {
+        if constexpr (Compare == ColumnCompare::Equal)
+        {
+            counters -= a == b;
+        }
+        else if constexpr (Compare == ColumnCompare::NotEqual)
+        {
+            counters -= a != b;
+        }
+        else if constexpr (Compare == ColumnCompare::Less)
+        {
+            counters -= a < b;
+        }
+        else if constexpr (Compare == ColumnCompare::LessEqual)
+        {
+            counters -= a <= b;
+        }
+        else if constexpr (Compare == ColumnCompare::Greater)
+        {
+            counters -= a > b;
+        }
+        else
+        {
+            counters -= a >= b;
+        }
+    }
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include "byteorder.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// CRC-32C (Castagnoli). Uses SSE4.2 crc32 instruction when CPU has it, falls back to
+// slicing-by-8 tables otherwise. Both produce identical values, crc argument allows
+// checksumming data in several pieces: crc32c(crc32c(0, a, n), b, m).
+class Crc32c final
+{
+public:
+    static uint32_t compute(uint32_t crc, const void *data, size_t size) noexcept
+    {
+        static const bool hardware = hasHardwareSupport();
+        const auto *ptr = static_cast<const uint8_t *>(data);
+        return hardware ? computeHardware(crc, ptr, size) : computeSoftware(crc, ptr, size);
+    }
+
+    static uint32_t computeSoftware(uint32_t crc, const uint8_t *ptr, size_t size) noexcept
+    {
+        const auto &table = tables().slices;
+        crc = ~crc;
+
+        // crc register takes bytes in the order they come, i.e. as a little-endian word
+        for (; size >= 8; size -= 8, ptr += 8)
+        {
+            uint64_t word = ByteOrder::load<uint64_t>(reinterpret_cast<const char *>(ptr));
+            word ^= crc;
+            crc = table[7][word & 0xff] ^ table[6][(word >> 8) & 0xff] ^
+                  table[5][(word >> 16) & 0xff] ^ table[4][(word >> 24) & 0xff] ^
+                  table[3][(word >> 32) & 0xff] ^ table[2][(word >> 40) & 0xff] ^
+                  table[1][(word >> 48) & 0xff] ^ table[0][word >> 56];
+        }
+
+        for (; size > 0; --size)
+        {
+            crc = table[0][(crc ^ *ptr++) & 0xff] ^ (crc >> 8);
+        }
+
+        return ~crc;
+    }
+
+#if defined(__x86_64__)
+    // crc32 instruction has latency of 3 cycles and throughput of 1, so long buffers are
+    // split into 3 interleaved streams which are merged afterwards by "appending zeros"
+    // operator, see Mark Adler's crc32c.c for details
+    __attribute__((target("sse4.2"))) static uint32_t computeHardware(
+        uint32_t crc, const uint8_t *ptr, size_t size) noexcept
+    {
+        const auto &t = tables();
+        uint64_t crc0 = ~crc;
+
+        for (; size > 0 && (reinterpret_cast<uintptr_t>(ptr) & 7) != 0; --size)
+        {
+            crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *ptr++);
+        }
+
+        crc0 = interleave<longBlock>(crc0, ptr, size, t.longShift);
+        crc0 = interleave<shortBlock>(crc0, ptr, size, t.shortShift);
+
+        for (; size >= 8; size -= 8, ptr += 8)
+        {
+            crc0 = _mm_crc32_u64(crc0, load64(ptr));
+        }
+
+        for (; size > 0; --size)
+        {
+            crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *ptr++);
+        }
+
+        return ~static_cast<uint32_t>(crc0);
+    }
+#else
+    static uint32_t computeHardware(uint32_t crc, const uint8_t *ptr, size_t size) noexcept
+    {
+        return computeSoftware(crc, ptr, size);
+    }
+#endif
+
+private:
+    static constexpr uint32_t polynomial = 0x82f63b78;
+    static constexpr size_t longBlock = 8192;
+    static constexpr size_t shortBlock = 256;
+
+    using ShiftTable = std::array<std::array<uint32_t, 256>, 4>;
+
+    struct Tables
+    {
+        std::array<std::array<uint32_t, 256>, 8> slices;
+        ShiftTable longShift;
+        ShiftTable shortShift;
+
+        Tables() noexcept
+        {
+            for (uint32_t n = 0; n < 256; ++n)
+            {
+                uint32_t crc = n;
+                for (int k = 0; k < 8; ++k)
+                {
+                    crc = crc & 1 ? (crc >> 1) ^ polynomial : crc >> 1;
+                }
+                slices[0][n] = crc;
+            }
+
+            for (uint32_t n = 0; n < 256; ++n)
+            {
+                for (size_t k = 1; k < slices.size(); ++k)
+                {
+                    uint32_t prev = slices[k - 1][n];
+                    slices[k][n] = slices[0][prev & 0xff] ^ (prev >> 8);
+                }
+            }
+
+            fillShift(longShift, longBlock);
+            fillShift(shortShift, shortBlock);
+        }
+    };
+
+    static const Tables &tables() noexcept
+    {
+        static const Tables instance;
+        return instance;
+    }
+
+    static bool hasHardwareSupport() noexcept
+    {
+#if defined(__x86_64__)
+        return __builtin_cpu_supports("sse4.2");
+#else
+        return false;
+#endif
+    }
+
+    static uint64_t load64(const uint8_t *ptr) noexcept
+    {
+        uint64_t value;
+        std::memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+
+#if defined(__x86_64__)
+    template<size_t Block>
+    __attribute__((target("sse4.2"))) static uint64_t interleave(
+        uint64_t crc0, const uint8_t *&ptr, size_t &size, const ShiftTable &shift) noexcept
+    {
+        for (; size >= Block * 3; size -= Block * 3, ptr += Block * 2)
+        {
+            uint64_t crc1{0};
+            uint64_t crc2{0};
+            const uint8_t *end = ptr + Block;
+
+            do
+            {
+                crc0 = _mm_crc32_u64(crc0, load64(ptr));
+                crc1 = _mm_crc32_u64(crc1, load64(ptr + Block));
+                crc2 = _mm_crc32_u64(crc2, load64(ptr + Block * 2));
+                ptr += 8;
+            } while (ptr < end);
+
+            crc0 = applyShift(shift, static_cast<uint32_t>(crc0)) ^ crc1;
+            crc0 = applyShift(shift, static_cast<uint32_t>(crc0)) ^ crc2;
+        }
+        return crc0;
+    }
+#endif
+
+    static uint32_t applyShift(const ShiftTable &shift, uint32_t crc) noexcept
+    {
+        return shift[0][crc & 0xff] ^ shift[1][(crc >> 8) & 0xff] ^
+               shift[2][(crc >> 16) & 0xff] ^ shift[3][crc >> 24];
+    }
+
+    // operators over GF(2): matrix of 32 columns applied to crc register
+    static uint32_t matrixTimes(const uint32_t *matrix, uint32_t vector) noexcept
+    {
+        uint32_t sum{0};
+        for (; vector != 0; vector >>= 1, ++matrix)
+        {
+            if (vector & 1)
+            {
+                sum ^= *matrix;
+            }
+        }
+        return sum;
+    }
+
+    static void matrixSquare(uint32_t *square, const uint32_t *matrix) noexcept
+    {
+        for (int n = 0; n < 32; ++n)
+        {
+            square[n] = matrixTimes(matrix, matrix[n]);
+        }
+    }
+
+    // builds operator that appends size zero bytes to a crc register
+    static void fillShift(ShiftTable &shift, size_t size) noexcept
+    {
+        uint32_t even[32];
+        uint32_t odd[32];
+
+        odd[0] = polynomial;
+        for (uint32_t n = 1, row = 1; n < 32; ++n, row <<= 1)
+        {
+            odd[n] = row;
+        }
+
+        matrixSquare(even, odd); // 2 zero bits
+        matrixSquare(odd, even); // 4 zero bits
+
+        const uint32_t *op = nullptr;
+        while (true)
+        {
+            matrixSquare(even, odd);
+            size >>= 1;
+            if (size == 0)
+            {
+                op = even;
+                break;
+            }
+            matrixSquare(odd, even);
+            size >>= 1;
+            if (size == 0)
+            {
+                op = odd;
+                break;
+            }
+        }
+
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            shift[0][n] = matrixTimes(op, n);
+            shift[1][n] = matrixTimes(op, n << 8);
+            shift[2][n] = matrixTimes(op, n << 16);
+            shift[3][n] = matrixTimes(op, n << 24);
+        }
+    }
+};
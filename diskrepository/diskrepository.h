@@ -3,20 +3,130 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
+#include <algorithm>
+#include <array>
 #include <cstring>
 #include <system_error>
 #include <filesystem>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
 
-template<bool UseDisk = true, typename... Args>
-class DiskRepository final
+#include "byteorder.h"
+#include "columnscan.h"
+#include "losertree.h"
+#include "memorypressure.h"
+#include "pagebuffer.h"
+#include "repositorystats.h"
+#include "ringheader.h"
+#include "ringsnapshot.h"
+#include "spillcodec.h"
+#include "spillframe.h"
+#include "spillindex.h"
+#include "spillpacer.h"
+#include "spillprefetcher.h"
+#include "stringdictionary.h"
+#include "tracepoints.h"
+
+struct DiskRepositoryOptions
+{
+    // codec applied to chunks on flush, nullptr stores them as is;
+    // refill decodes any codec known to SpillCodecRegistry regardless of this setting
+    const SpillCodec *spillCodec{nullptr};
+
+    // when set, ring is backed by this file instead of an anonymous one and survives restarts:
+    // first page holds RingHeader, ring bytes follow. State is persisted by checkpoint() only,
+    // records pulled after the last checkpoint are delivered again after restart, so push()
+    // doesn't reuse their bytes till the next one. reset() and refill() checkpoint themselves.
+    std::filesystem::path ringFilename;
+
+    // backup file is opened with O_SYNC, so a successful flush() is on stable storage
+    bool syncSpill{true};
+
+    // Backup file is opened with O_DIRECT, so spills bypass page cache: chunks are staged in
+    // a page-aligned buffer and written as whole blocks (frames padded to the file system
+    // block size), reads are done in whole aligned blocks too.
+    bool directSpill{false};
+
+    // When not 0, a helper thread loads up to this many chunks that refill() will take next,
+    // as long as their decoded size fits prefetchBudget. Prefetching starts with prefetch()
+    // and continues after every refill().
+    size_t prefetchDepth{0};
+    size_t prefetchBudget{64 << 20};
+
+    // When not 0, string fields are dictionary encoded with up to this many entries: a string
+    // seen before takes a varint id, a new one is defined inline once. Dictionary starts
+    // over at every chunk boundary, so spilled chunks stay self-contained. Not available
+    // with ringFilename, since dictionary state isn't persisted.
+    size_t stringDictionary{0};
+
+    // Chunks spilled by flush() and flush(args...) are transposed into a column per field,
+    // so scanCount() and scanSum() read just the column they need. refill() and replay()
+    // transpose them back. Only for records of integral and std::string fields, ignored
+    // for others; flushSorted() chunks stay row-wise. Not available with stringDictionary:
+    // columns hold strings in full, so a chunk of a full ring wouldn't fit it on refill().
+    bool columnarSpill{false};
+
+    // When not 0, chunks are sized to take about this many nanoseconds each to write: write
+    // bandwidth and per-write overhead, sync round-trip included, are measured on every chunk
+    // written, and flush() spills ring content larger than what fits the target as several
+    // chunks, so every write and every refill() stays within it (flush() still writes all of
+    // them). Only without stringDictionary and columnarSpill, whose chunks are encoded as a
+    // whole. refill() takes chunks back last first, as always. Decisions are shown in stats.
+    uint64_t spillLatencyTarget{0};
+
+    // With spillLatencyTarget, flush() leaves ring content that is too small to be worth a
+    // write, one spent mostly on overhead, in ring to go with the next flush(). Ring isn't
+    // empty after a successful flush() then, and records left aren't on disk yet.
+    bool coalesceSpill{false};
+
+    // When set, push() asks it every 1024 pushes whether the host is short of memory and
+    // calls relieveMemoryPressure() if so (errors are left to the next flush() to report).
+    // Must outlive the repository. See PsiMemoryPressure and CgroupMemoryPressure.
+    MemoryPressureSource *memoryPressure{nullptr};
+
+    // under memory pressure ring content is spilled once it is this many bytes, 0 for any
+    size_t pressureSpillSize{0};
+};
+
+// State of the backup file found by open(), counts cover all chunks left by previous runs
+struct SpillRecovery
+{
+    size_t frames{0};
+    size_t records{0};
+    size_t dataSize{0};       // bytes that refills will bring back into ring
+    size_t truncatedSize{0};  // bytes of torn tail cut off the file
+};
+
+template<typename T>
+inline constexpr bool isVariantRecord = false;
+
+template<typename... Ts>
+inline constexpr bool isVariantRecord<std::variant<Ts...>> = true;
+
+template<size_t MemoryLanes, size_t SpillLanes, typename... Args>
+class PriorityDiskRepository;
+
+// Stats is a compile-time policy receiving hooks from push/pull/flush/refill, see
+// NullRepositoryStats and RepositoryStats. Use DiskRepository/InstrumentedDiskRepository aliases.
+template<bool UseDisk, typename Stats, typename... Args>
+class BasicDiskRepository final
 {
 public:
-    DiskRepository(std::filesystem::path _filename, size_t size) noexcept
-        : filename(_filename), pageSize(getpagesize())
+    BasicDiskRepository(std::filesystem::path _filename, size_t size,
+        DiskRepositoryOptions _options = {}) noexcept
+        : filename(_filename), options(_options), pageSize(getpagesize()),
+          ringEncoder(_options.stringDictionary), chunkEncoder(_options.stringDictionary)
     {
         bufferCapacity = ((size / pageSize) + 1) * pageSize;
-        writeBackBuffer.clear();
     }
 
     // close() is not called upon error cause there are 2 valid cases of usage
@@ -24,16 +134,42 @@ public:
     //  2. call close() explicitly if program needs to smth further
     [[nodiscard]] std::error_code open() noexcept
     {
-        auto *file = ::tmpfile();
-        if (file == nullptr)
+        int fd{-1};
+        off_t ringOffset{0};
+
+        if (options.stringDictionary != 0 && !options.ringFilename.empty())
         {
-            return std::make_error_code(static_cast<std::errc>(errno));
+            return std::make_error_code(std::errc::invalid_argument);
         }
 
-        int fd = ::fileno(file);
-        if (::ftruncate(fd, bufferCapacity) == -1)
+        if (columnarRecord && options.columnarSpill && options.stringDictionary != 0)
         {
-            return std::make_error_code(static_cast<std::errc>(errno));
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        if (options.ringFilename.empty())
+        {
+            auto *file = ::tmpfile();
+            if (file == nullptr)
+            {
+                return std::make_error_code(static_cast<std::errc>(errno));
+            }
+
+            fd = ::fileno(file);
+            if (::ftruncate(fd, bufferCapacity) == -1)
+            {
+                return std::make_error_code(static_cast<std::errc>(errno));
+            }
+        }
+        else
+        {
+            if (auto ec = openRingFile(); ec)
+            {
+                return ec;
+            }
+
+            fd = ringFile;
+            ringOffset = pageSize;
         }
 
         if (buffer = static_cast<char *>(::mmap(
@@ -43,30 +179,73 @@ public:
             return std::make_error_code(static_cast<std::errc>(errno));
         }
 
-        if (::mmap(buffer, bufferCapacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) ==
-            MAP_FAILED)
+        if (::mmap(buffer, bufferCapacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+                ringOffset) == MAP_FAILED)
         {
             return std::make_error_code(static_cast<std::errc>(errno));
         }
 
         if (::mmap(buffer + bufferCapacity, bufferCapacity, PROT_READ | PROT_WRITE,
-                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+                MAP_SHARED | MAP_FIXED, fd, ringOffset) == MAP_FAILED)
         {
             return std::make_error_code(static_cast<std::errc>(errno));
         }
+        ringFd = fd;
+        ringFdOffset = ringOffset;
+
+        if (ringHeader != nullptr)
+        {
+            restoreCheckpoint();
+        }
 
         if constexpr (UseDisk == true)
         {
-            if (backupFile = ::open(filename.c_str(), O_RDWR | O_CREAT | O_SYNC, S_IRUSR | S_IWUSR);
-                backupFile == -1)
+            // header is a few bytes, O_DIRECT is only set once it is in place
+            int flags = O_RDWR | O_CREAT | (options.syncSpill ? O_SYNC : 0);
+            if (backupFile = ::open(filename.c_str(), flags, S_IRUSR | S_IWUSR); backupFile == -1)
             {
                 return std::make_error_code(static_cast<std::errc>(errno));
             }
 
+            if (auto ec = openHeader(); ec)
+            {
+                return ec;
+            }
+
+            if (options.directSpill)
+            {
+                struct stat st;
+                if (::fstat(backupFile, &st) == -1 ||
+                    ::fcntl(backupFile, F_SETFL, ::fcntl(backupFile, F_GETFL) | O_DIRECT) == -1)
+                {
+                    return std::make_error_code(static_cast<std::errc>(errno));
+                }
+                // padding has to fit SpillFrameTrailer::padding
+                directBlockSize = std::clamp<size_t>(st.st_blksize, 512, 1 << 15);
+            }
+
             if (int err = ::posix_fadvise(backupFile, 0, 0, POSIX_FADV_SEQUENTIAL); err != 0)
             {
                 return std::make_error_code(static_cast<std::errc>(errno));
             }
+
+            if (auto ec = recoverImpl(); ec)
+            {
+                return ec;
+            }
+
+            if (options.prefetchDepth != 0)
+            {
+                prefetcher.configure(
+                    [this](const SpillPrefetcher::Request &request, char *ptr,
+                        PageBuffer &codecBuffer, PageBuffer &readBuffer) {
+                        return readChunk(
+                            request.frameEnd, request.trailer, ptr, codecBuffer, readBuffer);
+                    },
+                    options.prefetchBudget);
+            }
+
+            spillPacer.configure(options.spillLatencyTarget, bufferCapacity);
         }
 
         return std::error_code();
@@ -74,6 +253,32 @@ public:
 
     [[nodiscard]] std::error_code close() noexcept
     {
+        snapshotter.stop();
+        if constexpr (UseDisk == true)
+        {
+            prefetcher.stop();
+        }
+
+        if (ringHeader != nullptr)
+        {
+            if (auto ec = checkpoint(); ec)
+            {
+                return ec;
+            }
+
+            if (::munmap(ringHeader, pageSize) == -1)
+            {
+                return std::make_error_code(static_cast<std::errc>(errno));
+            }
+            ringHeader = nullptr;
+
+            if (::close(ringFile) == -1)
+            {
+                return std::make_error_code(static_cast<std::errc>(errno));
+            }
+            ringFile = -1;
+        }
+
         if (::munmap(buffer, bufferCapacity << 1) == -1)
         {
             return std::make_error_code(static_cast<std::errc>(errno));
@@ -81,6 +286,11 @@ public:
 
         if constexpr (UseDisk == true)
         {
+            if (auto ec = saveIndex(); ec)
+            {
+                return ec;
+            }
+
             if (backupFile != -1 && ::close(backupFile) == -1)
             {
                 return std::make_error_code(static_cast<std::errc>(errno));
@@ -97,307 +307,3514 @@ public:
             return false;
         }
 
+        checkPressure(1);
+        size_t pinned = pinnedSize();
         size_t offset = writeOffset;
-        size_t size = bufferSize;
-        bool ok{false};
+        size_t size = bufferSize + pinned;
+        bool ok{true};
+        if (options.stringDictionary != 0)
+        {
+            ringEncoder.begin();
+        }
 
-        if (((ok = pushImpl(args, offset, size)), ...); ok)
+        if (((ok = ok && pushImpl(args, offset, size)), ...); ok)
         {
+            size -= pinned;
+            repositoryStats.pushed(size - bufferSize, size);
             writeOffset = offset;
+            dirtySize += size - bufferSize;
             bufferSize = size;
+            ++bufferRecords;
+        }
+        else
+        {
+            if (options.stringDictionary != 0)
+            {
+                ringEncoder.rollback();
+            }
+            DISKREPOSITORY_PROBE2(push_full, bufferSize, bufferCapacity);
+            repositoryStats.pushFailed();
         }
         return ok;
     }
 
-    [[nodiscard]] bool pull(Args &...args) noexcept
+    // Pushes count records in one go, record(index) gives fields of the index-th one as a
+    // tuple, of values or of references to fields that outlive the call. Records are encoded
+    // one after another and ring offsets and stats are committed once for all of them. Stops
+    // at the first record that doesn't fit, the ones after it aren't tried and count as
+    // failed pushes. Returns how many were pushed.
+    template<typename Record>
+    [[nodiscard]] size_t pushBatch(size_t count, Record &&record) noexcept
     {
-        if (buffer == nullptr)
+        if (buffer == nullptr || count == 0)
         {
-            return false;
+            return 0;
         }
 
-        size_t offset = readOffset;
-        size_t size = bufferSize;
-        bool ok{false};
+        checkPressure(count);
+        size_t pinned = pinnedSize();
+        size_t offset = writeOffset;
+        size_t size = bufferSize + pinned;
+        size_t pushed{0};
 
-        if (((ok = pullImpl(args, offset, size)), ...); ok)
+        for (; pushed < count; ++pushed)
         {
-            readOffset = offset;
-            bufferSize = size;
+            // a record that doesn't fit may have encoded some of its fields already
+            size_t recordOffset = offset;
+            size_t recordSize = size;
+            bool ok{true};
+            if (options.stringDictionary != 0)
+            {
+                ringEncoder.begin();
+            }
+            std::apply(
+                [&](const auto &...fields) {
+                    ((ok = ok && pushImpl(fields, recordOffset, recordSize)), ...);
+                },
+                record(pushed));
+
+            if (!ok)
+            {
+                if (options.stringDictionary != 0)
+                {
+                    ringEncoder.rollback();
+                }
+                break;
+            }
+            offset = recordOffset;
+            size = recordSize;
         }
-        return ok;
-    }
 
-    template<typename = std::enable_if_t<UseDisk == true>>
-    [[nodiscard]] std::error_code flush() noexcept
-    {
-        auto ec = flushImpl(buffer + readOffset, bufferSize);
-        if (!ec)
+        if (pushed != 0)
         {
-            bufferSize = 0;
-            writeOffset = 0;
-            readOffset = 0;
+            size -= pinned;
+            repositoryStats.pushedBatch(pushed, size - bufferSize, size);
+            writeOffset = offset;
+            dirtySize += size - bufferSize;
+            bufferSize = size;
+            bufferRecords += pushed;
         }
-        return ec;
-    }
 
-    template<typename = std::enable_if_t<UseDisk == true>>
-    [[nodiscard]] std::error_code flush(const Args &...args) noexcept
-    {
-        size_t offset{0};
-        (fillWriteBackBuffer(args, offset), ...);
-        auto ec = flushImpl(writeBackBuffer.data(), offset);
-        writeBackBuffer.clear();
-        return ec;
+        if (pushed != count)
+        {
+            DISKREPOSITORY_PROBE2(push_full, bufferSize, bufferCapacity);
+            for (size_t failed = pushed; failed < count; ++failed)
+            {
+                repositoryStats.pushFailed();
+            }
+        }
+        return pushed;
     }
 
-    template<typename = std::enable_if_t<UseDisk == true>>
-    std::pair<std::error_code, size_t> tellDataSize() noexcept
+    [[nodiscard]] bool pull(Args &...args) noexcept
     {
-        if (backupFile == -1)
+        if (buffer == nullptr)
         {
-            return {std::make_error_code(std::errc::bad_file_descriptor), 0};
+            return false;
         }
 
-        size_t size{0};
-        off_t offset = sizeof(size_t);
-        ::lseek(backupFile, -offset, SEEK_END);
+        size_t offset = readOffset;
+        size_t size = bufferSize;
+        bool ok{true};
 
-        if (::read(backupFile, reinterpret_cast<char *>(&size), sizeof(size_t)) == -1)
+        if (((ok = ok && pullImpl(args, offset, size)), ...); ok)
         {
-            return {std::make_error_code(static_cast<std::errc>(errno)), 0};
+            consume(offset, size);
         }
-
-        return {std::error_code(), size};
-    }
-
-    template<typename = std::enable_if_t<UseDisk == true>>
-    [[nodiscard]] std::error_code refill(size_t size) noexcept
-    {
-        auto ec = refillImpl(buffer, size);
-        if (!ec)
+        else if (bufferRecords == 0)
         {
-            bufferSize = size;
-            writeOffset = size;
-            readOffset = 0;
+            DISKREPOSITORY_PROBE0(pull_empty);
         }
-        return ec;
+        return ok;
     }
 
-    template<typename = std::enable_if_t<UseDisk == true>>
-    [[nodiscard]] std::error_code refill(size_t size, Args &...args) noexcept
+    // Same as pull(), but string fields can also be decoded into std::pmr::string, allocated
+    // by its own allocator, or into std::string_view with bytes allocated from arena, e.g.
+    // a std::pmr::monotonic_buffer_resource released once per batch of records. Fails, leaving
+    // record in ring, if either runs out of memory.
+    template<typename... Outs>
+    [[nodiscard]] bool pull(std::pmr::memory_resource &arena, Outs &...outs) noexcept
     {
-        if (size > writeBackBuffer.capacity())
+        static_assert(sizeof...(Outs) == sizeof...(Args) && (pullableAs<Args, Outs> && ...));
+
+        if (buffer == nullptr)
         {
-            writeBackBuffer.resize(((size / pageSize) + 1) * pageSize);
+            return false;
         }
 
-        auto ec = refillImpl(writeBackBuffer.data(), size);
-        size_t offset{0};
-        (dryWriteBackBuffer(args, offset), ...);
-        writeBackBuffer.clear();
-        return ec;
-    }
+        size_t offset = readOffset;
+        size_t size = bufferSize;
+        bool ok{true};
 
-    void reset() noexcept
-    {
-        bufferSize = 0;
-        writeOffset = 0;
-        readOffset = 0;
-        writeBackBuffer.clear();
+        if (((ok = ok && pullImpl(outs, offset, size, arena)), ...); ok)
+        {
+            consume(offset, size);
+        }
+        else if (bufferRecords == 0)
+        {
+            DISKREPOSITORY_PROBE0(pull_empty);
+        }
+        return ok;
     }
 
-    size_t capacity() const noexcept
+    // For a repository of one std::variant<Ts...>: decodes the next record straight into
+    // its alternative, picked by a table indexed with the stored tag, and calls visitor
+    // with it, so no variant is constructed and nothing is dispatched at run time but the
+    // table jump. Record is consumed before visitor is called.
+    template<typename Visitor, typename Record = std::tuple_element_t<0, std::tuple<Args...>>,
+        typename = std::enable_if_t<sizeof...(Args) == 1 && isVariantRecord<Record>>>
+    [[nodiscard]] bool pullVisit(Visitor &&visitor) noexcept
     {
-        return bufferCapacity;
+        return pullVisitImpl(visitor, std::make_index_sequence<std::variant_size_v<Record>>());
     }
 
-private:
-    template<typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
-    [[nodiscard]] bool pushImpl(const T &value, size_t &offset, size_t &size) noexcept
+    // Moves up to count records from the front of this ring to the back of other's, as long
+    // as they fit there, without decoding them: their bytes are copied as they are, in one
+    // go. Records are only walked to find where they end, which for integral fields is just
+    // adding up sizes. Returns how many records were moved. Neither repository may use
+    // stringDictionary, since dictionary references are only valid in their own ring.
+    template<bool OtherDisk, typename OtherStats>
+    [[nodiscard]] std::pair<std::error_code, size_t> transferTo(
+        BasicDiskRepository<OtherDisk, OtherStats, Args...> &other, size_t count) noexcept
     {
-        size_t typeSize = sizeof(T);
-        if (size + typeSize > bufferCapacity)
+        if (auto ec = checkTransfer(other); ec)
         {
-            return false;
+            return {ec, 0};
         }
 
-        const char *ptr = reinterpret_cast<const char *>(&value);
-        std::copy(ptr, ptr + typeSize, buffer + offset);
-        offset = (offset + typeSize) % bufferCapacity;
-        size += typeSize;
-        return true;
-    }
+        const char *ptr = buffer + readOffset;
+        size_t room = other.freeSize();
+        size_t offset{0};
+        size_t records{0};
 
-    [[nodiscard]] bool pushImpl(const std::string &value, size_t &offset, size_t &size) noexcept
-    {
-        size_t length = value.length();
-        if (!pushImpl(length, offset, size))
+        for (; records < count && records < bufferRecords; ++records)
         {
-            return false;
-        }
+            size_t next = offset;
+            if (!skipRecord(ptr, next, bufferSize))
+            {
+                return {std::make_error_code(std::errc::bad_message), 0};
+            }
 
-        if (size + length > bufferCapacity)
-        {
-            return false;
+            if (next > room)
+            {
+                break;
+            }
+            offset = next;
         }
 
-        std::copy(value.begin(), value.end(), buffer + offset);
-        offset = (offset + length) % bufferCapacity;
-        size += length;
-        return true;
+        moveRecords(other, offset, records);
+        return {std::error_code(), records};
     }
 
-    template<typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
-    [[nodiscard]] bool pullImpl(T &value, size_t &offset, size_t &size) noexcept
+    // Moves records for which predicate(fields...) is true from this ring to the back of
+    // other's, records for which it is false stay in this ring in the same order. Predicate
+    // gets only fields of given indices (all when none given, indices must increase), with
+    // std::string ones as std::string_view into ring, and other fields are skipped, so only
+    // what predicate needs is decoded. Record bytes are copied as they are, a single copy per
+    // run of records going to the same place. Stops, leaving records as they are, once a
+    // record doesn't fit other. Returns how many records were moved. Waits for a snapshot
+    // being written, since records staying are written anew after the others. Neither
+    // repository may use stringDictionary.
+    template<size_t... Fields, bool OtherDisk, typename OtherStats, typename Predicate>
+    [[nodiscard]] std::pair<std::error_code, size_t> transferIf(
+        BasicDiskRepository<OtherDisk, OtherStats, Args...> &other,
+        Predicate &&predicate) noexcept
     {
-        size_t typeSize = sizeof(T);
-        if (size < typeSize)
+        if constexpr (sizeof...(Fields) == 0)
         {
-            return false;
+            return transferIfImpl(other, predicate, std::index_sequence_for<Args...>());
+        }
+        else
+        {
+            return transferIfImpl(other, predicate, std::index_sequence<Fields...>());
         }
-
-        const char *ptr = buffer + offset;
-        std::copy(ptr, ptr + typeSize, reinterpret_cast<char *>(&value));
-        offset = (offset + typeSize) % bufferCapacity;
-        size -= typeSize;
-        return true;
     }
 
-    [[nodiscard]] bool pullImpl(std::string &value, size_t &offset, size_t &size) noexcept
+    // Spills records for which predicate(fields...) is true as one chunk, records for which
+    // it is false stay in ring in the same order. Predicate gets fields like transferIf()
+    // ones and is asked twice per record, once while the chunk is built and once, after it
+    // is written, while ring is rearranged, so it must answer the same both times. Ring is
+    // left as it is when writing fails. Chunk is row-wise, whatever columnarSpill says, and
+    // spillLatencyTarget doesn't split it. Returns how many records were spilled. Waits for
+    // a snapshot being written. Not available with stringDictionary.
+    template<size_t... Fields, typename Predicate, bool Enable = UseDisk,
+        typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::pair<std::error_code, size_t> flushIf(Predicate &&predicate) noexcept
     {
-        size_t length{0};
-        if (!pullImpl(length, offset, size))
+        if constexpr (sizeof...(Fields) == 0)
         {
-            return false;
+            return flushIfImpl(predicate, std::index_sequence_for<Args...>());
         }
-
-        if (size < length)
+        else
         {
-            return false;
+            return flushIfImpl(predicate, std::index_sequence<Fields...>());
         }
-
-        value.resize(length);
-        const char *ptr = buffer + offset;
-        std::copy(ptr, ptr + length, value.begin());
-        offset = (offset + length) % bufferCapacity;
-        size -= length;
-        return true;
     }
 
-    template<typename T, typename = std::enable_if_t<std::is_integral_v<T> && UseDisk == true>>
-    void fillWriteBackBuffer(const T &value, size_t &offset) noexcept
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::error_code flush() noexcept
     {
-        size_t typeSize = sizeof(value);
-        if (writeBackBuffer.capacity() - offset < typeSize)
+        if (options.spillLatencyTarget != 0 && options.coalesceSpill && bufferSize != 0 &&
+            spillPacer.coalesce(bufferSize))
         {
-            writeBackBuffer.resize(writeBackBuffer.capacity() + pageSize);
+            DISKREPOSITORY_PROBE2(flush_coalesced, bufferSize, bufferRecords);
+            repositoryStats.paced(
+                0, spillPacer.chunkSize(), spillPacer.overhead(), spillPacer.bandwidth());
+            return std::error_code();
         }
 
-        const char *ptr = reinterpret_cast<const char *>(&value);
-        std::copy(ptr, ptr + typeSize, writeBackBuffer.begin() + offset);
-        offset += typeSize;
-    }
-
-    template<typename = std::enable_if_t<UseDisk == true>>
-    void fillWriteBackBuffer(const std::string &value, size_t &offset) noexcept
-    {
-        if (writeBackBuffer.capacity() - offset < value.size())
+        if constexpr (columnarRecord)
         {
-            writeBackBuffer.resize(
-                writeBackBuffer.capacity() + ((value.size() / pageSize + 1) * pageSize));
+            if (options.columnarSpill)
+            {
+                // open() rejects columnarSpill with stringDictionary, strings are plain
+                const char *ptr = buffer + readOffset;
+                size_t offset{0};
+                size_t size{0};
+                auto next = [&](std::tuple<Args...> &record) {
+                    return decodeRecord(record, ptr, offset, bufferSize, nullptr);
+                };
+
+                if (auto ec = fillColumns(bufferRecords, next, size); ec)
+                {
+                    return ec;
+                }
+                return flushRing(writeBackBuffer.data(), size, SpillFrameTrailer::columnarFlag);
+            }
         }
 
-        fillWriteBackBuffer(value.size(), offset);
-        std::copy(value.begin(), value.end(), writeBackBuffer.begin() + offset);
-        offset += value.size();
-    }
+        if (options.stringDictionary == 0)
+        {
+            return flushRing(buffer + readOffset, bufferSize, 0);
+        }
 
-    template<typename T, typename = std::enable_if_t<UseDisk == true>>
-    void dryWriteBackBuffer(T &value, size_t &offset)
-    {
-        auto begin = writeBackBuffer.begin() + offset;
-        std::copy(begin, begin + sizeof(T), reinterpret_cast<char *>(&value));
-        offset += sizeof(T);
-    }
+        if (ringSelfContained)
+        {
+            return flushRing(buffer + readOffset, bufferSize, SpillFrameTrailer::dictionaryFlag);
+        }
 
-    template<typename = std::enable_if_t<UseDisk == true>>
-    void dryWriteBackBuffer(std::string &value, size_t &offset)
-    {
+        // records pulled since the last chunk boundary may have defined strings the rest
+        // refers to, so what is left is encoded again with a fresh dictionary
+        chunkEncoder.reset();
+        const char *ptr = buffer + readOffset;
+        std::tuple<Args...> record;
         size_t size{0};
-        dryWriteBackBuffer(size, offset);
 
-        value.resize(size);
-        auto begin = writeBackBuffer.begin() + offset;
-        std::copy(begin, begin + size, value.begin());
-        offset += value.size();
+        for (size_t offset = 0; offset < bufferSize;)
+        {
+            if (!decodeRecord(record, ptr, offset, bufferSize, &ringDecoder))
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            if (!writeBackBuffer.reserve(size + encodedSize(record)))
+            {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+            fillWriteBackBuffer(record, size);
+        }
+        return flushRing(writeBackBuffer.data(), size, SpillFrameTrailer::dictionaryFlag);
     }
 
-    template<typename = std::enable_if_t<UseDisk == true>>
-    std::error_code flushImpl(const char *ptr, size_t size) noexcept
+    // Same as flush(), but records are written ordered by key(args...), so chunks written
+    // this way can be merged by mergeSorted(). Order of records with equal keys is kept.
+    // With a string dictionary records are encoded again in sorted order, since a reference
+    // may not precede its definition.
+    template<typename Projection, bool Enable = UseDisk,
+        typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::error_code flushSorted(Projection &&key) noexcept
     {
-        if (backupFile == -1)
+        using Key = std::decay_t<std::invoke_result_t<Projection &, const Args &...>>;
+        struct Entry
         {
-            return std::make_error_code(std::errc::bad_file_descriptor);
-        }
+            Key key;
+            size_t offset;
+            size_t size;
+            std::tuple<Args...> record; // only kept with a string dictionary
+        };
 
-        ::lseek(backupFile, 0, SEEK_END);
-        size_t bytesWritten{0};
+        bool dictionary = options.stringDictionary != 0;
+        std::vector<Entry> entries;
+        entries.reserve(bufferRecords);
+        const char *ptr = buffer + readOffset;
+        std::tuple<Args...> record;
 
-        // TODO: maybe writev here?
-        do
+        for (size_t offset = 0; offset < bufferSize;)
         {
-            ssize_t bytes = ::write(backupFile, ptr + bytesWritten, size - bytesWritten);
-            if (bytes == -1)
+            size_t start = offset;
+            if (!decodeRecord(
+                    record, ptr, offset, bufferSize, dictionary ? &ringDecoder : nullptr))
             {
-                return std::make_error_code(static_cast<std::errc>(errno));
+                return std::make_error_code(std::errc::bad_message);
             }
-            bytesWritten += bytes;
-        } while (bytesWritten < size);
 
-        if (::write(backupFile, reinterpret_cast<char *>(&size), sizeof(size_t)) == -1)
-        {
-            return std::make_error_code(static_cast<std::errc>(errno));
+            entries.push_back({std::apply(key, std::as_const(record)), start, offset - start,
+                dictionary ? std::move(record) : std::tuple<Args...>()});
         }
 
-        return std::error_code();
-    }
+        std::stable_sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.key < b.key; });
 
-    template<typename = std::enable_if_t<UseDisk == true>>
-    std::error_code refillImpl(char *ptr, size_t size)
-    {
-        off_t offset = sizeof(size_t) + size;
-        off_t fileReadOffset = ::lseek(backupFile, -offset, SEEK_END);
-        size_t bytesRead{0};
+        if (!writeBackBuffer.reserve(bufferSize))
+        {
+            return std::make_error_code(std::errc::not_enough_memory);
+        }
 
-        do
+        size_t size{0};
+        chunkEncoder.reset();
+        for (const auto &entry : entries)
         {
-            ssize_t bytes = ::read(backupFile, ptr, size);
-            if (bytes == -1)
+            if (!dictionary)
             {
-                return std::make_error_code(static_cast<std::errc>(errno));
+                std::copy_n(ptr + entry.offset, entry.size, writeBackBuffer.data() + size);
+                size += entry.size;
             }
-            bytesRead += bytes;
-        } while (bytesRead < size);
+            else if (writeBackBuffer.reserve(size + encodedSize(entry.record)))
+            {
+                fillWriteBackBuffer(entry.record, size);
+            }
+            else
+            {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+        }
+        return flushRing(writeBackBuffer.data(), size,
+            SpillFrameTrailer::sortedFlag | (dictionary ? SpillFrameTrailer::dictionaryFlag : 0));
+    }
 
-        if (::ftruncate(backupFile, fileReadOffset) == -1)
+    // Visits records of all spilled chunks ordered by key(args...): visitor(args...) returns
+    // false to stop. All chunks must have been written by flushSorted(). Chunks are merged
+    // with a loser tree and stored ones are streamed through a small window each, so memory
+    // use doesn't depend on file size; chunks stored by a codec are decoded whole. A corrupt
+    // chunk is reported once its end is reached. Doesn't change repository state.
+    template<typename Projection, typename Visitor, bool Enable = UseDisk,
+        typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::error_code mergeSorted(Projection &&key, Visitor &&visitor) noexcept
+    {
+        using Key = std::decay_t<std::invoke_result_t<Projection &, const Args &...>>;
+        struct Cursor
         {
-            return std::make_error_code(static_cast<std::errc>(errno));
+            SpillFrameTrailer trailer;
+            off_t payloadOffset{0};
+            size_t loaded{0}; // payload bytes read into window so far
+            uint32_t crc{0};
+            uint64_t records{0}; // records left, including current one
+            PageBuffer window;
+            size_t windowOffset{0};
+            size_t windowSize{0};
+            PageBuffer codecBuffer;
+            PageBuffer readBuffer;
+            StringDictionaryDecoder dictionary;
+            std::tuple<Args...> record;
+            Key recordKey{};
+        };
+
+        if (auto ec = loadIndex(); ec)
+        {
+            return ec;
         }
 
-        return std::error_code();
-    }
+        std::vector<Cursor> cursors(spillIndex.size());
+        for (size_t chunk = 0; chunk < cursors.size(); ++chunk)
+        {
+            Cursor &cursor = cursors[chunk];
+            off_t frameEnd = spillIndex[chunk].frameEnd;
+            if (auto ec = readFrameTrailer(frameEnd, cursor.trailer); ec)
+            {
+                return ec;
+            }
+
+            if (!cursor.trailer.valid())
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            if (!(cursor.trailer.flags & SpillFrameTrailer::sortedFlag))
+            {
+                return std::make_error_code(std::errc::invalid_argument);
+            }
+
+            cursor.payloadOffset = frameEnd - cursor.trailer.frameSize();
+            cursor.records = cursor.trailer.records + 1;
+            if (cursor.trailer.codec != 0)
+            {
+                if (!cursor.window.reserve(cursor.trailer.dataSize))
+                {
+                    return std::make_error_code(std::errc::not_enough_memory);
+                }
+
+                if (auto ec = readChunk(frameEnd, cursor.trailer, cursor.window.data(),
+                        cursor.codecBuffer, cursor.readBuffer);
+                    ec)
+                {
+                    return ec;
+                }
+                cursor.loaded = cursor.windowSize = cursor.trailer.dataSize;
+            }
+        }
+
+        // moves cursor to its next record, records becomes 0 past the last one
+        auto advance = [&](Cursor &cursor) -> std::error_code {
+            if (--cursor.records == 0)
+            {
+                bool streamed = cursor.trailer.codec == 0;
+                if (streamed && cursor.crc != cursor.trailer.payloadCrc)
+                {
+                    return std::make_error_code(std::errc::bad_message);
+                }
+                return std::error_code();
+            }
+
+            for (;;)
+            {
+                size_t offset = cursor.windowOffset;
+                if (decodeRecord(cursor.record, cursor.window.data(), offset, cursor.windowSize,
+                        chunkDictionary(cursor.trailer, cursor.dictionary)))
+                {
+                    cursor.windowOffset = offset;
+                    cursor.recordKey = std::apply(key, std::as_const(cursor.record));
+                    return std::error_code();
+                }
+
+                if (cursor.loaded == cursor.trailer.dataSize)
+                {
+                    return std::make_error_code(std::errc::bad_message);
+                }
+
+                // keep the partial record, grow window only if it doesn't fit
+                size_t kept = cursor.windowSize - cursor.windowOffset;
+                size_t capacity = cursor.window.capacity();
+                if (!cursor.window.reserve(
+                        capacity == 0 ? mergeWindowSize : kept == capacity ? capacity * 2 : 0))
+                {
+                    return std::make_error_code(std::errc::not_enough_memory);
+                }
+
+                char *data = cursor.window.data();
+                std::copy(data + cursor.windowOffset, data + cursor.windowSize, data);
+                size_t bytes = std::min(
+                    cursor.window.capacity() - kept, cursor.trailer.dataSize - cursor.loaded);
+                if (auto ec = readFully(data + kept, bytes, cursor.payloadOffset + cursor.loaded,
+                        cursor.readBuffer);
+                    ec)
+                {
+                    return ec;
+                }
+
+                cursor.crc = Crc32c::compute(cursor.crc, data + kept, bytes);
+                cursor.loaded += bytes;
+                cursor.windowOffset = 0;
+                cursor.windowSize = kept + bytes;
+            }
+        };
+
+        for (auto &cursor : cursors)
+        {
+            if (auto ec = advance(cursor); ec)
+            {
+                return ec;
+            }
+        }
+
+        LoserTree tree(cursors.size(), [&](size_t a, size_t b) {
+            if (cursors[a].records == 0 || cursors[b].records == 0)
+            {
+                return cursors[b].records == 0 && (cursors[a].records != 0 || a < b);
+            }
+            if (cursors[a].recordKey < cursors[b].recordKey)
+            {
+                return true;
+            }
+            return !(cursors[b].recordKey < cursors[a].recordKey) && a < b;
+        });
+        tree.build();
+
+        while (!cursors.empty())
+        {
+            Cursor &cursor = cursors[tree.winner()];
+            if (cursor.records == 0)
+            {
+                break;
+            }
+
+            if (!std::apply([&](auto &...fields) { return visitor(std::as_const(fields)...); },
+                    cursor.record))
+            {
+                return std::error_code();
+            }
+
+            if (auto ec = advance(cursor); ec)
+            {
+                return ec;
+            }
+            tree.replay();
+        }
+
+        return std::error_code();
+    }
+
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::error_code flush(const Args &...args) noexcept
+    {
+        uint64_t start = Stats::now();
+        size_t offset{0};
+        uint8_t flags{0};
+
+        if constexpr (columnarRecord)
+        {
+            if (options.columnarSpill)
+            {
+                auto next = [&](std::tuple<Args...> &record) {
+                    record = std::forward_as_tuple(args...);
+                    return true;
+                };
+
+                if (auto ec = fillColumns(1, next, offset); ec)
+                {
+                    return ec;
+                }
+                flags = SpillFrameTrailer::columnarFlag;
+            }
+        }
+
+        if (flags == 0)
+        {
+            if (!writeBackBuffer.reserve((encodedSize(args) + ...)))
+            {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+
+            chunkEncoder.reset();
+            (fillWriteBackBuffer(args, offset), ...);
+            flags = options.stringDictionary != 0 ? SpillFrameTrailer::dictionaryFlag : 0;
+        }
+
+        DISKREPOSITORY_PROBE2(flush_begin, offset, 1);
+        auto ec = flushImpl(writeBackBuffer.data(), offset, 1, flags);
+        DISKREPOSITORY_PROBE3(flush_end, offset,
+            ec ? 0 : lastTrailer.frameSize(), ec.value());
+        if (!ec)
+        {
+            repositoryStats.flushed(lastTrailer.frameSize(), false, start);
+        }
+        return ec;
+    }
+
+    // size of the last spilled chunk as it will be put into ring by refill()
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::pair<std::error_code, size_t> tellDataSize() noexcept
+    {
+        SpillFrameTrailer trailer;
+        off_t frameEnd{0};
+        if (auto ec = readTrailer(trailer, frameEnd); ec || frameEnd == 0)
+        {
+            return {ec, 0};
+        }
+
+        return {std::error_code(), trailer.dataSize};
+    }
+
+    // Every record written to backup file gets the next number of a monotonic sequence and
+    // chunks remember the first one, so replay can start from any record without touching
+    // chunks before it. visitor(sequence, args...) is called for records from given one
+    // till the end of file and returns false to stop. Doesn't change repository state.
+    template<typename Visitor, bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::error_code replay(uint64_t sequence, Visitor &&visitor) noexcept
+    {
+        if (auto ec = loadIndex(); ec)
+        {
+            return ec;
+        }
+
+        StringDictionaryDecoder dictionary;
+        for (size_t chunk = findSpillChunk(spillIndex, sequence); chunk < spillIndex.size();
+             ++chunk)
+        {
+            off_t frameEnd = spillIndex[chunk].frameEnd;
+            SpillFrameTrailer trailer;
+            if (auto ec = readFrameTrailer(frameEnd, trailer); ec)
+            {
+                return ec;
+            }
+
+            if (!trailer.valid())
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            if (!replayBuffer.reserve(trailer.dataSize))
+            {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+
+            if (auto ec = readChunk(
+                    frameEnd, trailer, replayBuffer.data(), spillBuffer, directBuffer);
+                ec)
+            {
+                return ec;
+            }
+
+            size_t offset{0};
+            dictionary.reset();
+            ColumnarChunk columns;
+            bool columnar = trailer.flags & SpillFrameTrailer::columnarFlag;
+            if (columnar &&
+                !openColumns(columns, replayBuffer.data(), trailer.dataSize, trailer.records))
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            for (uint64_t current = trailer.firstSequence;
+                 current < trailer.firstSequence + trailer.records; ++current)
+            {
+                std::tuple<Args...> record;
+                bool ok = columnar
+                              ? decodeColumns(record, columns, current - trailer.firstSequence)
+                              : decodeRecord(record, replayBuffer.data(), offset,
+                                    trailer.dataSize, chunkDictionary(trailer, dictionary));
+                if (!ok)
+                {
+                    return std::make_error_code(std::errc::bad_message);
+                }
+
+                if (current >= sequence &&
+                    !std::apply(
+                        [&](auto &...fields) { return visitor(current, fields...); }, record))
+                {
+                    return std::error_code();
+                }
+            }
+        }
+
+        return std::error_code();
+    }
+
+    // Counts spilled records whose integral field Field compares to value as given, e.g.
+    // scanCount<2>(ColumnCompare::Greater, x). Of a columnar chunk only that column is read
+    // (payload checksum isn't verified then, unless chunk is stored by a codec and has to be
+    // decoded whole) and it is counted with SIMD; other chunks are decoded record by record.
+    // Records in ring aren't counted. Doesn't change repository state.
+    template<size_t Field, bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::pair<std::error_code, uint64_t> scanCount(
+        ColumnCompare compare, std::tuple_element_t<Field, std::tuple<Args...>> value) noexcept
+    {
+        using T = std::tuple_element_t<Field, std::tuple<Args...>>;
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>);
+        uint64_t count{0};
+        auto ec = scanField<Field>([&](const auto &...args) {
+            if constexpr (sizeof...(args) == 2)
+            {
+                count += ColumnScan::count<T>(args..., compare, value);
+            }
+            else
+            {
+                count += ColumnScan::matches(compare, args..., value);
+            }
+        });
+        return {ec, ec ? 0 : count};
+    }
+
+    // Sum of integral field Field over spilled records, wrapping around like 64-bit
+    // arithmetic; reads spilled chunks the way scanCount() does
+    template<size_t Field, bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>,
+        typename T = std::tuple_element_t<Field, std::tuple<Args...>>>
+    std::pair<std::error_code, ColumnScan::Sum<T>> scanSum() noexcept
+    {
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>);
+        uint64_t sum{0};
+        auto ec = scanField<Field>([&](const auto &...args) {
+            if constexpr (sizeof...(args) == 2)
+            {
+                sum += static_cast<uint64_t>(ColumnScan::sum<T>(args...));
+            }
+            else
+            {
+                ((sum += static_cast<uint64_t>(static_cast<ColumnScan::Sum<T>>(args))), ...);
+            }
+        });
+        return {ec, ec ? 0 : static_cast<ColumnScan::Sum<T>>(sum)};
+    }
+
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::error_code refill(size_t size) noexcept
+    {
+        if (size > bufferCapacity)
+        {
+            return std::make_error_code(std::errc::no_buffer_space);
+        }
+
+        unpin();
+        uint64_t start = Stats::now();
+        SpillFrameTrailer trailer;
+        DISKREPOSITORY_PROBE1(refill_begin, size);
+        auto ec = refillImpl(buffer, size, trailer, true);
+        size_t ringSize = size;
+        if constexpr (columnarRecord)
+        {
+            if (!ec && trailer.flags & SpillFrameTrailer::columnarFlag)
+            {
+                ec = refillColumns(size, trailer.records, ringSize);
+            }
+        }
+
+        DISKREPOSITORY_PROBE3(refill_end, size, ec ? 0 : trailer.records, ec.value());
+        if (!ec)
+        {
+            repositoryStats.refilled(trailer.records, true, start);
+            bufferSize = ringSize;
+            bufferRecords = trailer.records;
+            writeOffset = ringSize;
+            readOffset = 0;
+            dirtySize = ringSize;
+            ringEncoder.reset();
+            ringSelfContained = true;
+            if (ringHeader != nullptr)
+            {
+                (void)checkpoint();
+            }
+        }
+        return ec;
+    }
+
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::error_code refill(size_t size, Args &...args) noexcept
+    {
+        if (!writeBackBuffer.reserve(size))
+        {
+            return std::make_error_code(std::errc::not_enough_memory);
+        }
+
+        uint64_t start = Stats::now();
+        SpillFrameTrailer trailer;
+        DISKREPOSITORY_PROBE1(refill_begin, size);
+        auto ec = refillImpl(writeBackBuffer.data(), size, trailer, false);
+        DISKREPOSITORY_PROBE3(refill_end, size, ec ? 0 : trailer.records, ec.value());
+        if (ec)
+        {
+            return ec;
+        }
+        repositoryStats.refilled(trailer.records, false, start);
+
+        if constexpr (columnarRecord)
+        {
+            if (trailer.flags & SpillFrameTrailer::columnarFlag)
+            {
+                ColumnarChunk chunk;
+                std::tuple<Args...> record;
+                if (!openColumns(chunk, writeBackBuffer.data(), size, trailer.records) ||
+                    trailer.records == 0 || !decodeColumns(record, chunk, 0))
+                {
+                    return std::make_error_code(std::errc::bad_message);
+                }
+
+                std::tie(args...) = std::move(record);
+                return std::error_code();
+            }
+        }
+
+        StringDictionaryDecoder dictionary;
+        auto *decoder = chunkDictionary(trailer, dictionary);
+        size_t offset{0};
+        bool ok{true};
+        ((ok = ok && decodeImpl(args, writeBackBuffer.data(), offset, size, decoder)), ...);
+        return ok ? std::error_code() : std::make_error_code(std::errc::bad_message);
+    }
+
+    // Takes the last spilled chunk back behind records in ring, where refill() puts it in
+    // their place; size must fit ring next to them. Only for row-wise chunks without
+    // stringDictionary, whose records don't depend on what ring holds, so not available with
+    // either option. Records taken back have no push time.
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::error_code refillBack(size_t size) noexcept
+    {
+        if (options.stringDictionary != 0 || (columnarRecord && options.columnarSpill))
+        {
+            return std::make_error_code(std::errc::not_supported);
+        }
+
+        if (size > freeSize())
+        {
+            return std::make_error_code(std::errc::no_buffer_space);
+        }
+
+        uint64_t start = Stats::now();
+        SpillFrameTrailer trailer;
+        DISKREPOSITORY_PROBE1(refill_begin, size);
+        // free part of ring is contiguous, as it is mapped twice in a row
+        auto ec = refillImpl(buffer + writeOffset, size, trailer, true);
+        DISKREPOSITORY_PROBE3(refill_end, size, ec ? 0 : trailer.records, ec.value());
+        if (ec)
+        {
+            return ec;
+        }
+
+        repositoryStats.refilled(trailer.records, false, start);
+        repositoryStats.refilledBack(trailer.records);
+        writeOffset = (writeOffset + size) % bufferCapacity;
+        dirtySize += size;
+        bufferSize += size;
+        bufferRecords += trailer.records;
+        return std::error_code();
+    }
+
+    // Starts loading chunks the next refills will take, see DiskRepositoryOptions::prefetchDepth.
+    // Worth calling once consumer starts draining, refill() keeps it going afterwards.
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    [[nodiscard]] std::error_code prefetch() noexcept
+    {
+        if (options.prefetchDepth == 0)
+        {
+            return std::error_code();
+        }
+
+        std::vector<SpillPrefetcher::Request> requests;
+        off_t frameEnd{0};
+        SpillFrameTrailer trailer;
+        if (auto ec = readTrailer(trailer, frameEnd); ec)
+        {
+            return ec;
+        }
+
+        while (frameEnd != 0 && requests.size() < options.prefetchDepth)
+        {
+            requests.push_back({frameEnd, trailer});
+            frameEnd -= trailer.frameSize();
+            if (frameEnd == spillStart)
+            {
+                break;
+            }
+
+            if (auto ec = readFrameTrailer(frameEnd, trailer); ec)
+            {
+                return ec;
+            }
+
+            if (!trailer.valid() || trailer.frameSize() > uint64_t(frameEnd - spillStart))
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+        }
+
+        prefetcher.schedule(std::move(requests));
+        return std::error_code();
+    }
+
+    void reset() noexcept
+    {
+        unpin();
+        bufferSize = 0;
+        bufferRecords = 0;
+        writeOffset = 0;
+        readOffset = 0;
+        ringEncoder.reset();
+        ringSelfContained = true;
+        repositoryStats.reset();
+
+        // records the last checkpoint refers to are about to be overwritten
+        if (ringHeader != nullptr)
+        {
+            (void)checkpoint();
+        }
+    }
+
+    size_t capacity() const noexcept
+    {
+        return bufferCapacity;
+    }
+
+    // bytes of records currently in ring
+    size_t size() const noexcept
+    {
+        return bufferSize;
+    }
+
+    // bytes a record takes in ring and in spilled chunks
+    static size_t recordSize(const Args &...args) noexcept
+    {
+        return (encodedSize(args) + ...);
+    }
+
+    // RepositoryStats::snapshot() of it is safe to call from any thread
+    const Stats &stats() const noexcept
+    {
+        return repositoryStats;
+    }
+
+    // Persists ring state when it is backed by DiskRepositoryOptions::ringFilename: ring bytes
+    // written since the previous checkpoint are synced first, then the header, so a
+    // checkpoint never refers to data which didn't reach the file.
+    [[nodiscard]] std::error_code checkpoint() noexcept
+    {
+        if (ringHeader == nullptr)
+        {
+            return std::make_error_code(std::errc::bad_file_descriptor);
+        }
+
+        if (dirtySize != 0)
+        {
+            size_t size = std::min(dirtySize, bufferCapacity);
+            size_t start = (writeOffset + bufferCapacity - size) % bufferCapacity;
+            size_t alignedStart = start / pageSize * pageSize;
+
+            if (::msync(buffer + alignedStart, size + start - alignedStart, MS_SYNC) == -1)
+            {
+                return std::make_error_code(static_cast<std::errc>(errno));
+            }
+        }
+
+        RingCheckpoint &slot = ringHeader->slots[(ringGeneration + 1) & 1];
+        slot = RingCheckpoint();
+        slot.generation = ringGeneration + 1;
+        slot.capacity = bufferCapacity;
+        slot.readOffset = readOffset;
+        slot.size = bufferSize;
+        slot.records = bufferRecords;
+        slot.seal();
+
+        if (::msync(ringHeader, pageSize, MS_SYNC) == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        ++ringGeneration;
+        dirtySize = 0;
+        checkpointPinned = 0;
+        return std::error_code();
+    }
+
+    // Starts writing records queued in ring at this instant to path, as a backup file with a
+    // single chunk: a repository of the same Args... opened on it refills them, inspect reads
+    // it. Writing happens on a helper thread while producers and consumers go on: snapshotted
+    // bytes stay in place, push() just doesn't reuse them till they are written (ring has less
+    // room meanwhile), and reset() or refill() wait for that. File appears under path only
+    // once it is complete, synced with syncSpill. One snapshot at a time, waitSnapshot() tells
+    // how it went. Not available with stringDictionary, records may refer to pulled strings.
+    [[nodiscard]] std::error_code snapshot(const std::filesystem::path &path) noexcept
+    {
+        if (buffer == nullptr)
+        {
+            return std::make_error_code(std::errc::bad_file_descriptor);
+        }
+
+        if (options.stringDictionary != 0)
+        {
+            return std::make_error_code(std::errc::not_supported);
+        }
+
+        if (snapshotter.busy())
+        {
+            return std::make_error_code(std::errc::device_or_resource_busy);
+        }
+
+        DISKREPOSITORY_PROBE2(snapshot_begin, bufferSize, bufferRecords);
+        snapshotPinned = 0;
+        (void)snapshotter.start(
+            [this, path, start = readOffset, size = bufferSize, records = bufferRecords] {
+                auto ec = writeSnapshot(path, start, size, records);
+                DISKREPOSITORY_PROBE2(snapshot_end, size, ec.value());
+                return ec;
+            });
+        return std::error_code();
+    }
+
+    // waits for the snapshot being written, if any, and returns outcome of the last one
+    [[nodiscard]] std::error_code waitSnapshot() noexcept
+    {
+        return snapshotter.wait();
+    }
+
+    // Gives memory back to the system: spills ring content, if there is a backup file and it
+    // is at least pressureSpillSize, then releases pages of the free part of ring by punching
+    // a hole in the file backing it (they read as zeros when written again) and pages of
+    // scratch buffers and prefetched chunks. Called by push() under memory pressure, may be
+    // called any time.
+    [[nodiscard]] std::error_code relieveMemoryPressure() noexcept
+    {
+        if (buffer == nullptr)
+        {
+            return std::make_error_code(std::errc::bad_file_descriptor);
+        }
+
+        if constexpr (UseDisk == true)
+        {
+            if (backupFile != -1 && bufferSize != 0 && bufferSize >= options.pressureSpillSize)
+            {
+                if (auto ec = flush(); ec)
+                {
+                    return ec;
+                }
+            }
+
+            if (options.prefetchDepth != 0)
+            {
+                prefetcher.schedule({});
+            }
+            for (auto *scratch : {&writeBackBuffer, &spillBuffer, &replayBuffer, &scanBuffer,
+                     &directBuffer})
+            {
+                scratch->release();
+            }
+        }
+
+        size_t released{0};
+        auto ec = releaseFree(released);
+        DISKREPOSITORY_PROBE2(memory_pressure, bufferSize, released);
+        repositoryStats.relieved(released);
+        return ec;
+    }
+
+    // sequence number the next spilled record will get
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    uint64_t nextSequence() const noexcept
+    {
+        return spillSequence;
+    }
+
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    const SpillRecovery &recovery() const noexcept
+    {
+        return recovered;
+    }
+
+private:
+    template<bool, typename, typename...>
+    friend class BasicDiskRepository;
+    template<size_t, size_t, typename...>
+    friend class PriorityDiskRepository;
+
+    // consumed bytes push() can't reuse yet, a snapshot is still writing them or the last
+    // checkpoint of a file backed ring refers to them; counted as they are consumed rather
+    // than from offsets, which can't tell a ring drained by exactly its capacity since the
+    // snapshot started from one nothing was consumed from. Both end at readOffset.
+    size_t pinnedSize() const noexcept
+    {
+        return std::max(snapshotter.busy() ? snapshotPinned : 0, checkpointPinned);
+    }
+
+    // bytes at the front of ring that are no longer queued
+    void unqueued(size_t size) noexcept
+    {
+        snapshotPinned += size;
+        if (ringHeader != nullptr)
+        {
+            checkpointPinned += size;
+        }
+    }
+
+    // asks memoryPressure once every pressureCheckInterval pushes
+    void checkPressure(size_t pushes) noexcept
+    {
+        if (options.memoryPressure == nullptr)
+        {
+            return;
+        }
+
+        if (pushes < pressureCountdown)
+        {
+            pressureCountdown -= pushes;
+            return;
+        }
+
+        pressureCountdown = pressureCheckInterval;
+        if (options.memoryPressure->underPressure())
+        {
+            (void)relieveMemoryPressure();
+        }
+    }
+
+    // moves readOffset past size bytes that are no longer queued
+    void dropFront(size_t size) noexcept
+    {
+        readOffset = (readOffset + size) % bufferCapacity;
+        unqueued(size);
+    }
+
+    // Punches out whole pages of free ring space, as it is mapped twice in a row, it may
+    // cross the end of ring once: released is set to bytes given back
+    std::error_code releaseFree(size_t &released) noexcept
+    {
+        size_t start = (writeOffset + pageSize - 1) / pageSize * pageSize;
+        size_t end = (writeOffset + freeSize()) / pageSize * pageSize;
+        released = 0;
+
+        while (start < end)
+        {
+            size_t from = start % bufferCapacity;
+            size_t length = std::min(end - start, bufferCapacity - from);
+            if (::fallocate(ringFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    ringFdOffset + from, length) == -1 &&
+                (errno != EOPNOTSUPP || ::madvise(buffer + from, length, MADV_REMOVE) == -1))
+            {
+                return std::make_error_code(static_cast<std::errc>(errno));
+            }
+            released += length;
+            start += length;
+        }
+        return std::error_code();
+    }
+
+    // Waits for a snapshot before ring offsets are moved anywhere else but forward, a file
+    // backed ring is checkpointed so records pulled since the last checkpoint aren't referred
+    // to anymore. A failed checkpoint leaves the previous one, which next checkpoint() reports.
+    void unpin() noexcept
+    {
+        if (snapshotter.busy())
+        {
+            (void)snapshotter.wait();
+        }
+
+        if (checkpointPinned != 0)
+        {
+            (void)checkpoint();
+        }
+    }
+
+    // Runs on snapshot thread, so it only reads ring bytes in [start, start + size), which
+    // stay as they are while it runs, and what doesn't change after open(). Payload is copied
+    // between files with copy_file_range() when the kernel can, e.g. sharing blocks where
+    // file system supports that, and written from the mapping otherwise.
+    std::error_code writeSnapshot(
+        const std::filesystem::path &path, size_t start, size_t size, uint64_t records) noexcept
+    {
+        SpillFileHeader header;
+        header.schemaFingerprint = schemaFingerprint();
+        header.seal();
+        SpillFileHeader headerImage = header.fileImage();
+
+        SpillFrameTrailer trailer;
+        trailer.storedSize = size;
+        trailer.dataSize = size;
+        trailer.records = records;
+        trailer.totalFrames = 1;
+        trailer.totalRecords = records;
+        trailer.totalDataSize = size;
+        trailer.payloadCrc = Crc32c::compute(0, buffer + start, size);
+        trailer.seal();
+        SpillFrameTrailer trailerImage = trailer.fileImage();
+
+        auto temporary = std::filesystem::path(path).concat(".tmp");
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        off_t offset = sizeof(headerImage);
+        bool ok = ::pwrite(fd, &headerImage, sizeof(headerImage), 0) == sizeof(headerImage);
+        if (ok && size != 0)
+        {
+            ok = copyRing(fd, offset, start, size) &&
+                 ::pwrite(fd, &trailerImage, sizeof(trailerImage), offset + size) ==
+                     sizeof(trailerImage);
+        }
+        ok = ok && (!options.syncSpill || ::fdatasync(fd) == 0);
+
+        int err = ok ? 0 : errno;
+        ::close(fd);
+        if (ok && ::rename(temporary.c_str(), path.c_str()) == -1)
+        {
+            ok = false;
+            err = errno;
+        }
+
+        if (!ok)
+        {
+            ::unlink(temporary.c_str());
+            return std::make_error_code(
+                err != 0 ? static_cast<std::errc>(err) : std::errc::io_error);
+        }
+        return std::error_code();
+    }
+
+    // size ring bytes from start (they may wrap around) to fd at offset
+    bool copyRing(int fd, off_t offset, size_t start, size_t size) const noexcept
+    {
+        for (size_t copied = 0; copied < size;)
+        {
+            size_t from = (start + copied) % bufferCapacity;
+            loff_t in = ringFdOffset + from;
+            loff_t out = offset + copied;
+            ssize_t bytes = ::copy_file_range(
+                ringFd, &in, fd, &out, std::min(size - copied, bufferCapacity - from), 0);
+            if (bytes <= 0)
+            {
+                // nothing copied yet: kernel or file systems can't, write from mapping instead
+                return bytes == -1 && copied == 0 &&
+                       (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                           errno == EOPNOTSUPP) &&
+                       writeRing(fd, offset, start, size);
+            }
+            copied += bytes;
+        }
+        return true;
+    }
+
+    bool writeRing(int fd, off_t offset, size_t start, size_t size) const noexcept
+    {
+        for (size_t written = 0; written < size;)
+        {
+            ssize_t bytes =
+                ::pwrite(fd, buffer + start + written, size - written, offset + written);
+            if (bytes <= 0)
+            {
+                return false;
+            }
+            written += bytes;
+        }
+        return true;
+    }
+
+    std::error_code openRingFile() noexcept
+    {
+        if (ringFile = ::open(options.ringFilename.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+            ringFile == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        struct stat st;
+        if (::fstat(ringFile, &st) == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        off_t fileSize = pageSize + bufferCapacity;
+        if (st.st_size != 0 && st.st_size != fileSize)
+        {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        if (st.st_size == 0 && ::ftruncate(ringFile, fileSize) == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        void *header = ::mmap(nullptr, pageSize, PROT_READ | PROT_WRITE, MAP_SHARED, ringFile, 0);
+        if (header == MAP_FAILED)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+        ringHeader = static_cast<RingHeader *>(header);
+
+        if (const auto *latest = ringHeader->latest();
+            latest != nullptr && latest->capacity != bufferCapacity)
+        {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        return std::error_code();
+    }
+
+    void restoreCheckpoint() noexcept
+    {
+        const auto *latest = ringHeader->latest();
+        if (latest == nullptr)
+        {
+            return;
+        }
+
+        ringGeneration = latest->generation;
+        readOffset = latest->readOffset;
+        bufferSize = latest->size;
+        bufferRecords = latest->records;
+        writeOffset = (readOffset + bufferSize) % bufferCapacity;
+        dirtySize = 0;
+        checkpointPinned = 0;
+    }
+
+    [[nodiscard]] bool pushBytes(
+        const char *ptr, size_t length, size_t &offset, size_t &size) noexcept
+    {
+        if (size + length > bufferCapacity)
+        {
+            return false;
+        }
+
+        std::copy(ptr, ptr + length, buffer + offset);
+        offset = (offset + length) % bufferCapacity;
+        size += length;
+        return true;
+    }
+
+    template<typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    [[nodiscard]] bool pushImpl(const T &value, size_t &offset, size_t &size) noexcept
+    {
+        T little = ByteOrder::little(value);
+        return pushBytes(reinterpret_cast<const char *>(&little), sizeof(T), offset, size);
+    }
+
+    [[nodiscard]] bool pushImpl(const std::string &value, size_t &offset, size_t &size) noexcept
+    {
+        if (options.stringDictionary != 0)
+        {
+            return ringEncoder.encode(value, [&](const char *ptr, size_t length) {
+                return pushBytes(ptr, length, offset, size);
+            });
+        }
+
+        uint64_t length = value.length();
+        return pushImpl(length, offset, size) && pushBytes(value.data(), length, offset, size);
+    }
+
+    template<typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    [[nodiscard]] bool pullImpl(T &value, size_t &offset, size_t &size) noexcept
+    {
+        size_t typeSize = sizeof(T);
+        if (size < typeSize)
+        {
+            return false;
+        }
+
+        const char *ptr = buffer + offset;
+        std::copy(ptr, ptr + typeSize, reinterpret_cast<char *>(&value));
+        value = ByteOrder::little(value);
+        offset = (offset + typeSize) % bufferCapacity;
+        size -= typeSize;
+        return true;
+    }
+
+    // value points into ring or into dictionary, valid till the next pull
+    [[nodiscard]] bool pullString(std::string_view &value, size_t &offset, size_t &size) noexcept
+    {
+        if (options.stringDictionary != 0)
+        {
+            size_t length{0};
+            if (!ringDecoder.decode(buffer + offset, length, size, value))
+            {
+                return false;
+            }
+
+            offset = (offset + length) % bufferCapacity;
+            size -= length;
+            return true;
+        }
+
+        uint64_t length{0};
+        if (!pullImpl(length, offset, size) || size < length)
+        {
+            return false;
+        }
+
+        value = std::string_view(buffer + offset, length);
+        offset = (offset + length) % bufferCapacity;
+        size -= length;
+        return true;
+    }
+
+    template<typename Allocator>
+    [[nodiscard]] bool pullImpl(std::basic_string<char, std::char_traits<char>, Allocator> &value,
+        size_t &offset, size_t &size) noexcept
+    {
+        std::string_view view;
+        if (!pullString(view, offset, size))
+        {
+            return false;
+        }
+
+        try
+        {
+            value.assign(view.begin(), view.end());
+        }
+        catch (const std::bad_alloc &)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    template<typename T>
+    [[nodiscard]] bool pullImpl(
+        T &value, size_t &offset, size_t &size, std::pmr::memory_resource &arena) noexcept
+    {
+        return pullImpl(value, offset, size);
+    }
+
+    [[nodiscard]] bool pullImpl(std::string_view &value, size_t &offset, size_t &size,
+        std::pmr::memory_resource &arena) noexcept
+    {
+        std::string_view view;
+        if (!pullString(view, offset, size))
+        {
+            return false;
+        }
+
+        char *ptr{nullptr};
+        try
+        {
+            ptr = static_cast<char *>(arena.allocate(view.size(), alignof(char)));
+        }
+        catch (const std::bad_alloc &)
+        {
+            return false;
+        }
+        std::copy(view.begin(), view.end(), ptr);
+        value = std::string_view(ptr, view.size());
+        return true;
+    }
+
+    // Record of a variant repository is [uint8_t tag][alternative], an alternative is a field
+    // type or a std::tuple of them, encoded field after field
+    template<typename... Ts>
+    [[nodiscard]] bool pushImpl(
+        const std::variant<Ts...> &value, size_t &offset, size_t &size) noexcept
+    {
+        static_assert(sizeof...(Ts) <= 256, "variant tag is one byte");
+        auto tag = static_cast<uint8_t>(value.index());
+        return !value.valueless_by_exception() && pushImpl(tag, offset, size) &&
+               std::visit([&](const auto &alternative) {
+                   return pushImpl(alternative, offset, size);
+               }, value);
+    }
+
+    template<typename... Ts>
+    [[nodiscard]] bool pushImpl(
+        const std::tuple<Ts...> &value, size_t &offset, size_t &size) noexcept
+    {
+        return std::apply(
+            [&](const auto &...fields) {
+                bool ok{true};
+                ((ok = ok && pushImpl(fields, offset, size)), ...);
+                return ok;
+            },
+            value);
+    }
+
+    template<typename... Ts>
+    [[nodiscard]] bool pullImpl(std::variant<Ts...> &value, size_t &offset, size_t &size) noexcept
+    {
+        return pullVariant(value, offset, size, std::index_sequence_for<Ts...>());
+    }
+
+    template<typename... Ts, size_t... Indices>
+    [[nodiscard]] bool pullVariant(std::variant<Ts...> &value, size_t &offset, size_t &size,
+        std::index_sequence<Indices...>) noexcept
+    {
+        using Pull = bool (BasicDiskRepository::*)(std::variant<Ts...> &, size_t &, size_t &);
+        static constexpr Pull table[] = {&BasicDiskRepository::pullAlternative<Indices, Ts...>...};
+
+        uint8_t tag{0};
+        if (!pullImpl(tag, offset, size) || tag >= sizeof...(Ts))
+        {
+            return false;
+        }
+        return (this->*table[tag])(value, offset, size);
+    }
+
+    template<size_t Index, typename... Ts>
+    [[nodiscard]] bool pullAlternative(
+        std::variant<Ts...> &value, size_t &offset, size_t &size) noexcept
+    {
+        return pullImpl(value.template emplace<Index>(), offset, size);
+    }
+
+    template<typename... Ts>
+    [[nodiscard]] bool pullImpl(std::tuple<Ts...> &value, size_t &offset, size_t &size) noexcept
+    {
+        return std::apply(
+            [&](auto &...fields) {
+                bool ok{true};
+                ((ok = ok && pullImpl(fields, offset, size)), ...);
+                return ok;
+            },
+            value);
+    }
+
+    template<typename Visitor, size_t... Indices>
+    [[nodiscard]] bool pullVisitImpl(Visitor &visitor, std::index_sequence<Indices...>) noexcept
+    {
+        using Record = std::tuple_element_t<0, std::tuple<Args...>>;
+        using Pull = bool (BasicDiskRepository::*)(Visitor &, size_t &, size_t &);
+        static constexpr Pull table[] = {
+            &BasicDiskRepository::pullVisitAlternative<Visitor,
+                std::variant_alternative_t<Indices, Record>>...};
+
+        if (buffer == nullptr)
+        {
+            return false;
+        }
+
+        size_t offset = readOffset;
+        size_t size = bufferSize;
+        uint8_t tag{0};
+        if (!pullImpl(tag, offset, size) || tag >= sizeof...(Indices))
+        {
+            if (bufferRecords == 0)
+            {
+                DISKREPOSITORY_PROBE0(pull_empty);
+            }
+            return false;
+        }
+        return (this->*table[tag])(visitor, offset, size);
+    }
+
+    template<typename Visitor, typename Alternative>
+    [[nodiscard]] bool pullVisitAlternative(Visitor &visitor, size_t &offset, size_t &size) noexcept
+    {
+        Alternative alternative{};
+        if (!pullImpl(alternative, offset, size))
+        {
+            return false;
+        }
+
+        consume(offset, size);
+        visitor(alternative);
+        return true;
+    }
+
+    template<typename Arg, typename Out>
+    static constexpr bool pullableAs = std::is_same_v<Arg, Out> ||
+                                       (std::is_same_v<Arg, std::string> &&
+                                           (std::is_same_v<Out, std::pmr::string> ||
+                                               std::is_same_v<Out, std::string_view>));
+
+    template<typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    static size_t encodedSize(const T &value) noexcept
+    {
+        return sizeof(T);
+    }
+
+    static size_t encodedSize(const std::string &value) noexcept
+    {
+        return sizeof(uint64_t) + value.size();
+    }
+
+    template<typename... Ts>
+    static size_t encodedSize(const std::variant<Ts...> &value) noexcept
+    {
+        return sizeof(uint8_t) +
+               std::visit([](const auto &alternative) { return encodedSize(alternative); }, value);
+    }
+
+    template<typename... Ts>
+    static size_t encodedSize(const std::tuple<Ts...> &value) noexcept
+    {
+        return std::apply([](const auto &...fields) { return (encodedSize(fields) + ... + 0); },
+            value);
+    }
+
+    // writeBackBuffer must be reserved for encodedSize() of the record beforehand
+    template<typename T, typename = std::enable_if_t<std::is_integral_v<T> && UseDisk == true>>
+    void fillWriteBackBuffer(const T &value, size_t &offset) noexcept
+    {
+        ByteOrder::store(value, writeBackBuffer.data() + offset);
+        offset += sizeof(T);
+    }
+
+    // with a string dictionary, chunkEncoder must be reset at the start of the chunk
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    void fillWriteBackBuffer(const std::string &value, size_t &offset) noexcept
+    {
+        if (options.stringDictionary != 0)
+        {
+            // never longer than encodedSize(), so it always fits
+            (void)chunkEncoder.encode(value, [&](const char *ptr, size_t length) {
+                std::copy(ptr, ptr + length, writeBackBuffer.data() + offset);
+                offset += length;
+                return true;
+            });
+            return;
+        }
+
+        fillWriteBackBuffer(static_cast<uint64_t>(value.size()), offset);
+        std::copy(value.begin(), value.end(), writeBackBuffer.data() + offset);
+        offset += value.size();
+    }
+
+    template<typename... Ts, bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    void fillWriteBackBuffer(const std::variant<Ts...> &value, size_t &offset) noexcept
+    {
+        fillWriteBackBuffer(static_cast<uint8_t>(value.index()), offset);
+        std::visit([&](const auto &alternative) { fillWriteBackBuffer(alternative, offset); },
+            value);
+    }
+
+    template<typename... Ts, bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    void fillWriteBackBuffer(const std::tuple<Ts...> &value, size_t &offset) noexcept
+    {
+        std::apply([&](const auto &...fields) { (fillWriteBackBuffer(fields, offset), ...); },
+            value);
+    }
+
+    // dictionary is nullptr for chunks whose strings are stored as [uint64_t length][bytes]
+    template<typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    [[nodiscard]] bool decodeImpl(T &value, const char *ptr, size_t &offset, size_t size,
+        StringDictionaryDecoder *dictionary) noexcept
+    {
+        if (size - offset < sizeof(T))
+        {
+            return false;
+        }
+
+        value = ByteOrder::load<T>(ptr + offset);
+        offset += sizeof(T);
+        return true;
+    }
+
+    [[nodiscard]] bool decodeImpl(std::string &value, const char *ptr, size_t &offset,
+        size_t size, StringDictionaryDecoder *dictionary) noexcept
+    {
+        if (dictionary != nullptr)
+        {
+            std::string_view view;
+            if (!dictionary->decode(ptr, offset, size, view))
+            {
+                return false;
+            }
+
+            value.assign(view);
+            return true;
+        }
+
+        uint64_t length{0};
+        if (!decodeImpl(length, ptr, offset, size, dictionary) || size - offset < length)
+        {
+            return false;
+        }
+
+        value.assign(ptr + offset, length);
+        offset += length;
+        return true;
+    }
+
+    template<typename... Ts>
+    [[nodiscard]] bool decodeImpl(std::variant<Ts...> &value, const char *ptr, size_t &offset,
+        size_t size, StringDictionaryDecoder *dictionary) noexcept
+    {
+        return decodeVariant(
+            value, ptr, offset, size, dictionary, std::index_sequence_for<Ts...>());
+    }
+
+    template<typename... Ts, size_t... Indices>
+    [[nodiscard]] bool decodeVariant(std::variant<Ts...> &value, const char *ptr,
+        size_t &offset, size_t size, StringDictionaryDecoder *dictionary,
+        std::index_sequence<Indices...>) noexcept
+    {
+        using Decode = bool (BasicDiskRepository::*)(std::variant<Ts...> &, const char *,
+            size_t &, size_t, StringDictionaryDecoder *);
+        static constexpr Decode table[] = {
+            &BasicDiskRepository::decodeAlternative<Indices, Ts...>...};
+
+        uint8_t tag{0};
+        if (!decodeImpl(tag, ptr, offset, size, dictionary) || tag >= sizeof...(Ts))
+        {
+            return false;
+        }
+        return (this->*table[tag])(value, ptr, offset, size, dictionary);
+    }
+
+    template<size_t Index, typename... Ts>
+    [[nodiscard]] bool decodeAlternative(std::variant<Ts...> &value, const char *ptr,
+        size_t &offset, size_t size, StringDictionaryDecoder *dictionary) noexcept
+    {
+        return decodeImpl(value.template emplace<Index>(), ptr, offset, size, dictionary);
+    }
+
+    template<typename... Ts>
+    [[nodiscard]] bool decodeImpl(std::tuple<Ts...> &value, const char *ptr, size_t &offset,
+        size_t size, StringDictionaryDecoder *dictionary) noexcept
+    {
+        return std::apply(
+            [&](auto &...fields) {
+                bool ok{true};
+                ((ok = ok && decodeImpl(fields, ptr, offset, size, dictionary)), ...);
+                return ok;
+            },
+            value);
+    }
+
+    // all fields of a record, false if it isn't whole within size bytes
+    [[nodiscard]] bool decodeRecord(std::tuple<Args...> &record, const char *ptr,
+        size_t &offset, size_t size, StringDictionaryDecoder *dictionary) noexcept
+    {
+        return decodeImpl(record, ptr, offset, size, dictionary);
+    }
+
+    // Advances offset past a T without decoding it, false if it isn't whole within size
+    // bytes. Only for strings stored as [uint64_t length][bytes], i.e. without dictionary.
+    template<typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    static bool skipImpl(const T *, const char *ptr, size_t &offset, size_t size) noexcept
+    {
+        if (size - offset < sizeof(T))
+        {
+            return false;
+        }
+
+        offset += sizeof(T);
+        return true;
+    }
+
+    static bool skipImpl(
+        const std::string *, const char *ptr, size_t &offset, size_t size) noexcept
+    {
+        if (size - offset < sizeof(uint64_t))
+        {
+            return false;
+        }
+
+        uint64_t length = ByteOrder::load<uint64_t>(ptr + offset);
+        offset += sizeof(uint64_t);
+        if (size - offset < length)
+        {
+            return false;
+        }
+
+        offset += length;
+        return true;
+    }
+
+    template<typename... Ts>
+    static bool skipImpl(
+        const std::variant<Ts...> *, const char *ptr, size_t &offset, size_t size) noexcept
+    {
+        using Skip = bool (*)(const char *, size_t &, size_t);
+        static constexpr Skip table[] = {&skipAlternative<Ts>...};
+
+        if (size - offset < sizeof(uint8_t))
+        {
+            return false;
+        }
+
+        uint8_t tag = ptr[offset++];
+        return tag < sizeof...(Ts) && table[tag](ptr, offset, size);
+    }
+
+    template<typename T>
+    static bool skipAlternative(const char *ptr, size_t &offset, size_t size) noexcept
+    {
+        return skipImpl(static_cast<const T *>(nullptr), ptr, offset, size);
+    }
+
+    template<typename... Ts>
+    static bool skipImpl(
+        const std::tuple<Ts...> *, const char *ptr, size_t &offset, size_t size) noexcept
+    {
+        return (skipImpl(static_cast<const Ts *>(nullptr), ptr, offset, size) && ...);
+    }
+
+    static bool skipRecord(const char *ptr, size_t &offset, size_t size) noexcept
+    {
+        return skipImpl(static_cast<const std::tuple<Args...> *>(nullptr), ptr, offset, size);
+    }
+
+    // what transferIf() predicates get for a field: strings are viewed in place
+    template<typename T>
+    using FieldView = std::conditional_t<std::is_same_v<T, std::string>, std::string_view, T>;
+
+    template<typename T>
+    [[nodiscard]] bool viewImpl(T &value, const char *ptr, size_t &offset, size_t size) noexcept
+    {
+        return decodeImpl(value, ptr, offset, size, nullptr);
+    }
+
+    [[nodiscard]] bool viewImpl(
+        std::string_view &value, const char *ptr, size_t &offset, size_t size) noexcept
+    {
+        size_t start = offset;
+        if (!skipImpl(static_cast<const std::string *>(nullptr), ptr, offset, size))
+        {
+            return false;
+        }
+
+        start += sizeof(uint64_t);
+        value = std::string_view(ptr + start, offset - start);
+        return true;
+    }
+
+    // views fields Fields... of a record into views, skips the others
+    template<size_t... Fields, typename Views, size_t... Indices>
+    [[nodiscard]] bool viewRecord(Views &views, const char *ptr, size_t &offset, size_t size,
+        std::index_sequence<Indices...>) noexcept
+    {
+        bool ok{true};
+        ((ok = ok && viewField<Indices, Fields...>(views, ptr, offset, size)), ...);
+        return ok;
+    }
+
+    template<size_t Index, size_t... Fields, typename Views>
+    [[nodiscard]] bool viewField(
+        Views &views, const char *ptr, size_t &offset, size_t size) noexcept
+    {
+        using T = std::tuple_element_t<Index, std::tuple<Args...>>;
+        if constexpr (((Index == Fields) || ...))
+        {
+            constexpr size_t position = ((Fields < Index) + ... + 0);
+            return viewImpl(std::get<position>(views), ptr, offset, size);
+        }
+        else
+        {
+            return skipImpl(static_cast<const T *>(nullptr), ptr, offset, size);
+        }
+    }
+
+    // decoder to pass to decodeImpl() for a chunk, must start empty for every chunk
+    static StringDictionaryDecoder *chunkDictionary(
+        const SpillFrameTrailer &trailer, StringDictionaryDecoder &decoder) noexcept
+    {
+        return trailer.flags & SpillFrameTrailer::dictionaryFlag ? &decoder : nullptr;
+    }
+
+    // Columnar chunk of n records: a column per field in field order, holding n values of an
+    // integral field or n end offsets (uint64_t) into bytes of a string field, then bytes of
+    // every string field, field after field. It is exactly as long as the records row-wise.
+    template<typename T>
+    static constexpr bool columnarField =
+        std::is_integral_v<T> || std::is_same_v<T, std::string>;
+
+    static constexpr bool columnarRecord = (columnarField<Args> && ...);
+
+    template<typename T>
+    static constexpr size_t columnWidth =
+        std::is_same_v<T, std::string> ? sizeof(uint64_t) : sizeof(T);
+
+    // per record bytes of columns before each field, and of all columns as the last element
+    static constexpr std::array<size_t, sizeof...(Args) + 1> columnOffsets = [] {
+        std::array<size_t, sizeof...(Args) + 1> offsets{};
+        size_t widths[] = {columnWidth<Args>...};
+        for (size_t field = 0; field < sizeof...(Args); ++field)
+        {
+            offsets[field + 1] = offsets[field] + widths[field];
+        }
+        return offsets;
+    }();
+
+    struct ColumnarChunk
+    {
+        const char *ptr{nullptr};
+        size_t records{0};
+        std::array<const char *, sizeof...(Args)> bytes{}; // of string fields
+    };
+
+    // Transposes records produced by next(record), false when it fails, into writeBackBuffer,
+    // size is set to the chunk size
+    template<typename Next>
+    std::error_code fillColumns(size_t records, Next &&next, size_t &size) noexcept
+    {
+        size = records * columnOffsets.back();
+        if (!writeBackBuffer.reserve(size))
+        {
+            return std::make_error_code(std::errc::not_enough_memory);
+        }
+
+        columnBytes.resize(sizeof...(Args));
+        for (auto &bytes : columnBytes)
+        {
+            bytes.clear();
+        }
+
+        std::tuple<Args...> record;
+        for (size_t index = 0; index < records; ++index)
+        {
+            if (!next(record))
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+            fillColumns(record, index, records, std::index_sequence_for<Args...>());
+        }
+
+        for (const auto &bytes : columnBytes)
+        {
+            if (!writeBackBuffer.reserve(size + bytes.size()))
+            {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+            std::copy(bytes.begin(), bytes.end(), writeBackBuffer.data() + size);
+            size += bytes.size();
+        }
+        return std::error_code();
+    }
+
+    template<size_t... Fields>
+    void fillColumns(const std::tuple<Args...> &record, size_t index, size_t records,
+        std::index_sequence<Fields...>) noexcept
+    {
+        (fillColumn(std::get<Fields>(record), Fields, index, records), ...);
+    }
+
+    template<typename T>
+    void fillColumn(const T &value, size_t field, size_t index, size_t records) noexcept
+    {
+        char *column = writeBackBuffer.data() + records * columnOffsets[field];
+        if constexpr (std::is_same_v<T, std::string>)
+        {
+            columnBytes[field].append(value);
+            uint64_t end = columnBytes[field].size();
+            ByteOrder::store(end, column + index * sizeof(end));
+        }
+        else
+        {
+            ByteOrder::store(value, column + index * sizeof(T));
+        }
+    }
+
+    // false if size bytes at ptr can't be a columnar chunk of given records
+    static bool openColumns(
+        ColumnarChunk &chunk, const char *ptr, size_t size, size_t records) noexcept
+    {
+        if (!columnarRecord || size / columnOffsets.back() < records)
+        {
+            return false;
+        }
+
+        chunk.ptr = ptr;
+        chunk.records = records;
+        size_t offset = records * columnOffsets.back();
+        size_t field{0};
+        bool ok{true};
+        ((ok = ok && openBytes<Args>(chunk, field++, offset, size)), ...);
+        return ok && offset == size;
+    }
+
+    template<typename T>
+    static bool openBytes(ColumnarChunk &chunk, size_t field, size_t &offset, size_t size) noexcept
+    {
+        if constexpr (std::is_same_v<T, std::string>)
+        {
+            uint64_t length{0};
+            if (chunk.records != 0)
+            {
+                const char *column = chunk.ptr + chunk.records * columnOffsets[field];
+                length = ByteOrder::load<uint64_t>(column + (chunk.records - 1) * sizeof(length));
+            }
+
+            if (size - offset < length)
+            {
+                return false;
+            }
+            chunk.bytes[field] = chunk.ptr + offset;
+            offset += length;
+        }
+        return true;
+    }
+
+    // record number index of an opened chunk
+    static bool decodeColumns(
+        std::tuple<Args...> &record, const ColumnarChunk &chunk, size_t index) noexcept
+    {
+        return std::apply(
+            [&](auto &...fields) {
+                size_t field{0};
+                bool ok{true};
+                ((ok = ok && decodeColumn(fields, chunk, field++, index)), ...);
+                return ok;
+            },
+            record);
+    }
+
+    template<typename T>
+    static bool decodeColumn(
+        T &value, const ColumnarChunk &chunk, size_t field, size_t index) noexcept
+    {
+        const char *column = chunk.ptr + chunk.records * columnOffsets[field];
+        if constexpr (std::is_same_v<T, std::string>)
+        {
+            constexpr size_t width = sizeof(uint64_t);
+            uint64_t start{0};
+            if (index != 0)
+            {
+                start = ByteOrder::load<uint64_t>(column + (index - 1) * width);
+            }
+            uint64_t end = ByteOrder::load<uint64_t>(column + index * width);
+            uint64_t length = ByteOrder::load<uint64_t>(column + (chunk.records - 1) * width);
+
+            if (start > end || end > length)
+            {
+                return false;
+            }
+            value.assign(chunk.bytes[field] + start, end - start);
+            return true;
+        }
+        else if constexpr (std::is_integral_v<T>)
+        {
+            value = ByteOrder::load<T>(column + index * sizeof(T));
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // Puts records of a columnar chunk staged in writeBackBuffer into ring, encoded as ring
+    // expects them, ringSize is set to the bytes they take
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code refillColumns(size_t size, size_t records, size_t &ringSize) noexcept
+    {
+        ColumnarChunk chunk;
+        if (!openColumns(chunk, writeBackBuffer.data(), size, records))
+        {
+            return std::make_error_code(std::errc::bad_message);
+        }
+
+        std::tuple<Args...> record;
+        size_t offset{0};
+        ringSize = 0;
+        ringEncoder.reset();
+        for (size_t index = 0; index < records; ++index)
+        {
+            ringEncoder.begin();
+            if (!decodeColumns(record, chunk, index) || !pushImpl(record, offset, ringSize))
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+        }
+        return std::error_code();
+    }
+
+    // Feeds field Field of every spilled record to scan: scan(column, records) for columns
+    // of columnar chunks, scan(value) for other chunks which are decoded record by record
+    template<size_t Field, typename Scan, bool Enable = UseDisk,
+        typename = std::enable_if_t<Enable == true>>
+    std::error_code scanField(Scan &&scan) noexcept
+    {
+        using T = std::tuple_element_t<Field, std::tuple<Args...>>;
+        if (auto ec = loadIndex(); ec)
+        {
+            return ec;
+        }
+
+        StringDictionaryDecoder dictionary;
+        std::tuple<Args...> record;
+        for (const auto &entry : spillIndex)
+        {
+            off_t frameEnd = entry.frameEnd;
+            SpillFrameTrailer trailer;
+            if (auto ec = readFrameTrailer(frameEnd, trailer); ec)
+            {
+                return ec;
+            }
+
+            if (!trailer.valid())
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            bool columnar = trailer.flags & SpillFrameTrailer::columnarFlag;
+            size_t columnOffset = trailer.records * columnOffsets[Field];
+            size_t columnSize = trailer.records * sizeof(T);
+            if (columnar && (!columnarRecord || trailer.dataSize < columnOffset + columnSize))
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            // column alone, which skips payload checksum
+            if (columnar && trailer.codec == 0)
+            {
+                if (!scanBuffer.reserve(columnSize))
+                {
+                    return std::make_error_code(std::errc::not_enough_memory);
+                }
+
+                if (auto ec = readFully(scanBuffer.data(), columnSize,
+                        frameEnd - trailer.frameSize() + columnOffset);
+                    ec)
+                {
+                    return ec;
+                }
+                ByteOrder::littleArray<T>(scanBuffer.data(), trailer.records);
+                scan(static_cast<const char *>(scanBuffer.data()), size_t(trailer.records));
+                continue;
+            }
+
+            if (!replayBuffer.reserve(trailer.dataSize))
+            {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+
+            if (auto ec = readChunk(
+                    frameEnd, trailer, replayBuffer.data(), spillBuffer, directBuffer);
+                ec)
+            {
+                return ec;
+            }
+
+            if (columnar)
+            {
+                ByteOrder::littleArray<T>(replayBuffer.data() + columnOffset, trailer.records);
+                scan(static_cast<const char *>(replayBuffer.data() + columnOffset),
+                    size_t(trailer.records));
+                continue;
+            }
+
+            size_t offset{0};
+            dictionary.reset();
+            for (uint64_t index = 0; index < trailer.records; ++index)
+            {
+                if (!decodeRecord(record, replayBuffer.data(), offset, trailer.dataSize,
+                        chunkDictionary(trailer, dictionary)))
+                {
+                    return std::make_error_code(std::errc::bad_message);
+                }
+                scan(std::as_const(std::get<Field>(record)));
+            }
+        }
+
+        return std::error_code();
+    }
+
+    // commits a record pulled from readOffset till offset, size is what is left in ring
+    void consume(size_t offset, size_t size) noexcept
+    {
+        repositoryStats.pulled(bufferSize - size);
+        unqueued(bufferSize - size);
+        readOffset = offset;
+        bufferSize = size;
+        --bufferRecords;
+        // records left may refer to strings defined by this one
+        ringSelfContained = false;
+    }
+
+    // bytes push() may take
+    size_t freeSize() const noexcept
+    {
+        return bufferCapacity - bufferSize - pinnedSize();
+    }
+
+    template<bool OtherDisk, typename OtherStats>
+    std::error_code checkTransfer(
+        const BasicDiskRepository<OtherDisk, OtherStats, Args...> &other) const noexcept
+    {
+        if (buffer == nullptr || other.buffer == nullptr)
+        {
+            return std::make_error_code(std::errc::bad_file_descriptor);
+        }
+
+        if (static_cast<const void *>(&other) == this)
+        {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        if (options.stringDictionary != 0 || other.options.stringDictionary != 0)
+        {
+            return std::make_error_code(std::errc::not_supported);
+        }
+        return std::error_code();
+    }
+
+    template<bool OtherDisk, typename OtherStats, size_t... Fields, typename Predicate>
+    std::pair<std::error_code, size_t> transferIfImpl(
+        BasicDiskRepository<OtherDisk, OtherStats, Args...> &other, Predicate &predicate,
+        std::index_sequence<Fields...>) noexcept
+    {
+        static_assert(increasing<Fields...>(), "field indices must increase");
+
+        if (auto ec = checkTransfer(other); ec)
+        {
+            return {ec, 0};
+        }
+        unpin();
+
+        // offsets are from where ring started when called, runs are committed in order
+        const char *ptr = buffer + readOffset;
+        size_t size = bufferSize;
+        size_t records = bufferRecords;
+        std::tuple<FieldView<std::tuple_element_t<Fields, std::tuple<Args...>>>...> views;
+        size_t runStart{0};
+        size_t runRecords{0};
+        bool runMoves{false};
+        size_t moved{0};
+        size_t kept{0};
+        std::error_code ec;
+
+        auto commit = [&](size_t end) {
+            if (runMoves)
+            {
+                moveRecords(other, end - runStart, runRecords);
+                moved += runRecords;
+            }
+            else
+            {
+                rotateRecords(end - runStart, runRecords);
+                kept += runRecords;
+            }
+            runStart = end;
+            runRecords = 0;
+        };
+
+        size_t offset{0};
+        for (size_t index = 0; index < records; ++index)
+        {
+            size_t next = offset;
+            if (!viewRecord<Fields...>(
+                    views, ptr, next, size, std::index_sequence_for<Args...>()))
+            {
+                ec = std::make_error_code(std::errc::bad_message);
+                break;
+            }
+
+            bool moves = std::apply(predicate, std::as_const(views));
+            if (runRecords != 0 && moves != runMoves)
+            {
+                commit(offset);
+            }
+
+            if (moves && next - runStart > other.freeSize())
+            {
+                break;
+            }
+
+            runMoves = moves;
+            offset = next;
+            ++runRecords;
+        }
+
+        if (runRecords != 0)
+        {
+            commit(offset);
+        }
+
+        // records that stayed went after those not looked at, which follow them again
+        if (offset != size && kept != 0)
+        {
+            runMoves = false;
+            runRecords = records - moved - kept;
+            commit(size);
+        }
+        return {ec, moved};
+    }
+
+    template<typename Predicate, size_t... Fields>
+    std::pair<std::error_code, size_t> flushIfImpl(
+        Predicate &predicate, std::index_sequence<Fields...>) noexcept
+    {
+        static_assert(increasing<Fields...>(), "field indices must increase");
+
+        if (options.stringDictionary != 0)
+        {
+            return {std::make_error_code(std::errc::not_supported), 0};
+        }
+
+        if (!writeBackBuffer.reserve(bufferSize))
+        {
+            return {std::make_error_code(std::errc::not_enough_memory), 0};
+        }
+        unpin();
+
+        uint64_t start = Stats::now();
+        const char *ptr = buffer + readOffset;
+        size_t size = bufferSize;
+        size_t records = bufferRecords;
+        std::tuple<FieldView<std::tuple_element_t<Fields, std::tuple<Args...>>>...> views;
+        size_t chunkSize{0};
+        size_t chunkRecords{0};
+
+        // chunk is built and written first, so ring is untouched if that fails
+        for (size_t index = 0, offset = 0; index < records; ++index)
+        {
+            size_t next = offset;
+            if (!viewRecord<Fields...>(
+                    views, ptr, next, size, std::index_sequence_for<Args...>()))
+            {
+                return {std::make_error_code(std::errc::bad_message), 0};
+            }
+
+            if (std::apply(predicate, std::as_const(views)))
+            {
+                std::memcpy(writeBackBuffer.data() + chunkSize, ptr + offset, next - offset);
+                chunkSize += next - offset;
+                ++chunkRecords;
+            }
+            offset = next;
+        }
+
+        if (chunkRecords == 0)
+        {
+            return {std::error_code(), 0};
+        }
+
+        DISKREPOSITORY_PROBE2(flush_begin, chunkSize, chunkRecords);
+        auto ec = flushImpl(writeBackBuffer.data(), chunkSize, chunkRecords);
+        DISKREPOSITORY_PROBE3(flush_end, chunkSize, ec ? 0 : lastTrailer.frameSize(), ec.value());
+        if (ec)
+        {
+            return {ec, 0};
+        }
+        repositoryStats.flushed(lastTrailer.frameSize(), false, start);
+
+        // then runs of spilled records are dropped from the front of ring and runs of others
+        // rotated to its back, which leaves the others in order
+        size_t runStart{0};
+        size_t runRecords{0};
+        bool runSpills{false};
+
+        auto commit = [&](size_t end) {
+            if (runSpills)
+            {
+                dropFront(end - runStart);
+                bufferSize -= end - runStart;
+                bufferRecords -= runRecords;
+                repositoryStats.spilledFront(runRecords);
+            }
+            else
+            {
+                rotateRecords(end - runStart, runRecords);
+            }
+            runStart = end;
+            runRecords = 0;
+        };
+
+        size_t offset{0};
+        for (size_t index = 0; index < records; ++index)
+        {
+            size_t next = offset;
+            (void)viewRecord<Fields...>(views, ptr, next, size, std::index_sequence_for<Args...>());
+            bool spills = std::apply(predicate, std::as_const(views));
+            if (runRecords != 0 && spills != runSpills)
+            {
+                commit(offset);
+            }
+
+            runSpills = spills;
+            offset = next;
+            ++runRecords;
+        }
+        commit(offset);
+        return {std::error_code(), chunkRecords};
+    }
+
+    template<size_t... Fields>
+    static constexpr bool increasing() noexcept
+    {
+        size_t fields[] = {Fields...};
+        for (size_t index = 1; index < sizeof...(Fields); ++index)
+        {
+            if (fields[index - 1] >= fields[index])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Moves size bytes of count records from the front of this ring to the back of other's,
+    // where they must fit
+    template<bool OtherDisk, typename OtherStats>
+    void moveRecords(BasicDiskRepository<OtherDisk, OtherStats, Args...> &other, size_t size,
+        size_t count) noexcept
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        DISKREPOSITORY_PROBE2(transfer, count, size);
+        const char *ptr = buffer + readOffset;
+        if constexpr (!std::is_same_v<Stats, NullRepositoryStats> ||
+                      !std::is_same_v<OtherStats, NullRepositoryStats>)
+        {
+            for (size_t offset = 0; offset < size;)
+            {
+                size_t next = offset;
+                (void)skipRecord(ptr, next, size);
+                uint64_t pushTime = repositoryStats.transferredOut(next - offset);
+                other.repositoryStats.transferredIn(
+                    next - offset, other.bufferSize + next, pushTime);
+                offset = next;
+            }
+        }
+
+        // both rings are mapped twice in a row, so the bytes are contiguous on both sides
+        std::memcpy(other.buffer + other.writeOffset, ptr, size);
+        other.writeOffset = (other.writeOffset + size) % other.bufferCapacity;
+        other.dirtySize += size;
+        other.bufferSize += size;
+        other.bufferRecords += count;
+
+        dropFront(size);
+        bufferSize -= size;
+        bufferRecords -= count;
+    }
+
+    // Moves size bytes of count records from the front of ring to its back, nothing may be
+    // pinned. Source is addressed relative to writeOffset: when ring is nearly full, source
+    // and destination overlap and memmove must see them through the same mapping.
+    void rotateRecords(size_t size, size_t count) noexcept
+    {
+        repositoryStats.rotated(count);
+        size_t free = bufferCapacity - bufferSize + size;
+        if (free == size)
+        {
+            // full ring: bytes are where they'd go already
+            readOffset = (readOffset + size) % bufferCapacity;
+            writeOffset = readOffset;
+            dirtySize += size;
+            return;
+        }
+
+        std::memmove(buffer + writeOffset, buffer + writeOffset + free - size, size);
+        readOffset = (readOffset + size) % bufferCapacity;
+        writeOffset = (writeOffset + size) % bufferCapacity;
+        dirtySize += size;
+    }
+
+    // spills whole ring content, ptr holds size bytes of it in the order to write;
+    // ring content as is gets split into chunks when spillLatencyTarget asks for that
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code flushRing(const char *ptr, size_t size, uint8_t flags) noexcept
+    {
+        uint64_t start = Stats::now();
+        DISKREPOSITORY_PROBE2(flush_begin, size, bufferRecords);
+        bool paced = options.spillLatencyTarget != 0;
+        size_t chunkSize = paced && flags == 0 && ptr == buffer + readOffset
+                               ? spillPacer.chunkSize()
+                               : size;
+        size_t frames{1};
+        size_t spilled{0};
+        std::error_code ec;
+
+        if (size > chunkSize)
+        {
+            ec = flushChunks(chunkSize, frames, spilled);
+        }
+        else if (ec = flushImpl(ptr, size, bufferRecords, flags); !ec)
+        {
+            spilled = lastTrailer.frameSize();
+        }
+
+        DISKREPOSITORY_PROBE3(flush_end, size, ec ? 0 : spilled, ec.value());
+        if (paced)
+        {
+            repositoryStats.paced(
+                frames, spillPacer.chunkSize(), spillPacer.overhead(), spillPacer.bandwidth());
+        }
+        if (!ec)
+        {
+            repositoryStats.flushed(spilled, true, start);
+            reset();
+        }
+        return ec;
+    }
+
+    // Spills ring content as chunks of up to chunkSize bytes, or a single record if it is
+    // larger. Chunks are cut at record boundaries, found by decoding records one by one.
+    // When a chunk fails to be written, records already written are dropped from ring, so
+    // flush() can be retried without spilling them twice.
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code flushChunks(size_t chunkSize, size_t &frames, size_t &spilled) noexcept
+    {
+        const char *ptr = buffer + readOffset;
+        std::tuple<Args...> record;
+        size_t begin{0};
+        size_t end{0};
+        size_t records{0};
+        size_t written{0};
+        std::error_code ec;
+        frames = 0;
+
+        auto write = [&]() {
+            if (auto ec = flushImpl(ptr + begin, end - begin, records); ec)
+            {
+                return ec;
+            }
+            ++frames;
+            spilled += lastTrailer.frameSize();
+            written += records;
+            begin = end;
+            records = 0;
+            return std::error_code();
+        };
+
+        for (size_t offset = 0; offset < bufferSize && !ec;)
+        {
+            if (!decodeRecord(record, ptr, offset, bufferSize, nullptr))
+            {
+                ec = std::make_error_code(std::errc::bad_message);
+            }
+            else if (records != 0 && offset - begin > chunkSize)
+            {
+                ec = write();
+            }
+
+            end = offset;
+            ++records;
+        }
+
+        if (!ec)
+        {
+            ec = write();
+        }
+
+        if (ec && frames != 0)
+        {
+            dropFront(begin);
+            bufferSize -= begin;
+            bufferRecords -= written;
+            repositoryStats.spilledFront(written);
+        }
+        return ec;
+    }
+
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code flushImpl(
+        const char *ptr, size_t size, size_t records, uint8_t flags = 0) noexcept
+    {
+        if (backupFile == -1)
+        {
+            return std::make_error_code(std::errc::bad_file_descriptor);
+        }
+
+        // codec time counts in the latency a chunk of this size takes too
+        uint64_t start = options.spillLatencyTarget != 0 ? TscClock::now() : 0;
+        SpillFrameTrailer trailer;
+        trailer.storedSize = size;
+        trailer.dataSize = size;
+        trailer.records = records;
+        trailer.flags = flags;
+        trailer.firstSequence = spillSequence;
+        trailer.totalFrames = lastTrailer.totalFrames + 1;
+        trailer.totalRecords = lastTrailer.totalRecords + records;
+        trailer.totalDataSize = lastTrailer.totalDataSize + size;
+        const char *payload = ptr;
+
+        if (const auto *codec = options.spillCodec; codec != nullptr && size != 0)
+        {
+            // incompressible chunks are stored as is, so refill never pays for decoding them
+            size_t compressed{0};
+            if (spillBuffer.reserve(codec->maxCompressedSize(size)))
+            {
+                compressed =
+                    codec->compress(ptr, size, spillBuffer.data(), spillBuffer.capacity());
+            }
+
+            if (compressed != 0 && compressed < size)
+            {
+                payload = spillBuffer.data();
+                trailer.storedSize = compressed;
+                trailer.codec = codec->id();
+            }
+        }
+
+        trailer.payloadCrc = Crc32c::compute(0, payload, trailer.storedSize);
+
+        off_t frameEnd{0};
+        if (directBlockSize != 0)
+        {
+            if (auto ec = writeDirect(payload, trailer, frameEnd); ec)
+            {
+                return ec;
+            }
+        }
+        else if (auto ec = writeBuffered(payload, trailer, frameEnd); ec)
+        {
+            return ec;
+        }
+
+        if (options.spillLatencyTarget != 0)
+        {
+            spillPacer.record(size, TscClock::toNanoseconds(TscClock::now() - start));
+        }
+
+        lastTrailer = trailer;
+        spillSequence += records;
+        if (indexLoaded)
+        {
+            spillIndex.push_back({trailer.firstSequence, static_cast<uint64_t>(frameEnd)});
+        }
+        return std::error_code();
+    }
+
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code writeBuffered(
+        const char *payload, SpillFrameTrailer &trailer, off_t &frameEnd) noexcept
+    {
+        trailer.seal();
+        SpillFrameTrailer image = trailer.fileImage();
+        off_t fileSize = ::lseek(backupFile, 0, SEEK_END);
+
+        iovec iov[] = {
+            {const_cast<char *>(payload), trailer.storedSize},
+            {&image, sizeof(image)},
+        };
+        size_t bytesLeft = trailer.storedSize + sizeof(trailer);
+        size_t index{0};
+
+        do
+        {
+            ssize_t bytes = ::writev(backupFile, iov + index, std::size(iov) - index);
+            if (bytes == -1)
+            {
+                return tornWrite(fileSize);
+            }
+            bytesLeft -= bytes;
+
+            while (index < std::size(iov) && static_cast<size_t>(bytes) >= iov[index].iov_len)
+            {
+                bytes -= iov[index].iov_len;
+                ++index;
+            }
+            if (index < std::size(iov))
+            {
+                iov[index].iov_base = static_cast<char *>(iov[index].iov_base) + bytes;
+                iov[index].iov_len -= bytes;
+            }
+        } while (bytesLeft > 0);
+
+        frameEnd = ::lseek(backupFile, 0, SEEK_CUR);
+        return std::error_code();
+    }
+
+    // cuts off what a failed write left past fileSize, so the next frame follows the last whole
+    // one; returns the error of the write
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code tornWrite(off_t fileSize) noexcept
+    {
+        auto ec = std::make_error_code(static_cast<std::errc>(errno));
+        (void)::ftruncate(backupFile, fileSize);
+        return ec;
+    }
+
+    // Frame is staged as whole blocks: the partial block at the end of file, if any (a file
+    // written without direct I/O), then payload, zero padding and trailer in the last bytes.
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code writeDirect(
+        const char *payload, SpillFrameTrailer &trailer, off_t &frameEnd) noexcept
+    {
+        off_t fileSize = ::lseek(backupFile, 0, SEEK_END);
+        if (fileSize == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        off_t writeOffset = fileSize / directBlockSize * directBlockSize;
+        size_t head = fileSize - writeOffset;
+        size_t size = head + trailer.storedSize + sizeof(trailer);
+        size_t alignedSize = (size + directBlockSize - 1) / directBlockSize * directBlockSize;
+        trailer.padding = alignedSize - size;
+        trailer.seal();
+        SpillFrameTrailer image = trailer.fileImage();
+
+        if (!directBuffer.reserve(alignedSize))
+        {
+            return std::make_error_code(std::errc::not_enough_memory);
+        }
+
+        char *staging = directBuffer.data();
+        if (head != 0 && ::pread(backupFile, staging, directBlockSize, writeOffset) < ssize_t(head))
+        {
+            return std::make_error_code(std::errc::io_error);
+        }
+
+        std::copy(payload, payload + trailer.storedSize, staging + head);
+        std::fill_n(staging + head + trailer.storedSize, trailer.padding, 0);
+        std::memcpy(staging + alignedSize - sizeof(image), &image, sizeof(image));
+
+        for (size_t bytesWritten = 0; bytesWritten < alignedSize;)
+        {
+            ssize_t bytes = ::pwrite(backupFile, staging + bytesWritten,
+                alignedSize - bytesWritten, writeOffset + bytesWritten);
+            if (bytes == -1)
+            {
+                return tornWrite(fileSize);
+            }
+            bytesWritten += bytes;
+        }
+
+        frameEnd = writeOffset + alignedSize;
+        return std::error_code();
+    }
+
+    // a chunk goes into ring only when its strings are encoded the way ring expects
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code refillImpl(char *ptr, size_t size, SpillFrameTrailer &trailer, bool intoRing)
+    {
+        off_t frameEnd{0};
+        if (auto ec = readTrailer(trailer, frameEnd); ec)
+        {
+            return ec;
+        }
+
+        if (frameEnd == 0 || trailer.dataSize != size)
+        {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        bool dictionary = trailer.flags & SpillFrameTrailer::dictionaryFlag;
+        bool columnar = trailer.flags & SpillFrameTrailer::columnarFlag;
+        if ((columnar && !columnarRecord) ||
+            (intoRing && !columnar && dictionary != (options.stringDictionary != 0)))
+        {
+            return std::make_error_code(std::errc::not_supported);
+        }
+
+        // columnar chunk is staged, caller transposes it into ring with refillColumns()
+        if (intoRing && columnar)
+        {
+            if (!writeBackBuffer.reserve(size))
+            {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+            ptr = writeBackBuffer.data();
+        }
+
+        off_t fileReadOffset = frameEnd - trailer.frameSize();
+        if (options.prefetchDepth == 0 || !prefetcher.take({frameEnd, trailer}, ptr))
+        {
+            if (auto ec = readChunk(frameEnd, trailer, ptr, spillBuffer, directBuffer); ec)
+            {
+                return ec;
+            }
+        }
+
+        SpillFrameTrailer previous;
+        if (fileReadOffset != spillStart)
+        {
+            if (auto ec = readFrameTrailer(fileReadOffset, previous); ec)
+            {
+                return ec;
+            }
+        }
+
+        if (auto ec = saveSequence(); ec)
+        {
+            return ec;
+        }
+
+        if (::ftruncate(backupFile, fileReadOffset) == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        lastTrailer = previous;
+        if (indexLoaded && !spillIndex.empty())
+        {
+            spillIndex.pop_back();
+        }
+
+        // chunk is in ring already, failing to prefetch the next ones only costs latency
+        (void)prefetch();
+        return std::error_code();
+    }
+
+    // Reads payload of chunk ending at frameEnd into ptr, which must fit trailer.dataSize
+    // bytes. Scratch buffers are passed in, so prefetcher can call it from its own thread.
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code readChunk(off_t frameEnd, const SpillFrameTrailer &trailer, char *ptr,
+        PageBuffer &codecBuffer, PageBuffer &readBuffer) const noexcept
+    {
+        off_t fileReadOffset = frameEnd - trailer.frameSize();
+        if (trailer.codec == 0)
+        {
+            if (auto ec = readFully(ptr, trailer.dataSize, fileReadOffset, readBuffer); ec)
+            {
+                return ec;
+            }
+
+            if (Crc32c::compute(0, ptr, trailer.dataSize) != trailer.payloadCrc)
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+        }
+        else
+        {
+            const auto *codec = SpillCodecRegistry::find(trailer.codec);
+            if (codec == nullptr)
+            {
+                return std::make_error_code(std::errc::not_supported);
+            }
+
+            if (!codecBuffer.reserve(trailer.storedSize))
+            {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+
+            if (auto ec = readFully(
+                    codecBuffer.data(), trailer.storedSize, fileReadOffset, readBuffer);
+                ec)
+            {
+                return ec;
+            }
+
+            if (Crc32c::compute(0, codecBuffer.data(), trailer.storedSize) != trailer.payloadCrc)
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            if (!codec->decompress(codecBuffer.data(), trailer.storedSize, ptr, trailer.dataSize))
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+        }
+
+        return std::error_code();
+    }
+
+    // Description of Args... hashed as SpillSchema tells, stored in SpillFileHeader
+    static constexpr uint64_t schemaFingerprint() noexcept
+    {
+        return schemaOf<Args...>(SpillSchema::basis);
+    }
+
+    template<typename... Ts>
+    static constexpr uint64_t schemaOf(uint64_t hash) noexcept
+    {
+        bool first{true};
+        ((hash = schemaOf(first ? hash : SpillSchema::mix(hash, ","), static_cast<Ts *>(nullptr)),
+             first = false),
+            ...);
+        return hash;
+    }
+
+    template<typename T>
+    static constexpr uint64_t schemaOf(uint64_t hash, T *) noexcept
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            return SpillSchema::mix(hash, "b");
+        }
+        else if constexpr (std::is_same_v<T, char>)
+        {
+            return SpillSchema::mix(hash, "c");
+        }
+        else if constexpr (std::is_integral_v<T>)
+        {
+            const char text[] = {std::is_signed_v<T> ? 'i' : 'u', char('0' + sizeof(T))};
+            return SpillSchema::mix(hash, std::string_view(text, sizeof(text)));
+        }
+        else
+        {
+            static_assert(std::is_same_v<T, std::string>, "no schema for this field type");
+            return SpillSchema::mix(hash, "s");
+        }
+    }
+
+    template<typename... Ts>
+    static constexpr uint64_t schemaOf(uint64_t hash, std::variant<Ts...> *) noexcept
+    {
+        return SpillSchema::mix(schemaOf<Ts...>(SpillSchema::mix(hash, "v(")), ")");
+    }
+
+    template<typename... Ts>
+    static constexpr uint64_t schemaOf(uint64_t hash, std::tuple<Ts...> *) noexcept
+    {
+        return SpillSchema::mix(schemaOf<Ts...>(SpillSchema::mix(hash, "t(")), ")");
+    }
+
+    // Checks header of backup file and sets spillStart, a new file gets its header here. A
+    // file of another schema or of a newer version isn't touched, nor is one with a corrupt
+    // header, since whatever follows the header can't be trusted to be frames, nor is a file
+    // too short for a header unless it holds the start of the one written here.
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code openHeader() noexcept
+    {
+        struct stat st;
+        if (::fstat(backupFile, &st) == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        SpillFileHeader created;
+        created.schemaFingerprint = schemaFingerprint();
+        created.seal();
+        SpillFileHeader image = created.fileImage();
+
+        SpillFileHeader fileBytes;
+        size_t size = std::min<size_t>(st.st_size, sizeof(fileBytes));
+        if (size != 0 && ::pread(backupFile, &fileBytes, size, 0) != ssize_t(size))
+        {
+            return std::make_error_code(std::errc::io_error);
+        }
+
+        SpillFileHeader header = fileBytes;
+        header.fromFile();
+        bool magic = size >= SpillFileHeader::version1Size &&
+                     header.magic == SpillFileHeader::fileMagic;
+
+        // version 1 header is shorter, a file of just that one is too
+        if (magic && size >= header.fieldsSize())
+        {
+            if (!header.valid() || header.headerSize < header.fieldsSize() ||
+                header.headerSize > st.st_size)
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            if (header.version > SpillFileHeader::currentVersion)
+            {
+                return std::make_error_code(std::errc::not_supported);
+            }
+
+            if (header.schemaFingerprint != schemaFingerprint())
+            {
+                return std::make_error_code(std::errc::invalid_argument);
+            }
+
+            spillHeader = header;
+            spillStart = header.headerSize;
+            return std::error_code();
+        }
+
+        if (!magic && size >= SpillFileHeader::version1Size)
+        {
+            // version 0 file, it reads as version 1 where that is host order and size_t
+            // lengths were 8 bytes; new chunks are appended to it without a header
+            if (!ByteOrder::hostLittle || sizeof(size_t) != sizeof(uint64_t))
+            {
+                return std::make_error_code(std::errc::not_supported);
+            }
+            spillHeader = SpillFileHeader();
+            spillHeader.version = 0;
+            spillHeader.headerSize = 0;
+            spillStart = 0;
+            return std::error_code();
+        }
+
+        // empty file, or a header torn while the file was being created
+        if (std::memcmp(&fileBytes, &image, size) != 0)
+        {
+            return std::make_error_code(std::errc::bad_message);
+        }
+
+        if (::pwrite(backupFile, &image, sizeof(image), 0) != ssize_t(sizeof(image)))
+        {
+            return std::make_error_code(std::errc::io_error);
+        }
+
+        spillHeader = created;
+        spillStart = sizeof(created);
+        return std::error_code();
+    }
+
+    // Rewrites nextSequence of header before a refill cuts chunks off the file, once they
+    // are gone the sequence numbers they took are only known from it. Files of versions
+    // before SpillFileHeader::sequenceVersion have nowhere to keep it.
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code saveSequence() noexcept
+    {
+        if (spillHeader.version < SpillFileHeader::sequenceVersion ||
+            spillHeader.nextSequence >= spillSequence)
+        {
+            return std::error_code();
+        }
+
+        SpillFileHeader header = spillHeader;
+        header.nextSequence = spillSequence;
+        header.seal();
+        SpillFileHeader image = header.fileImage();
+
+        if (directBlockSize == 0)
+        {
+            if (::pwrite(backupFile, &image, sizeof(image), 0) != ssize_t(sizeof(image)))
+            {
+                return std::make_error_code(std::errc::io_error);
+            }
+        }
+        else
+        {
+            // header shares its block with the first frame
+            if (!directBuffer.reserve(directBlockSize))
+            {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+
+            char *staging = directBuffer.data();
+            if (::pread(backupFile, staging, directBlockSize, 0) < ssize_t(sizeof(image)))
+            {
+                return std::make_error_code(std::errc::io_error);
+            }
+
+            std::memcpy(staging, &image, sizeof(image));
+            if (::pwrite(backupFile, staging, directBlockSize, 0) != ssize_t(directBlockSize))
+            {
+                return std::make_error_code(std::errc::io_error);
+            }
+        }
+
+        spillHeader = header;
+        return std::error_code();
+    }
+
+    // Only the tail of backup file is inspected: the last chunk must have a sealed trailer,
+    // intact payload and running totals matching its predecessor. Since every trailer carries
+    // totals of the whole file, that is enough to know what is spilled without a full scan.
+    // Anything past the last such chunk, or past the header if there is none, is a torn write
+    // of a chunk and gets truncated. A file without header is only known to hold frames by
+    // such a chunk, one that has none isn't touched.
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code recoverImpl() noexcept
+    {
+        recovered = SpillRecovery();
+        lastTrailer = SpillFrameTrailer();
+        spillIndex.clear();
+        indexLoaded = false;
+
+        struct stat st;
+        if (::fstat(backupFile, &st) == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        off_t fileSize = st.st_size;
+        off_t frameEnd = fileSize;
+        bool found{false};
+
+        if (auto ec = checkFrame(frameEnd, found); ec)
+        {
+            return ec;
+        }
+
+        // torn chunk can't be longer than what was being written, so this walks at most one
+        // chunk backwards looking for a trailer of the previous one
+        std::string window;
+        constexpr off_t windowSize = 1 << 20;
+        constexpr off_t magicOffset = offsetof(SpillFrameTrailer, magic);
+
+        for (off_t windowEnd = fileSize;
+             !found && windowEnd >= spillStart + off_t(sizeof(SpillFrameTrailer));)
+        {
+            off_t windowStart = std::max<off_t>(spillStart, windowEnd - windowSize);
+            window.resize(windowEnd - windowStart);
+            if (auto ec = readFully(window.data(), window.size(), windowStart); ec)
+            {
+                return ec;
+            }
+
+            for (off_t pos = window.size() - sizeof(SpillFrameTrailer); pos >= 0 && !found; --pos)
+            {
+                uint32_t magic;
+                std::memcpy(&magic, window.data() + pos + magicOffset, sizeof(magic));
+                if (ByteOrder::little(magic) != SpillFrameTrailer::frameMagic)
+                {
+                    continue;
+                }
+
+                frameEnd = windowStart + pos + sizeof(SpillFrameTrailer);
+                if (auto ec = checkFrame(frameEnd, found); ec)
+                {
+                    return ec;
+                }
+            }
+
+            if (windowStart == spillStart)
+            {
+                break;
+            }
+            windowEnd = windowStart + sizeof(SpillFrameTrailer) - 1;
+        }
+
+        if (!found && spillStart == 0)
+        {
+            return std::make_error_code(std::errc::bad_message);
+        }
+
+        if (!found)
+        {
+            frameEnd = spillStart;
+        }
+
+        if (frameEnd != fileSize && ::ftruncate(backupFile, frameEnd) == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        recovered.frames = lastTrailer.totalFrames;
+        recovered.records = lastTrailer.totalRecords;
+        recovered.dataSize = lastTrailer.totalDataSize;
+        recovered.truncatedSize = fileSize - frameEnd;
+        spillSequence = std::max(
+            lastTrailer.firstSequence + lastTrailer.records, spillHeader.savedSequence());
+        return std::error_code();
+    }
+
+    std::filesystem::path indexFilename() const
+    {
+        return std::filesystem::path(filename).concat(".idx");
+    }
+
+    // Index is built lazily, so open() stays as fast as recovery allows: saved index is used
+    // when it matches the last chunk, otherwise trailers are walked backwards (no payload reads)
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code loadIndex() noexcept
+    {
+        if (indexLoaded)
+        {
+            return std::error_code();
+        }
+
+        if (backupFile == -1)
+        {
+            return std::make_error_code(std::errc::bad_file_descriptor);
+        }
+
+        spillIndex.clear();
+        off_t frameEnd = ::lseek(backupFile, 0, SEEK_END);
+
+        if (int fd = ::open(indexFilename().c_str(), O_RDONLY); fd != -1)
+        {
+            SpillIndexFooter footer;
+            struct stat st;
+            bool ok = ::fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(footer) &&
+                      ::pread(fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) ==
+                          sizeof(footer) &&
+                      (footer.fromFile(), footer.valid()) &&
+                      footer.entries == lastTrailer.totalFrames &&
+                      footer.lastFrameEnd == uint64_t(frameEnd) &&
+                      footer.lastTrailerCrc == lastTrailer.trailerCrc &&
+                      size_t(st.st_size) ==
+                          sizeof(footer) + footer.entries * sizeof(SpillIndexEntry);
+
+            if (ok)
+            {
+                spillIndex.resize(footer.entries);
+                size_t bytes = footer.entries * sizeof(SpillIndexEntry);
+                ok = ::pread(fd, spillIndex.data(), bytes, 0) == ssize_t(bytes) &&
+                     Crc32c::compute(0, spillIndex.data(), bytes) == footer.entriesCrc;
+                ByteOrder::littleArray<uint64_t>(
+                    reinterpret_cast<char *>(spillIndex.data()), 2 * footer.entries);
+            }
+            ::close(fd);
+
+            if (ok)
+            {
+                indexLoaded = true;
+                return std::error_code();
+            }
+            spillIndex.clear();
+        }
+
+        spillIndex.resize(lastTrailer.totalFrames);
+        for (size_t chunk = spillIndex.size(); chunk > 0; --chunk)
+        {
+            SpillFrameTrailer trailer;
+            if (auto ec = readFrameTrailer(frameEnd, trailer); ec)
+            {
+                return ec;
+            }
+
+            if (!trailer.valid() || trailer.totalFrames != chunk)
+            {
+                spillIndex.clear();
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            spillIndex[chunk - 1] = {trailer.firstSequence, static_cast<uint64_t>(frameEnd)};
+            frameEnd -= trailer.frameSize();
+        }
+
+        indexLoaded = true;
+        return std::error_code();
+    }
+
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code saveIndex() noexcept
+    {
+        if (!indexLoaded || backupFile == -1)
+        {
+            return std::error_code();
+        }
+
+        int fd = ::open(indexFilename().c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        SpillIndexFooter footer;
+        footer.entries = spillIndex.size();
+        footer.lastFrameEnd = spillIndex.empty() ? 0 : spillIndex.back().frameEnd;
+        footer.lastTrailerCrc = lastTrailer.trailerCrc;
+
+        // entries are converted to file byte order in place for writing and back afterwards
+        char *entries = reinterpret_cast<char *>(spillIndex.data());
+        ByteOrder::littleArray<uint64_t>(entries, 2 * spillIndex.size());
+        footer.entriesCrc =
+            Crc32c::compute(0, entries, spillIndex.size() * sizeof(SpillIndexEntry));
+        footer.seal();
+        SpillIndexFooter image = footer.fileImage();
+
+        iovec iov[] = {
+            {entries, spillIndex.size() * sizeof(SpillIndexEntry)},
+            {&image, sizeof(image)},
+        };
+        ssize_t expected = iov[0].iov_len + iov[1].iov_len;
+        ssize_t bytes = ::writev(fd, iov, std::size(iov));
+        int err = errno;
+        ::close(fd);
+        ByteOrder::littleArray<uint64_t>(entries, 2 * spillIndex.size());
+
+        if (bytes != expected)
+        {
+            return std::make_error_code(
+                bytes == -1 ? static_cast<std::errc>(err) : std::errc::io_error);
+        }
+        return std::error_code();
+    }
+
+    // on success lastTrailer is set to trailer of chunk ending at frameEnd
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code checkFrame(off_t frameEnd, bool &found) noexcept
+    {
+        found = frameEnd == spillStart;
+        if (frameEnd < spillStart + off_t(sizeof(SpillFrameTrailer)))
+        {
+            return std::error_code();
+        }
+
+        SpillFrameTrailer trailer;
+        if (auto ec = readFrameTrailer(frameEnd, trailer); ec)
+        {
+            return ec;
+        }
+
+        if (!trailer.valid() || trailer.frameSize() > uint64_t(frameEnd - spillStart))
+        {
+            return std::error_code();
+        }
+
+        off_t frameStart = frameEnd - trailer.frameSize();
+        SpillFrameTrailer previous;
+        if (frameStart != spillStart)
+        {
+            if (frameStart < spillStart + off_t(sizeof(previous)))
+            {
+                return std::error_code();
+            }
+
+            if (auto ec = readFrameTrailer(frameStart, previous); ec)
+            {
+                return ec;
+            }
+
+            if (!previous.valid())
+            {
+                return std::error_code();
+            }
+        }
+
+        if (!trailer.follows(previous))
+        {
+            return std::error_code();
+        }
+
+        if (!spillBuffer.reserve(trailer.storedSize))
+        {
+            return std::make_error_code(std::errc::not_enough_memory);
+        }
+
+        if (auto ec = readFully(spillBuffer.data(), trailer.storedSize, frameStart); ec)
+        {
+            return ec;
+        }
+
+        if (!trailer.intact(previous, spillBuffer.data()))
+        {
+            return std::error_code();
+        }
+
+        lastTrailer = trailer;
+        found = true;
+        return std::error_code();
+    }
+
+    // frameEnd is set to 0 when there is nothing spilled
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code readTrailer(SpillFrameTrailer &trailer, off_t &frameEnd) noexcept
+    {
+        if (backupFile == -1)
+        {
+            return std::make_error_code(std::errc::bad_file_descriptor);
+        }
+
+        struct stat st;
+        if (::fstat(backupFile, &st) == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        frameEnd = st.st_size;
+        if (frameEnd == spillStart)
+        {
+            frameEnd = 0;
+            return std::error_code();
+        }
+
+        if (frameEnd < spillStart + off_t(sizeof(trailer)))
+        {
+            return std::make_error_code(std::errc::bad_message);
+        }
+
+        if (auto ec = readFrameTrailer(frameEnd, trailer); ec)
+        {
+            return ec;
+        }
+
+        if (!trailer.valid() || trailer.frameSize() > uint64_t(frameEnd - spillStart))
+        {
+            return std::make_error_code(std::errc::bad_message);
+        }
+
+        return std::error_code();
+    }
+
+    // trailer of chunk ending at frameEnd, converted to host byte order but not validated
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code readFrameTrailer(off_t frameEnd, SpillFrameTrailer &trailer) noexcept
+    {
+        if (auto ec = readFully(
+                reinterpret_cast<char *>(&trailer), sizeof(trailer), frameEnd - sizeof(trailer));
+            ec)
+        {
+            return ec;
+        }
+
+        trailer.fromFile();
+        return std::error_code();
+    }
+
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code readFully(char *ptr, size_t size, off_t offset) noexcept
+    {
+        return readFully(ptr, size, offset, directBuffer);
+    }
+
+    // readBuffer is only used with direct I/O
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code readFully(
+        char *ptr, size_t size, off_t offset, PageBuffer &readBuffer) const noexcept
+    {
+        if (directBlockSize != 0)
+        {
+            return readDirect(ptr, size, offset, readBuffer);
+        }
+
+        size_t bytesRead{0};
+
+        while (bytesRead < size)
+        {
+            ssize_t bytes = ::pread(backupFile, ptr + bytesRead, size - bytesRead,
+                offset + bytesRead);
+            if (bytes == -1)
+            {
+                return std::make_error_code(static_cast<std::errc>(errno));
+            }
+            if (bytes == 0)
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+            bytesRead += bytes;
+        }
+
+        return std::error_code();
+    }
+
+    // Whole aligned blocks are read straight into ptr when ptr and offset are aligned,
+    // whatever is left goes through readBuffer
+    template<bool Enable = UseDisk, typename = std::enable_if_t<Enable == true>>
+    std::error_code readDirect(
+        char *ptr, size_t size, off_t offset, PageBuffer &readBuffer) const noexcept
+    {
+        if (reinterpret_cast<uintptr_t>(ptr) % directBlockSize == 0 &&
+            offset % directBlockSize == 0)
+        {
+            size_t body = size / directBlockSize * directBlockSize;
+            for (size_t bytesRead = 0; bytesRead < body;)
+            {
+                ssize_t bytes = ::pread(backupFile, ptr + bytesRead, body - bytesRead,
+                    offset + bytesRead);
+                if (bytes == -1)
+                {
+                    return std::make_error_code(static_cast<std::errc>(errno));
+                }
+                if (bytes == 0)
+                {
+                    return std::make_error_code(std::errc::bad_message);
+                }
+                bytesRead += bytes;
+            }
+
+            ptr += body;
+            size -= body;
+            offset += body;
+            if (size == 0)
+            {
+                return std::error_code();
+            }
+        }
+
+        off_t alignedOffset = offset / directBlockSize * directBlockSize;
+        size_t head = offset - alignedOffset;
+        size_t alignedSize =
+            (head + size + directBlockSize - 1) / directBlockSize * directBlockSize;
+        if (!readBuffer.reserve(alignedSize))
+        {
+            return std::make_error_code(std::errc::not_enough_memory);
+        }
+
+        // last block of a file written without direct I/O may be partial
+        size_t bytesRead{0};
+        while (bytesRead < head + size)
+        {
+            ssize_t bytes = ::pread(backupFile, readBuffer.data() + bytesRead,
+                alignedSize - bytesRead, alignedOffset + bytesRead);
+            if (bytes == -1)
+            {
+                return std::make_error_code(static_cast<std::errc>(errno));
+            }
+            if (bytes == 0)
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+            bytesRead += bytes;
+        }
+
+        std::copy(readBuffer.data() + head, readBuffer.data() + head + size, ptr);
+        return std::error_code();
+    }
 
 private:
+    static constexpr size_t mergeWindowSize = 64 << 10; // per chunk, see mergeSorted()
+
     std::filesystem::path filename;
+    DiskRepositoryOptions options;
+    Stats repositoryStats;
     size_t pageSize{0};
 
     size_t bufferCapacity{0};
     size_t bufferSize{0};
+    size_t bufferRecords{0};
     size_t writeOffset{0};
     size_t readOffset{0};
     char *buffer{nullptr};
 
+    // see DiskRepositoryOptions::stringDictionary
+    StringDictionaryEncoder ringEncoder;
+    StringDictionaryDecoder ringDecoder;
+    StringDictionaryEncoder chunkEncoder; // for chunks built in writeBackBuffer
+    bool ringSelfContained{true};         // no record refers to a string defined outside ring
+
+    int ringFd{-1};          // file backing ring, read by snapshots
+    off_t ringFdOffset{0};   // where ring bytes start in it
+    RingSnapshotter snapshotter;
+    // pushes till memoryPressure is asked again
+    static constexpr size_t pressureCheckInterval = 1024;
+    size_t pressureCountdown{pressureCheckInterval};
+    size_t snapshotPinned{0}; // bytes consumed since the snapshot being written was taken
+    size_t checkpointPinned{0}; // bytes consumed since the last checkpoint of a file ring
+
+    int ringFile{-1};
+    RingHeader *ringHeader{nullptr};
+    uint64_t ringGeneration{0};
+    size_t dirtySize{0}; // bytes pushed since last checkpoint
+
     int backupFile{-1};
-    std::string writeBackBuffer;
+    PageBuffer writeBackBuffer;
+    PageBuffer spillBuffer;
+    SpillFileHeader spillHeader; // as in backup file, version 0 when it has none
+    off_t spillStart{0};         // where frames start, right past spillHeader
+    SpillFrameTrailer lastTrailer;
+    SpillRecovery recovered;
+    uint64_t spillSequence{0};
+    std::vector<SpillIndexEntry> spillIndex;
+    bool indexLoaded{false};
+    PageBuffer replayBuffer;
+    PageBuffer scanBuffer;                // single columns read by scanField()
+    std::vector<std::string> columnBytes; // string bytes per field, see fillColumns()
+    size_t directBlockSize{0}; // O_DIRECT alignment, 0 when spilling through page cache
+    PageBuffer directBuffer;   // staging for direct writes and unaligned direct reads
+    SpillPrefetcher prefetcher;
+    SpillPacer spillPacer;
 };
+
+template<bool UseDisk = true, typename... Args>
+using DiskRepository = BasicDiskRepository<UseDisk, NullRepositoryStats, Args...>;
+
+template<bool UseDisk = true, typename... Args>
+using InstrumentedDiskRepository = BasicDiskRepository<UseDisk, RepositoryStats, Args...>;
@@ -0,0 +1,865 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "byteorder.h"
+#include "pagebuffer.h"
+#include "spillcodec.h"
+#include "spillframe.h"
+#include "spillindex.h"
+#include "stringdictionary.h"
+
+// Reads a backup file of DiskRepository without the service running:
+//   diskrepository_inspect [options] <backup file>
+//     -s, --schema u64,str,...  field types of Args..., needed for anything but summary:
+//                               i8 i16 i32 i64 u8 u16 u32 u64 str
+//     -f, --format F            summary (default), count, csv or binary; binary writes
+//                               matching records encoded as in the file, records of
+//                               dictionary encoded and columnar frames as they are
+//                               stored without a dictionary, row by row
+//     -w, --where N=VALUE       only records whose field N (from 0) prints as VALUE
+//     -j, --threads N           decoding threads, all cores by default
+// File is mapped and frames are found through <file>.idx when it matches the file, by
+// walking trailers backwards otherwise. Frames are then decoded in parallel, output keeps
+// file order. CSV starts with the sequence number of each record. Schema is checked against
+// fingerprint in file header, files are little-endian and read the same on any host.
+
+namespace
+{
+
+enum class FieldType
+{
+    I8,
+    I16,
+    I32,
+    I64,
+    U8,
+    U16,
+    U32,
+    U64,
+    String,
+};
+
+enum class Format
+{
+    Summary,
+    Count,
+    Csv,
+    Binary,
+};
+
+struct Options
+{
+    std::filesystem::path filename;
+    std::vector<FieldType> schema;
+    Format format{Format::Summary};
+    std::optional<size_t> whereField;
+    std::string whereValue;
+    size_t threads{std::max(1u, std::thread::hardware_concurrency())};
+};
+
+struct Frame
+{
+    uint64_t frameEnd{0};
+    SpillFrameTrailer trailer;
+};
+
+// what a worker produced for one frame
+struct FrameResult
+{
+    std::string output;
+    uint64_t matched{0};
+    std::string error;
+};
+
+[[noreturn]] void fail(const char *format, const char *argument = "")
+{
+    std::fprintf(stderr, "diskrepository_inspect: ");
+    std::fprintf(stderr, format, argument);
+    std::fprintf(stderr, "\n");
+    std::exit(EXIT_FAILURE);
+}
+
+std::vector<FieldType> parseSchema(std::string_view text)
+{
+    static constexpr std::pair<std::string_view, FieldType> names[] = {
+        {"i8", FieldType::I8},
+        {"i16", FieldType::I16},
+        {"i32", FieldType::I32},
+        {"i64", FieldType::I64},
+        {"u8", FieldType::U8},
+        {"u16", FieldType::U16},
+        {"u32", FieldType::U32},
+        {"u64", FieldType::U64},
+        {"str", FieldType::String},
+    };
+
+    std::vector<FieldType> schema;
+    while (!text.empty())
+    {
+        size_t comma = text.find(',');
+        std::string_view name = text.substr(0, comma);
+        auto it = std::find_if(std::begin(names), std::end(names),
+            [&](const auto &entry) { return entry.first == name; });
+        if (it == std::end(names))
+        {
+            fail("unknown field type '%s'", std::string(name).c_str());
+        }
+
+        schema.push_back(it->second);
+        text = comma == std::string_view::npos ? std::string_view() : text.substr(comma + 1);
+    }
+    return schema;
+}
+
+Options parseOptions(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        auto value = [&]() -> const char * {
+            if (++i == argc)
+            {
+                fail("%s needs a value", argv[i - 1]);
+            }
+            return argv[i];
+        };
+
+        if (arg == "-s" || arg == "--schema")
+        {
+            options.schema = parseSchema(value());
+        }
+        else if (arg == "-f" || arg == "--format")
+        {
+            std::string_view format = value();
+            if (format == "summary")
+            {
+                options.format = Format::Summary;
+            }
+            else if (format == "count")
+            {
+                options.format = Format::Count;
+            }
+            else if (format == "csv")
+            {
+                options.format = Format::Csv;
+            }
+            else if (format == "binary")
+            {
+                options.format = Format::Binary;
+            }
+            else
+            {
+                fail("unknown format '%s'", argv[i]);
+            }
+        }
+        else if (arg == "-w" || arg == "--where")
+        {
+            std::string_view where = value();
+            size_t equals = where.find('=');
+            if (equals == std::string_view::npos || equals == 0)
+            {
+                fail("--where expects N=VALUE, got '%s'", argv[i]);
+            }
+            options.whereField = std::strtoull(std::string(where.substr(0, equals)).c_str(),
+                nullptr, 10);
+            options.whereValue = where.substr(equals + 1);
+        }
+        else if (arg == "-j" || arg == "--threads")
+        {
+            options.threads = std::max<size_t>(1, std::strtoull(value(), nullptr, 10));
+        }
+        else if (!arg.empty() && arg[0] == '-')
+        {
+            fail("unknown option '%s'", argv[i]);
+        }
+        else
+        {
+            options.filename = arg;
+        }
+    }
+
+    if (options.filename.empty())
+    {
+        fail("usage: diskrepository_inspect [-s schema] [-f summary|count|csv|binary] "
+             "[-w N=VALUE] [-j threads] <backup file>");
+    }
+
+    if (options.format != Format::Summary && options.schema.empty())
+    {
+        fail("--schema is required to decode records");
+    }
+
+    if (options.whereField && *options.whereField >= options.schema.size())
+    {
+        fail("--where field is out of schema");
+    }
+    return options;
+}
+
+template<typename T>
+T load(const char *ptr)
+{
+    return ByteOrder::load<T>(ptr);
+}
+
+// string length as stored in file
+void appendLength(std::string &out, uint64_t length)
+{
+    char bytes[sizeof(length)];
+    ByteOrder::store(length, bytes);
+    out.append(bytes, sizeof(bytes));
+}
+
+// description of schema as SpillSchema hashes it
+uint64_t schemaFingerprint(const std::vector<FieldType> &schema)
+{
+    static constexpr std::string_view names[] = {
+        "i1", "i2", "i4", "i8", "u1", "u2", "u4", "u8", "s"};
+
+    std::string description;
+    for (auto type : schema)
+    {
+        description += description.empty() ? "" : ",";
+        description += names[static_cast<size_t>(type)];
+    }
+    return SpillSchema::fingerprint(description);
+}
+
+size_t fieldSize(FieldType type)
+{
+    switch (type)
+    {
+        case FieldType::I8:
+        case FieldType::U8:
+            return 1;
+        case FieldType::I16:
+        case FieldType::U16:
+            return 2;
+        case FieldType::I32:
+        case FieldType::U32:
+            return 4;
+        case FieldType::I64:
+        case FieldType::U64:
+        case FieldType::String:
+            return 8;
+    }
+    return 0;
+}
+
+// dictionary is nullptr unless frame has SpillFrameTrailer::dictionaryFlag
+bool readString(const char *ptr, size_t &offset, size_t size,
+    StringDictionaryDecoder *dictionary, std::string_view &value)
+{
+    if (dictionary != nullptr)
+    {
+        return dictionary->decode(ptr, offset, size, value);
+    }
+
+    if (size - offset < sizeof(uint64_t))
+    {
+        return false;
+    }
+
+    uint64_t length = load<uint64_t>(ptr + offset);
+    if (size - offset - sizeof(uint64_t) < length)
+    {
+        return false;
+    }
+
+    value = std::string_view(ptr + offset + sizeof(uint64_t), length);
+    offset += sizeof(uint64_t) + length;
+    return true;
+}
+
+// appends field as text, false if it doesn't fit the payload
+bool formatField(FieldType type, const char *ptr, size_t &offset, size_t size,
+    StringDictionaryDecoder *dictionary, std::string &out, bool quote)
+{
+    if (type == FieldType::String)
+    {
+        std::string_view value;
+        if (!readString(ptr, offset, size, dictionary, value))
+        {
+            return false;
+        }
+
+        if (!quote || value.find_first_of(",\"\r\n") == std::string_view::npos)
+        {
+            out.append(value);
+            return true;
+        }
+
+        out.push_back('"');
+        for (char c : value)
+        {
+            if (c == '"')
+            {
+                out.push_back('"');
+            }
+            out.push_back(c);
+        }
+        out.push_back('"');
+        return true;
+    }
+
+    size_t typeSize = fieldSize(type);
+    if (size - offset < typeSize)
+    {
+        return false;
+    }
+
+    char text[32];
+    const char *p = ptr + offset;
+    offset += typeSize;
+    switch (type)
+    {
+        case FieldType::I8:
+            out.append(text, std::snprintf(text, sizeof(text), "%d", load<int8_t>(p)));
+            return true;
+        case FieldType::I16:
+            out.append(text, std::snprintf(text, sizeof(text), "%d", load<int16_t>(p)));
+            return true;
+        case FieldType::I32:
+            out.append(text, std::snprintf(text, sizeof(text), "%" PRId32, load<int32_t>(p)));
+            return true;
+        case FieldType::I64:
+            out.append(text, std::snprintf(text, sizeof(text), "%" PRId64, load<int64_t>(p)));
+            return true;
+        case FieldType::U8:
+            out.append(text, std::snprintf(text, sizeof(text), "%u", load<uint8_t>(p)));
+            return true;
+        case FieldType::U16:
+            out.append(text, std::snprintf(text, sizeof(text), "%u", load<uint16_t>(p)));
+            return true;
+        case FieldType::U32:
+            out.append(text, std::snprintf(text, sizeof(text), "%" PRIu32, load<uint32_t>(p)));
+            return true;
+        case FieldType::U64:
+            out.append(text, std::snprintf(text, sizeof(text), "%" PRIu64, load<uint64_t>(p)));
+            return true;
+        case FieldType::String:
+            break;
+    }
+    return false;
+}
+
+// moves past field, appending it to out as it is stored without a dictionary unless out
+// is nullptr; false if it doesn't fit the payload
+bool copyField(FieldType type, const char *ptr, size_t &offset, size_t size,
+    StringDictionaryDecoder *dictionary, std::string *out)
+{
+    if (type == FieldType::String)
+    {
+        std::string_view value;
+        if (!readString(ptr, offset, size, dictionary, value))
+        {
+            return false;
+        }
+
+        if (out != nullptr)
+        {
+            appendLength(*out, value.size());
+            out->append(value);
+        }
+        return true;
+    }
+
+    size_t typeSize = fieldSize(type);
+    if (size - offset < typeSize)
+    {
+        return false;
+    }
+
+    if (out != nullptr)
+    {
+        out->append(ptr + offset, typeSize);
+    }
+    offset += typeSize;
+    return true;
+}
+
+// rebuilds records of a columnar frame row by row, false if payload doesn't fit schema
+bool transposeColumns(const std::vector<FieldType> &schema, const char *payload, uint64_t size,
+    uint64_t records, std::string &rows)
+{
+    size_t width{0};
+    for (auto type : schema)
+    {
+        width += fieldSize(type);
+    }
+
+    if (size / width < records)
+    {
+        return false;
+    }
+
+    // column of each field, and for strings where their bytes start and how long they are
+    std::vector<const char *> columns;
+    std::vector<const char *> bytes(schema.size());
+    std::vector<uint64_t> lengths(schema.size());
+    uint64_t offset = records * width;
+    for (size_t field = 0; field < schema.size(); ++field)
+    {
+        const char *column =
+            field == 0 ? payload : columns.back() + records * fieldSize(schema[field - 1]);
+        columns.push_back(column);
+
+        if (schema[field] == FieldType::String && records != 0)
+        {
+            lengths[field] = load<uint64_t>(column + (records - 1) * sizeof(uint64_t));
+            if (size - offset < lengths[field])
+            {
+                return false;
+            }
+            bytes[field] = payload + offset;
+            offset += lengths[field];
+        }
+    }
+
+    if (offset != size)
+    {
+        return false;
+    }
+
+    rows.clear();
+    rows.reserve(size);
+    for (uint64_t record = 0; record < records; ++record)
+    {
+        for (size_t field = 0; field < schema.size(); ++field)
+        {
+            size_t typeSize = fieldSize(schema[field]);
+            const char *column = columns[field];
+            if (schema[field] != FieldType::String)
+            {
+                rows.append(column + record * typeSize, typeSize);
+                continue;
+            }
+
+            uint64_t start = record == 0 ? 0 : load<uint64_t>(column + (record - 1) * typeSize);
+            uint64_t end = load<uint64_t>(column + record * typeSize);
+            if (start > end || end > lengths[field])
+            {
+                return false;
+            }
+
+            appendLength(rows, end - start);
+            rows.append(bytes[field] + start, end - start);
+        }
+    }
+    return true;
+}
+
+// Header of file, version 0 one when file has none. Frames start at its headerSize.
+SpillFileHeader readHeader(const char *file, uint64_t fileSize)
+{
+    SpillFileHeader header;
+    std::memcpy(&header, file, std::min<uint64_t>(fileSize, sizeof(header)));
+    header.fromFile();
+
+    if (fileSize < SpillFileHeader::version1Size || header.magic != SpillFileHeader::fileMagic)
+    {
+        if (!ByteOrder::hostLittle && fileSize != 0)
+        {
+            fail("file has no header, it was written in byte order of its host");
+        }
+
+        SpillFileHeader legacy;
+        legacy.version = 0;
+        legacy.headerSize = 0;
+        return legacy;
+    }
+
+    if (fileSize < header.fieldsSize() || !header.valid() ||
+        header.headerSize < header.fieldsSize() || header.headerSize > fileSize)
+    {
+        fail("broken file header");
+    }
+
+    if (header.version > SpillFileHeader::currentVersion)
+    {
+        fail("file version %s isn't supported", std::to_string(header.version).c_str());
+    }
+    return header;
+}
+
+// frames in file order, from index when it describes this very file
+std::vector<Frame> readFrames(const char *file, uint64_t fileSize, uint64_t spillStart,
+    const std::filesystem::path &indexFilename, uint64_t &tornSize, bool &fromIndex)
+{
+    std::vector<Frame> frames;
+    fromIndex = false;
+    tornSize = 0;
+
+    auto trailerAt = [&](uint64_t frameEnd, SpillFrameTrailer &trailer) {
+        if (frameEnd < spillStart + sizeof(trailer) || frameEnd > fileSize)
+        {
+            return false;
+        }
+        std::memcpy(&trailer, file + frameEnd - sizeof(trailer), sizeof(trailer));
+        trailer.fromFile();
+        return trailer.valid() && trailer.frameSize() <= frameEnd - spillStart;
+    };
+
+    // chunk ending at frameEnd passes what open() checks of the last chunk of a file
+    auto intactAt = [&](uint64_t frameEnd, SpillFrameTrailer &trailer) {
+        if (!trailerAt(frameEnd, trailer))
+        {
+            return false;
+        }
+
+        uint64_t frameStart = frameEnd - trailer.frameSize();
+        SpillFrameTrailer previous;
+        return (frameStart == spillStart || trailerAt(frameStart, previous)) &&
+               trailer.intact(previous, file + frameStart);
+    };
+
+    if (int fd = ::open(indexFilename.c_str(), O_RDONLY); fd != -1)
+    {
+        struct stat st;
+        SpillIndexFooter footer;
+        std::vector<SpillIndexEntry> entries;
+        bool ok = ::fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(footer) &&
+                  ::pread(fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) ==
+                      sizeof(footer) &&
+                  (footer.fromFile(), footer.valid()) && footer.lastFrameEnd == fileSize &&
+                  size_t(st.st_size) == sizeof(footer) + footer.entries * sizeof(SpillIndexEntry);
+        if (ok)
+        {
+            entries.resize(footer.entries);
+            size_t bytes = entries.size() * sizeof(SpillIndexEntry);
+            ok = ::pread(fd, entries.data(), bytes, 0) == ssize_t(bytes) &&
+                 Crc32c::compute(0, entries.data(), bytes) == footer.entriesCrc;
+            ByteOrder::littleArray<uint64_t>(
+                reinterpret_cast<char *>(entries.data()), 2 * entries.size());
+        }
+        ::close(fd);
+
+        // chunks must follow one another; like open(), the last one is trusted only with
+        // its payload intact, a stale index may still end where the file does
+        SpillFrameTrailer previous;
+        uint64_t frameStart = spillStart;
+        for (size_t i = 0; ok && i < entries.size(); ++i)
+        {
+            Frame frame{entries[i].frameEnd, {}};
+            ok = trailerAt(frame.frameEnd, frame.trailer) &&
+                 frame.frameEnd - frame.trailer.frameSize() == frameStart &&
+                 frame.trailer.follows(previous) &&
+                 (i + 1 < entries.size() || (frame.trailer.trailerCrc == footer.lastTrailerCrc &&
+                                                intactAt(frame.frameEnd, frame.trailer)));
+            previous = frame.trailer;
+            frameStart = frame.frameEnd;
+            frames.push_back(frame);
+        }
+
+        if (ok)
+        {
+            fromIndex = true;
+            return frames;
+        }
+        frames.clear();
+    }
+
+    // a torn tail is whatever follows the last intact chunk, as open() would truncate it
+    uint64_t frameEnd = fileSize;
+    SpillFrameTrailer trailer;
+    while (frameEnd != spillStart && !intactAt(frameEnd, trailer))
+    {
+        --frameEnd;
+    }
+    tornSize = fileSize - frameEnd;
+
+    while (frameEnd != spillStart)
+    {
+        if (!trailerAt(frameEnd, trailer))
+        {
+            fail("broken trailer before offset %s", std::to_string(frameEnd).c_str());
+        }
+        frames.push_back({frameEnd, trailer});
+        frameEnd -= trailer.frameSize();
+    }
+    std::reverse(frames.begin(), frames.end());
+    return frames;
+}
+
+void decodeFrame(const Options &options, const char *file, const Frame &frame,
+    PageBuffer &decoded, FrameResult &result)
+{
+    const SpillFrameTrailer &trailer = frame.trailer;
+    const char *payload = file + frame.frameEnd - trailer.frameSize();
+    if (Crc32c::compute(0, payload, trailer.storedSize) != trailer.payloadCrc)
+    {
+        result.error = "payload checksum mismatch";
+        return;
+    }
+
+    if (trailer.codec != 0)
+    {
+        const auto *codec = SpillCodecRegistry::find(trailer.codec);
+        if (codec == nullptr)
+        {
+            result.error = "unknown codec " + std::to_string(trailer.codec);
+            return;
+        }
+
+        if (!decoded.reserve(trailer.dataSize) ||
+            !codec->decompress(payload, trailer.storedSize, decoded.data(), trailer.dataSize))
+        {
+            result.error = "can't decode payload";
+            return;
+        }
+        payload = decoded.data();
+    }
+
+    std::string rows;
+    if (trailer.flags & SpillFrameTrailer::columnarFlag)
+    {
+        if (!transposeColumns(options.schema, payload, trailer.dataSize, trailer.records, rows))
+        {
+            result.error = "columns don't match schema";
+            return;
+        }
+        payload = rows.data();
+    }
+
+    StringDictionaryDecoder decoder;
+    auto *dictionary = trailer.flags & SpillFrameTrailer::dictionaryFlag ? &decoder : nullptr;
+    // binary output of a dictionary encoded frame is encoded again, since a record may
+    // refer to strings defined by records that are filtered out; columnar frames are
+    // already transposed into rows
+    bool reencode = dictionary != nullptr && options.format == Format::Binary;
+
+    std::string scratch;
+    std::string plain;
+    size_t offset{0};
+    for (uint64_t record = 0; record < trailer.records; ++record)
+    {
+        size_t start = offset;
+        bool matches = !options.whereField;
+        size_t lineStart = result.output.size();
+        plain.clear();
+
+        if (options.format == Format::Csv)
+        {
+            result.output += std::to_string(trailer.firstSequence + record);
+        }
+
+        for (size_t field = 0; field < options.schema.size(); ++field)
+        {
+            bool ok{true};
+            if (options.whereField == field)
+            {
+                scratch.clear();
+                size_t fieldOffset = offset;
+                ok = formatField(options.schema[field], payload, fieldOffset, trailer.dataSize,
+                    dictionary, scratch, false);
+                matches = ok && scratch == options.whereValue;
+            }
+
+            if (ok && options.format == Format::Csv)
+            {
+                result.output.push_back(',');
+                ok = formatField(options.schema[field], payload, offset, trailer.dataSize,
+                    dictionary, result.output, true);
+            }
+            else if (ok)
+            {
+                ok = copyField(options.schema[field], payload, offset, trailer.dataSize,
+                    dictionary, reencode ? &plain : nullptr);
+            }
+
+            if (!ok)
+            {
+                result.error = "record " + std::to_string(trailer.firstSequence + record) +
+                               " doesn't match schema";
+                return;
+            }
+        }
+
+        if (!matches)
+        {
+            result.output.resize(lineStart);
+            continue;
+        }
+
+        ++result.matched;
+        if (options.format == Format::Csv)
+        {
+            result.output.push_back('\n');
+        }
+        else if (reencode)
+        {
+            result.output.append(plain);
+        }
+        else if (options.format == Format::Binary)
+        {
+            result.output.append(payload + start, offset - start);
+        }
+    }
+
+    if (offset != trailer.dataSize)
+    {
+        result.error = "payload has bytes past the last record";
+    }
+}
+
+void summary(const Options &options, const SpillFileHeader &header, uint64_t fileSize,
+    uint64_t tornSize, bool fromIndex, const std::vector<Frame> &frames)
+{
+    uint64_t storedSize{0};
+    uint64_t encoded{0};
+    uint64_t sorted{0};
+    uint64_t dictionary{0};
+    uint64_t columnar{0};
+    uint64_t padding{0};
+    for (const auto &frame : frames)
+    {
+        storedSize += frame.trailer.storedSize;
+        encoded += frame.trailer.codec != 0;
+        sorted += (frame.trailer.flags & SpillFrameTrailer::sortedFlag) != 0;
+        dictionary += (frame.trailer.flags & SpillFrameTrailer::dictionaryFlag) != 0;
+        columnar += (frame.trailer.flags & SpillFrameTrailer::columnarFlag) != 0;
+        padding += frame.trailer.padding;
+    }
+
+    SpillFrameTrailer last = frames.empty() ? SpillFrameTrailer() : frames.back().trailer;
+    std::printf("file: %s\n", options.filename.c_str());
+    std::printf("file_size: %" PRIu64 "\n", fileSize);
+    std::printf("version: %u\n", header.version);
+    std::printf("schema_fingerprint: %016" PRIx64 "\n", header.schemaFingerprint);
+    std::printf("torn_tail: %" PRIu64 "\n", tornSize);
+    std::printf("frames_from: %s\n", fromIndex ? "index" : "trailers");
+    std::printf("frames: %zu\n", frames.size());
+    std::printf("records: %" PRIu64 "\n", last.totalRecords);
+    std::printf("data_size: %" PRIu64 "\n", last.totalDataSize);
+    std::printf("stored_size: %" PRIu64 "\n", storedSize);
+    std::printf("padding: %" PRIu64 "\n", padding);
+    std::printf("encoded_frames: %" PRIu64 "\n", encoded);
+    std::printf("sorted_frames: %" PRIu64 "\n", sorted);
+    std::printf("dictionary_frames: %" PRIu64 "\n", dictionary);
+    std::printf("columnar_frames: %" PRIu64 "\n", columnar);
+    if (!frames.empty())
+    {
+        std::printf("first_sequence: %" PRIu64 "\n", frames.front().trailer.firstSequence);
+    }
+    // header keeps numbers taken by chunks refills cut off the file
+    std::printf("next_sequence: %" PRIu64 "\n",
+        std::max(last.firstSequence + last.records, header.savedSequence()));
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options = parseOptions(argc, argv);
+
+    int fd = ::open(options.filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1 || ::fstat(fd, &st) == -1)
+    {
+        fail("can't open %s", options.filename.c_str());
+    }
+
+    uint64_t fileSize = st.st_size;
+    const char *file = "";
+    if (fileSize != 0)
+    {
+        void *mapping = ::mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            fail("can't map %s", options.filename.c_str());
+        }
+        ::madvise(mapping, fileSize, MADV_WILLNEED);
+        file = static_cast<const char *>(mapping);
+    }
+    ::close(fd);
+
+    SpillFileHeader header = readHeader(file, fileSize);
+    if (header.version != 0 && !options.schema.empty() &&
+        header.schemaFingerprint != schemaFingerprint(options.schema))
+    {
+        fail("schema doesn't match the one file was written with");
+    }
+
+    uint64_t tornSize{0};
+    bool fromIndex{false};
+    std::vector<Frame> frames = readFrames(file, fileSize, header.headerSize,
+        std::filesystem::path(options.filename).concat(".idx"), tornSize, fromIndex);
+
+    if (options.format == Format::Summary)
+    {
+        summary(options, header, fileSize, tornSize, fromIndex, frames);
+        return EXIT_SUCCESS;
+    }
+
+    // frames are handed out one by one to workers, a batch at a time, and each batch is
+    // written out in file order before the next one starts, so output needn't fit memory
+    const size_t batchSize = options.threads * 16;
+    std::vector<FrameResult> results;
+    uint64_t matched{0};
+
+    for (size_t batchStart = 0; batchStart < frames.size(); batchStart += batchSize)
+    {
+        size_t batchEnd = std::min(frames.size(), batchStart + batchSize);
+        results.assign(batchEnd - batchStart, FrameResult());
+        std::atomic<size_t> next{batchStart};
+
+        auto work = [&] {
+            PageBuffer decoded;
+            for (size_t frame; (frame = next.fetch_add(1)) < batchEnd;)
+            {
+                decodeFrame(options, file, frames[frame], decoded, results[frame - batchStart]);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min(options.threads, batchEnd - batchStart); ++i)
+        {
+            workers.emplace_back(work);
+        }
+        work();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            if (!results[i].error.empty())
+            {
+                std::string error = std::to_string(batchStart + i) + ": " + results[i].error;
+                fail("frame %s", error.c_str());
+            }
+
+            matched += results[i].matched;
+            if (options.format != Format::Count &&
+                std::fwrite(results[i].output.data(), 1, results[i].output.size(), stdout) !=
+                    results[i].output.size())
+            {
+                fail("can't write output");
+            }
+        }
+    }
+
+    if (options.format == Format::Count)
+    {
+        std::printf("%" PRIu64 "\n", matched);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Tournament tree of losers for k-way merge. Leaves are sources 0..k-1, inner nodes keep
+// the loser of the match played there and the overall winner is kept on top, so after the
+// winner advances to its next item only the log2(k) matches on its path are replayed,
+// each against a stored loser (one comparison per level, unlike a binary heap's two).
+// beats(a, b) tells whether source a goes before source b; sources that are exhausted
+// must lose to all others and ties should be broken by index for a stable merge.
+template<typename Beats>
+class LoserTree final
+{
+public:
+    LoserTree(size_t _sources, Beats _beats) : sources(_sources), beats(std::move(_beats))
+    {
+    }
+
+    // every source has its first item (or is exhausted) before this is called
+    void build()
+    {
+        // virtual source that beats everybody, pushed to the top by real ones on the way up
+        tree.assign(sources == 0 ? 1 : sources, sources);
+        for (size_t source = sources; source > 0; --source)
+        {
+            replay(source - 1);
+        }
+    }
+
+    // source with the smallest item, exhausted one if all of them are
+    size_t winner() const noexcept
+    {
+        return tree[0];
+    }
+
+    // call after winner() advanced to its next item
+    void replay() noexcept
+    {
+        replay(tree[0]);
+    }
+
+private:
+    void replay(size_t source) noexcept
+    {
+        for (size_t node = (source + sources) / 2; node > 0; node /= 2)
+        {
+            if (wins(tree[node], source))
+            {
+                std::swap(source, tree[node]);
+            }
+        }
+        tree[0] = source;
+    }
+
+    bool wins(size_t a, size_t b) noexcept
+    {
+        if (a == sources || b == sources)
+        {
+            return a == sources;
+        }
+        return beats(a, b);
+    }
+
+    size_t sources;
+    Beats beats;
+    std::vector<size_t> tree;
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+
+// Tells BasicDiskRepository whether the host is short of memory, see
+// DiskRepositoryOptions::memoryPressure. underPressure() is called by the thread driving the
+// repository every so many pushes, so it has to be cheap: a non-blocking poll at most.
+class MemoryPressureSource
+{
+public:
+    virtual ~MemoryPressureSource() = default;
+
+    [[nodiscard]] virtual bool underPressure() noexcept = 0;
+};
+
+// Pressure set by hand, e.g. by the application's own monitoring or by tests
+class ManualMemoryPressure final : public MemoryPressureSource
+{
+public:
+    void set(bool pressure) noexcept
+    {
+        state.store(pressure, std::memory_order_relaxed);
+    }
+
+    bool underPressure() noexcept override
+    {
+        return state.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> state{false};
+};
+
+// Shared part of sources that learn about pressure from a kernel file signalling POLLPRI:
+// pressure is reported from an event on till hold has passed without another one.
+class PolledMemoryPressure : public MemoryPressureSource
+{
+public:
+    PolledMemoryPressure() noexcept = default;
+
+    PolledMemoryPressure(const PolledMemoryPressure &) = delete;
+    PolledMemoryPressure &operator=(const PolledMemoryPressure &) = delete;
+
+    ~PolledMemoryPressure() override
+    {
+        if (fd != -1)
+        {
+            ::close(fd);
+        }
+    }
+
+    bool underPressure() noexcept override
+    {
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        auto now = Clock::now();
+        pollfd event{fd, POLLPRI, 0};
+        if (::poll(&event, 1, 0) == 1 && (event.revents & (POLLPRI | POLLERR)) && signalled())
+        {
+            lastEvent = now;
+            pressure = true;
+        }
+        pressure = pressure && now - lastEvent < hold;
+        return pressure;
+    }
+
+protected:
+    using Clock = std::chrono::steady_clock;
+
+    // called on every event, false if it turns out not to mean pressure
+    virtual bool signalled() noexcept = 0;
+
+    int fd{-1};
+    std::chrono::microseconds hold{0};
+
+private:
+    Clock::time_point lastEvent;
+    bool pressure{false};
+};
+
+// Linux PSI trigger: fires when tasks stalled on memory for stall out of every window, both
+// in microseconds (window is 500ms to 10s, a multiple of 2s for unprivileged users). Path is
+// /proc/pressure/memory for the whole host or memory.pressure of a cgroup v2 directory.
+// Pressure is assumed to last a window after each trigger.
+class PsiMemoryPressure final : public PolledMemoryPressure
+{
+public:
+    // full triggers on stalls of all non-idle tasks at once, some on stalls of any of them
+    [[nodiscard]] std::error_code open(const std::filesystem::path &path, uint64_t stall,
+        uint64_t window, bool full = false) noexcept
+    {
+        if (fd != -1)
+        {
+            return std::make_error_code(std::errc::device_or_resource_busy);
+        }
+
+        int file = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (file == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        char trigger[64];
+        int length = std::snprintf(trigger, sizeof(trigger), "%s %llu %llu",
+            full ? "full" : "some", static_cast<unsigned long long>(stall),
+            static_cast<unsigned long long>(window));
+        // kernel takes the terminating zero as part of the trigger
+        if (::write(file, trigger, length + 1) == -1)
+        {
+            auto ec = std::make_error_code(static_cast<std::errc>(errno));
+            ::close(file);
+            return ec;
+        }
+
+        fd = file;
+        hold = std::chrono::microseconds(window);
+        return std::error_code();
+    }
+
+protected:
+    bool signalled() noexcept override
+    {
+        return true;
+    }
+};
+
+// memory.events of a cgroup v2 directory: pressure is when the group was throttled for
+// going over memory.high or hit memory.max since the last look, and is assumed to last hold
+// after that. The file signals every change of its counters.
+class CgroupMemoryPressure final : public PolledMemoryPressure
+{
+public:
+    [[nodiscard]] std::error_code open(
+        const std::filesystem::path &path, std::chrono::microseconds _hold) noexcept
+    {
+        if (fd != -1)
+        {
+            return std::make_error_code(std::errc::device_or_resource_busy);
+        }
+
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return std::make_error_code(static_cast<std::errc>(errno));
+        }
+
+        hold = _hold;
+        (void)signalled();
+        return std::error_code();
+    }
+
+protected:
+    bool signalled() noexcept override
+    {
+        char text[512];
+        ssize_t length = ::pread(fd, text, sizeof(text) - 1, 0);
+        if (length <= 0)
+        {
+            return false;
+        }
+        text[length] = 0;
+
+        uint64_t events = counter(text, "high") + counter(text, "max");
+        bool grown = events > lastEvents;
+        lastEvents = events;
+        return grown;
+    }
+
+private:
+    // value of "name value" line of text, 0 if there is none
+    static uint64_t counter(const char *text, std::string_view name) noexcept
+    {
+        for (const char *line = text; *line != 0;)
+        {
+            const char *end = std::strchr(line, '\n');
+            if (std::string_view(line).substr(0, name.size()) == name &&
+                line[name.size()] == ' ')
+            {
+                return std::strtoull(line + name.size() + 1, nullptr, 10);
+            }
+
+            if (end == nullptr)
+            {
+                break;
+            }
+            line = end + 1;
+        }
+        return 0;
+    }
+
+    uint64_t lastEvents{0};
+};
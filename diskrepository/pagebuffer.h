@@ -0,0 +1,100 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <utility>
+
+#include "tracepoints.h"
+
+// Page-aligned scratch buffer for staging chunks between ring and backup file. Memory is
+// mapped directly, grows geometrically with mremap (contents are kept, nothing is zeroed in
+// user space) and stays mapped until destruction, so a buffer that has seen the largest chunk
+// once doesn't allocate anymore. release() hands its pages back under memory pressure, they
+// are faulted in again on the next use.
+class PageBuffer final
+{
+public:
+    PageBuffer() noexcept = default;
+
+    PageBuffer(const PageBuffer &) = delete;
+    PageBuffer &operator=(const PageBuffer &) = delete;
+
+    PageBuffer(PageBuffer &&other) noexcept
+        : ptr(std::exchange(other.ptr, nullptr)), bytes(std::exchange(other.bytes, 0))
+    {
+    }
+
+    PageBuffer &operator=(PageBuffer &&other) noexcept
+    {
+        std::swap(ptr, other.ptr);
+        std::swap(bytes, other.bytes);
+        return *this;
+    }
+
+    ~PageBuffer()
+    {
+        if (ptr != nullptr)
+        {
+            ::munmap(ptr, bytes);
+        }
+    }
+
+    char *data() noexcept
+    {
+        return ptr;
+    }
+
+    const char *data() const noexcept
+    {
+        return ptr;
+    }
+
+    size_t capacity() const noexcept
+    {
+        return bytes;
+    }
+
+    [[nodiscard]] bool reserve(size_t size) noexcept
+    {
+        if (size <= bytes)
+        {
+            return true;
+        }
+
+        size_t pageSize = getpagesize();
+        size_t newBytes = ((size + pageSize - 1) / pageSize) * pageSize;
+        if (newBytes < bytes * 2)
+        {
+            newBytes = bytes * 2;
+        }
+
+        void *newPtr = ptr == nullptr
+                           ? ::mmap(nullptr, newBytes, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+                           : ::mremap(ptr, bytes, newBytes, MREMAP_MAYMOVE);
+        if (newPtr == MAP_FAILED)
+        {
+            return false;
+        }
+
+        DISKREPOSITORY_PROBE2(buffer_grow, bytes, newBytes);
+        ptr = static_cast<char *>(newPtr);
+        bytes = newBytes;
+        return true;
+    }
+
+    // gives pages back to the system but keeps the mapping, contents read as zeros afterwards
+    void release() noexcept
+    {
+        if (ptr != nullptr)
+        {
+            ::madvise(ptr, bytes, MADV_DONTNEED);
+        }
+    }
+
+private:
+    char *ptr{nullptr};
+    size_t bytes{0};
+};
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <system_error>
+#include <tuple>
+
+#include "diskrepository.h"
+
+// K priority lanes sharing one capacity budget: lanes [0, MemoryLanes) carry latency
+// critical records and are never spilled, lanes [MemoryLanes, MemoryLanes + SpillLanes)
+// carry bulk records and are the only ones spilled to disk when the budget runs out.
+// Lane 0 has the highest priority.
+//
+// All lanes share one ring, as large as the budget, and one spill file at filename: every
+// record carries its lane as a leading byte. A record pulled from behind records of other
+// lanes is marked taken in place, its bytes are given back once those ahead of it are
+// gone. Spilling writes every bulk record in ring as one chunk and leaves the others in
+// order (see flushIf() of DiskRepository). Once a bulk lane has nothing in ring, chunks are
+// taken back behind what ring holds, last spilled first, as long as the budget allows.
+//
+// pull() takes from the highest non-empty lane. A non-zero weight w of a lane lets it
+// deliver at most w records in a row while a lower lane has records waiting, which keeps
+// lower lanes from starving; weight 0 means strict priority. Not available with
+// stringDictionary, records are taken out of order; columnarSpill doesn't apply.
+template<size_t MemoryLanes, size_t SpillLanes, typename... Args>
+class PriorityDiskRepository final
+{
+public:
+    static constexpr size_t lanes = MemoryLanes + SpillLanes;
+
+    using Repository = DiskRepository<true, uint8_t, Args...>;
+
+    PriorityDiskRepository(std::filesystem::path filename, size_t _budget,
+        std::array<size_t, lanes> _weights = {}, DiskRepositoryOptions options = {}) noexcept
+        : budget(_budget), weights(_weights), ring(std::move(filename), _budget, options)
+    {
+    }
+
+    [[nodiscard]] std::error_code open() noexcept
+    {
+        if (ring.options.stringDictionary != 0)
+        {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        if (auto ec = ring.open(); ec)
+        {
+            return ec;
+        }
+
+        // ring recovered from ringFilename may hold records already
+        queued = {};
+        cursors = {};
+        if (auto ec = countLanes(0); ec)
+        {
+            return ec;
+        }
+        dropTaken();
+
+        auto [ec, chunkSize] = ring.tellDataSize();
+        spilled = ec || chunkSize != 0;
+        return ec;
+    }
+
+    [[nodiscard]] std::error_code close() noexcept
+    {
+        return ring.close();
+    }
+
+    // Fails if lane isn't one of lanes, if record doesn't fit the budget even after bulk
+    // lanes are spilled or if spilling fails, see error()
+    [[nodiscard]] bool push(size_t lane, const Args &...args) noexcept
+    {
+        if (lane >= lanes)
+        {
+            return false;
+        }
+
+        const uint8_t tag = static_cast<uint8_t>(lane);
+        size_t required = Repository::recordSize(tag, args...);
+        while (ring.size() + required > budget)
+        {
+            if (!spill())
+            {
+                return false;
+            }
+        }
+
+        if (!ring.push(tag, args...))
+        {
+            return false;
+        }
+        ++queued[lane];
+        return true;
+    }
+
+    // lane is set to the lane record was taken from
+    [[nodiscard]] bool pull(size_t &lane, Args &...args) noexcept
+    {
+        size_t fallback = lanes;
+        for (size_t candidate = 0; candidate < lanes; ++candidate)
+        {
+            if (!available(candidate))
+            {
+                continue;
+            }
+
+            if (weights[candidate] != 0 && served[candidate] >= weights[candidate])
+            {
+                fallback = fallback == lanes ? candidate : fallback;
+                continue;
+            }
+
+            return serve(candidate, lane, args...);
+        }
+
+        if (fallback == lanes)
+        {
+            return false;
+        }
+
+        // only lanes that used up their weight have records, start another round
+        served[fallback] = 0;
+        return serve(fallback, lane, args...);
+    }
+
+    // bytes held in ring, records marked taken included
+    size_t size() const noexcept
+    {
+        return ring.size();
+    }
+
+    // records of lane in ring, 0 for a lane that isn't one of lanes
+    size_t queuedRecords(size_t lane) const noexcept
+    {
+        return lane < lanes ? queued[lane] : 0;
+    }
+
+    // the last failure of spilling or refilling bulk lanes, which push()/pull() can only
+    // report as false
+    std::error_code error() const noexcept
+    {
+        return lastError;
+    }
+
+private:
+    // lane tag of records already pulled from behind others
+    static constexpr uint8_t taken = 0xff;
+    static_assert(lanes < taken, "lane tag is a byte and one value of it marks taken records");
+
+    // a record is spilled when it is of a bulk lane and still queued
+    static bool spills(uint8_t tag) noexcept
+    {
+        return tag >= MemoryLanes && tag != taken;
+    }
+
+    // spills bulk records, false if there are none
+    bool spill() noexcept
+    {
+        size_t bulk{0};
+        for (size_t lane = MemoryLanes; lane < lanes; ++lane)
+        {
+            bulk += queued[lane];
+        }
+        if (bulk == 0)
+        {
+            return false;
+        }
+
+        auto [ec, records] = ring.template flushIf<0>(spills);
+        lastError = ec;
+        if (ec)
+        {
+            return false;
+        }
+
+        for (size_t lane = MemoryLanes; lane < lanes; ++lane)
+        {
+            queued[lane] = 0;
+        }
+        // records left were rearranged
+        cursors = {};
+        spilled = true;
+        dropTaken();
+        return true;
+    }
+
+    // Bulk lane with nothing in ring gets chunks back, last spilled first, till one brings it
+    // records or the next doesn't fit the budget
+    bool available(size_t lane) noexcept
+    {
+        while (queued[lane] == 0 && lane >= MemoryLanes && spilled)
+        {
+            auto [ec, chunkSize] = ring.tellDataSize();
+            if (!ec && chunkSize == 0)
+            {
+                spilled = false;
+                break;
+            }
+
+            if (!ec && ring.size() + chunkSize > budget)
+            {
+                break;
+            }
+
+            size_t from = ring.size();
+            if (!ec)
+            {
+                ec = ring.refillBack(chunkSize);
+            }
+
+            if (!ec)
+            {
+                ec = countLanes(from);
+            }
+
+            if (ec)
+            {
+                lastError = ec;
+                return false;
+            }
+        }
+        return queued[lane] != 0;
+    }
+
+    // Takes the first record of candidate lane, found from where the last one was: from the
+    // front of ring as any pull(), from behind other records by marking it taken
+    bool serve(size_t candidate, size_t &lane, Args &...args) noexcept
+    {
+        const char *ptr = ring.buffer + ring.readOffset;
+        size_t offset = cursors[candidate];
+        while (static_cast<uint8_t>(ptr[offset]) != candidate)
+        {
+            if (!ring.skipRecord(ptr, offset, ring.bufferSize))
+            {
+                lastError = std::make_error_code(std::errc::bad_message);
+                return false;
+            }
+        }
+
+        if (offset == 0)
+        {
+            uint8_t tag{0};
+            size_t before = ring.size();
+            if (!ring.pull(tag, args...))
+            {
+                return false;
+            }
+            advance(before - ring.size());
+        }
+        else
+        {
+            std::tuple<uint8_t, Args...> record;
+            size_t next = offset;
+            if (!ring.decodeRecord(record, ptr, next, ring.bufferSize, nullptr))
+            {
+                lastError = std::make_error_code(std::errc::bad_message);
+                return false;
+            }
+            std::tie(std::ignore, args...) = std::move(record);
+
+            ring.buffer[ring.readOffset + offset] = static_cast<char>(taken);
+            // checkpoint() syncs the tail of ring that was written since the last one
+            ring.dirtySize = std::max(ring.dirtySize, ring.bufferSize - offset);
+            cursors[candidate] = next;
+        }
+
+        --queued[candidate];
+        dropTaken();
+
+        lane = candidate;
+        ++served[candidate];
+        for (size_t higher = 0; higher < candidate; ++higher)
+        {
+            served[higher] = 0;
+        }
+        return true;
+    }
+
+    // gives back bytes of taken records at the front of ring
+    void dropTaken() noexcept
+    {
+        while (ring.bufferRecords != 0 &&
+               static_cast<uint8_t>(ring.buffer[ring.readOffset]) == taken)
+        {
+            size_t next{0};
+            if (!ring.skipRecord(ring.buffer + ring.readOffset, next, ring.bufferSize))
+            {
+                lastError = std::make_error_code(std::errc::bad_message);
+                return;
+            }
+            ring.consume((ring.readOffset + next) % ring.bufferCapacity, ring.bufferSize - next);
+            advance(next);
+        }
+    }
+
+    // front of ring moved by size bytes
+    void advance(size_t size) noexcept
+    {
+        for (size_t &cursor : cursors)
+        {
+            cursor = cursor > size ? cursor - size : 0;
+        }
+    }
+
+    // adds up records of each lane in ring from offset bytes on
+    std::error_code countLanes(size_t offset) noexcept
+    {
+        const char *ptr = ring.buffer + ring.readOffset;
+        while (offset < ring.bufferSize)
+        {
+            uint8_t tag = static_cast<uint8_t>(ptr[offset]);
+            if (tag != taken && tag >= lanes)
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            if (!ring.skipRecord(ptr, offset, ring.bufferSize))
+            {
+                return std::make_error_code(std::errc::bad_message);
+            }
+
+            if (tag != taken)
+            {
+                ++queued[tag];
+            }
+        }
+        return std::error_code();
+    }
+
+    size_t budget;
+    std::array<size_t, lanes> weights;
+    std::array<size_t, lanes> served{};
+    Repository ring;
+    std::array<size_t, lanes> queued{}; // records of each lane in ring, taken ones aside
+    std::array<size_t, lanes> cursors{}; // bytes from the front of ring with none of lane
+    bool spilled{false};                 // spill file may have chunks
+    std::error_code lastError;
+};
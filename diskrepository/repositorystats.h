@@ -0,0 +1,479 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Cheap monotonic clock for timestamping every record: rdtsc on x86 (invariant TSC assumed),
+// steady_clock elsewhere. Ticks are converted to nanoseconds with a factor calibrated once.
+class TscClock final
+{
+public:
+    static uint64_t now() noexcept
+    {
+#if defined(__x86_64__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+#endif
+    }
+
+    static uint64_t toNanoseconds(uint64_t ticks) noexcept
+    {
+        static const double nanosecondsPerTick = calibrate();
+        return static_cast<uint64_t>(ticks * nanosecondsPerTick);
+    }
+
+private:
+    static double calibrate() noexcept
+    {
+#if defined(__x86_64__)
+        using Clock = std::chrono::steady_clock;
+        auto start = Clock::now();
+        uint64_t startTicks = now();
+        while (Clock::now() - start < std::chrono::milliseconds(2))
+        {
+        }
+        uint64_t ticks = now() - startTicks;
+        auto elapsed =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        return ticks == 0 ? 1.0 : double(elapsed) / double(ticks);
+#else
+        return 1.0;
+#endif
+    }
+};
+
+// Log-linear histogram in the spirit of HdrHistogram: values are bucketed by power of two
+// and each power of two is split into 8 linear sub-buckets, so relative error stays under
+// 12.5% over the whole uint64_t range with a fixed set of 496 counters.
+// Single writer, any number of concurrent readers.
+class LatencyHistogram final
+{
+public:
+    static constexpr size_t subBucketBits = 3;
+    static constexpr size_t subBuckets = 1 << subBucketBits;
+    static constexpr size_t buckets = (64 - subBucketBits + 1) * subBuckets;
+
+    struct Snapshot
+    {
+        std::array<uint64_t, buckets> counts{};
+        uint64_t count{0};
+        uint64_t max{0};
+
+        // upper bound of the bucket holding given quantile, 0 for empty histogram
+        uint64_t percentile(double quantile) const noexcept
+        {
+            if (count == 0)
+            {
+                return 0;
+            }
+
+            uint64_t rank = static_cast<uint64_t>(quantile * (count - 1)) + 1;
+            uint64_t seen{0};
+            for (size_t index = 0; index < buckets; ++index)
+            {
+                if (seen += counts[index]; seen >= rank)
+                {
+                    return std::min(upperBound(index), max);
+                }
+            }
+            return max;
+        }
+    };
+
+    void record(uint64_t value) noexcept
+    {
+        increment(counts[indexOf(value)], 1);
+        if (value > max.load(std::memory_order_relaxed))
+        {
+            max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    Snapshot snapshot() const noexcept
+    {
+        Snapshot result;
+        for (size_t index = 0; index < buckets; ++index)
+        {
+            result.counts[index] = counts[index].load(std::memory_order_relaxed);
+            result.count += result.counts[index];
+        }
+        result.max = max.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    static size_t indexOf(uint64_t value) noexcept
+    {
+        if (value < subBuckets)
+        {
+            return value;
+        }
+
+        size_t exponent = 63 - __builtin_clzll(value);
+        size_t subBucket = (value >> (exponent - subBucketBits)) & (subBuckets - 1);
+        return (exponent - subBucketBits + 1) * subBuckets + subBucket;
+    }
+
+    static uint64_t upperBound(size_t index) noexcept
+    {
+        if (index < subBuckets)
+        {
+            return index;
+        }
+
+        size_t exponent = index / subBuckets + subBucketBits - 1;
+        uint64_t base = uint64_t(1) << exponent;
+        uint64_t step = uint64_t(1) << (exponent - subBucketBits);
+        return base + (index % subBuckets + 1) * step - 1;
+    }
+
+    // the only writer doesn't need atomic read-modify-write, just a tear-free store
+    static void increment(std::atomic<uint64_t> &counter, uint64_t value) noexcept
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, buckets> counts{};
+    std::atomic<uint64_t> max{0};
+};
+
+// Stats policy of BasicDiskRepository that compiles to nothing, used by default.
+struct NullRepositoryStats
+{
+    static uint64_t now() noexcept
+    {
+        return 0;
+    }
+
+    void pushed(size_t bytes, size_t bufferSize) noexcept
+    {
+    }
+
+    void pushedBatch(size_t records, size_t bytes, size_t bufferSize) noexcept
+    {
+    }
+
+    void pushFailed() noexcept
+    {
+    }
+
+    void pulled(size_t bytes) noexcept
+    {
+    }
+
+    uint64_t transferredOut(size_t bytes) noexcept
+    {
+        return 0;
+    }
+
+    void transferredIn(size_t bytes, size_t bufferSize, uint64_t pushTime) noexcept
+    {
+    }
+
+    void rotated(size_t records) noexcept
+    {
+    }
+
+    void spilledFront(size_t records) noexcept
+    {
+    }
+
+    void refilledBack(size_t records) noexcept
+    {
+    }
+
+    void flushed(size_t spilledBytes, bool fromRing, uint64_t start) noexcept
+    {
+    }
+
+    void refilled(size_t records, bool intoRing, uint64_t start) noexcept
+    {
+    }
+
+    void paced(size_t frames, size_t chunkSize, uint64_t overhead, uint64_t bandwidth) noexcept
+    {
+    }
+
+    void relieved(size_t releasedBytes) noexcept
+    {
+    }
+
+    void reset() noexcept
+    {
+    }
+};
+
+struct RepositoryStatsSnapshot
+{
+    uint64_t recordsPushed{0};
+    uint64_t bytesPushed{0};
+    uint64_t recordsPulled{0};
+    uint64_t bytesPulled{0};
+    uint64_t failedPushes{0};
+    uint64_t flushes{0};
+    uint64_t refills{0};
+    uint64_t bytesSpilled{0}; // bytes written to backup file, after codec
+    uint64_t bufferSizeHighWater{0};
+
+    // decisions of flush() with spillLatencyTarget and the model they were made by
+    uint64_t splitFlushes{0};     // flushes that wrote ring content as several chunks
+    uint64_t splitChunks{0};      // chunks written by them
+    uint64_t coalescedFlushes{0}; // flushes that left content in ring for the next one
+    uint64_t spillChunkSize{0};   // largest chunk expected to fit the target
+    uint64_t spillOverhead{0};    // nanoseconds a chunk write takes whatever its size
+    uint64_t spillBandwidth{0};   // bytes per second
+    uint64_t pressureReliefs{0};  // calls of relieveMemoryPressure()
+    uint64_t bytesReleased{0};    // ring bytes given back to the system by them
+
+    // nanoseconds
+    LatencyHistogram::Snapshot flushDuration;
+    LatencyHistogram::Snapshot refillDuration;
+    // from push() to pull(), only for records that never left ring
+    LatencyHistogram::Snapshot residency;
+};
+
+// Stats policy that counts everything. Hooks are called by the thread driving the
+// repository, snapshot() may be called from any other thread at any time.
+class RepositoryStats
+{
+public:
+    static uint64_t now() noexcept
+    {
+        return TscClock::now();
+    }
+
+    void pushed(size_t bytes, size_t bufferSize) noexcept
+    {
+        transferredIn(bytes, bufferSize, now());
+    }
+
+    // records pushed in one go share a push time
+    void pushedBatch(size_t records, size_t bytes, size_t bufferSize) noexcept
+    {
+        LatencyHistogram::increment(recordsPushed, records);
+        LatencyHistogram::increment(bytesPushed, bytes);
+        if (bufferSize > bufferSizeHighWater.load(std::memory_order_relaxed))
+        {
+            bufferSizeHighWater.store(bufferSize, std::memory_order_relaxed);
+        }
+
+        uint64_t pushTime = now();
+        for (size_t i = 0; i < records; ++i)
+        {
+            enqueue(pushTime);
+        }
+    }
+
+    void pushFailed() noexcept
+    {
+        LatencyHistogram::increment(failedPushes, 1);
+    }
+
+    void pulled(size_t bytes) noexcept
+    {
+        if (uint64_t pushTime = transferredOut(bytes); pushTime != untimed)
+        {
+            residency.record(TscClock::toNanoseconds(now() - pushTime));
+        }
+    }
+
+    // Record at the front of ring goes to another repository: it counts as pulled here and
+    // pushed there, and its push time, untimed if unknown, goes along with it
+    uint64_t transferredOut(size_t bytes) noexcept
+    {
+        LatencyHistogram::increment(recordsPulled, 1);
+        LatencyHistogram::increment(bytesPulled, bytes);
+        return dequeue();
+    }
+
+    void transferredIn(size_t bytes, size_t bufferSize, uint64_t pushTime) noexcept
+    {
+        LatencyHistogram::increment(recordsPushed, 1);
+        LatencyHistogram::increment(bytesPushed, bytes);
+        if (bufferSize > bufferSizeHighWater.load(std::memory_order_relaxed))
+        {
+            bufferSizeHighWater.store(bufferSize, std::memory_order_relaxed);
+        }
+        enqueue(pushTime);
+    }
+
+    // records at the front of ring were moved to its back, push times go along
+    void rotated(size_t records) noexcept
+    {
+        for (size_t i = 0; i < records; ++i)
+        {
+            enqueue(dequeue());
+        }
+    }
+
+    // records at the front of ring were spilled while the ones behind them stay in ring,
+    // their push times are dropped
+    void spilledFront(size_t records) noexcept
+    {
+        for (size_t i = 0; i < records; ++i)
+        {
+            (void)dequeue();
+        }
+    }
+
+    // records were refilled behind the ones in ring, their push times aren't known
+    void refilledBack(size_t records) noexcept
+    {
+        for (size_t i = 0; i < records; ++i)
+        {
+            enqueue(untimed);
+        }
+    }
+
+    // fromRing is false when records left in ring keep their push times: a single record
+    // spilled bypassing ring, or records flushIf() spilled out of it
+    void flushed(size_t spilledBytes, bool fromRing, uint64_t start) noexcept
+    {
+        flushDuration.record(TscClock::toNanoseconds(now() - start));
+        LatencyHistogram::increment(flushes, 1);
+        LatencyHistogram::increment(bytesSpilled, spilledBytes);
+        if (fromRing)
+        {
+            reset();
+        }
+    }
+
+    // ring content is replaced by records whose push time is unknown
+    void refilled(size_t records, bool intoRing, uint64_t start) noexcept
+    {
+        refillDuration.record(TscClock::toNanoseconds(now() - start));
+        LatencyHistogram::increment(refills, 1);
+        if (intoRing)
+        {
+            reset();
+            untimedRecords = records;
+        }
+    }
+
+    // Called by flush() with spillLatencyTarget: frames written, 0 when content was left in
+    // ring, and the model as it stands
+    void paced(size_t frames, size_t chunkSize, uint64_t overhead, uint64_t bandwidth) noexcept
+    {
+        if (frames == 0)
+        {
+            LatencyHistogram::increment(coalescedFlushes, 1);
+        }
+        else if (frames > 1)
+        {
+            LatencyHistogram::increment(splitFlushes, 1);
+            LatencyHistogram::increment(splitChunks, frames);
+        }
+        spillChunkSize.store(chunkSize, std::memory_order_relaxed);
+        spillOverhead.store(overhead, std::memory_order_relaxed);
+        spillBandwidth.store(bandwidth, std::memory_order_relaxed);
+    }
+
+    void relieved(size_t releasedBytes) noexcept
+    {
+        LatencyHistogram::increment(pressureReliefs, 1);
+        LatencyHistogram::increment(bytesReleased, releasedBytes);
+    }
+
+    void reset() noexcept
+    {
+        head = tail;
+        untimedRecords = 0;
+    }
+
+    RepositoryStatsSnapshot snapshot() const noexcept
+    {
+        RepositoryStatsSnapshot result;
+        result.recordsPushed = recordsPushed.load(std::memory_order_relaxed);
+        result.bytesPushed = bytesPushed.load(std::memory_order_relaxed);
+        result.recordsPulled = recordsPulled.load(std::memory_order_relaxed);
+        result.bytesPulled = bytesPulled.load(std::memory_order_relaxed);
+        result.failedPushes = failedPushes.load(std::memory_order_relaxed);
+        result.flushes = flushes.load(std::memory_order_relaxed);
+        result.refills = refills.load(std::memory_order_relaxed);
+        result.bytesSpilled = bytesSpilled.load(std::memory_order_relaxed);
+        result.bufferSizeHighWater = bufferSizeHighWater.load(std::memory_order_relaxed);
+        result.splitFlushes = splitFlushes.load(std::memory_order_relaxed);
+        result.splitChunks = splitChunks.load(std::memory_order_relaxed);
+        result.coalescedFlushes = coalescedFlushes.load(std::memory_order_relaxed);
+        result.spillChunkSize = spillChunkSize.load(std::memory_order_relaxed);
+        result.spillOverhead = spillOverhead.load(std::memory_order_relaxed);
+        result.spillBandwidth = spillBandwidth.load(std::memory_order_relaxed);
+        result.pressureReliefs = pressureReliefs.load(std::memory_order_relaxed);
+        result.bytesReleased = bytesReleased.load(std::memory_order_relaxed);
+        result.flushDuration = flushDuration.snapshot();
+        result.refillDuration = refillDuration.snapshot();
+        result.residency = residency.snapshot();
+        return result;
+    }
+
+private:
+    // push time of a record whose push time isn't known, TscClock never reads it
+    static constexpr uint64_t untimed = 0;
+
+    // push time of the record at the front of ring
+    uint64_t dequeue() noexcept
+    {
+        if (untimedRecords != 0)
+        {
+            --untimedRecords;
+            return untimed;
+        }
+        return head != tail ? timestamps[head++ & (timestamps.size() - 1)] : untimed;
+    }
+
+    // push timestamps of records in ring, in ring order; grows to the peak record count
+    void enqueue(uint64_t timestamp) noexcept
+    {
+        if (tail - head == timestamps.size())
+        {
+            std::vector<uint64_t> grown(std::max<size_t>(64, timestamps.size() * 2));
+            for (size_t i = 0; head + i != tail; ++i)
+            {
+                grown[i] = timestamps[(head + i) & (timestamps.size() - 1)];
+            }
+            tail -= head;
+            head = 0;
+            timestamps.swap(grown);
+        }
+        timestamps[tail++ & (timestamps.size() - 1)] = timestamp;
+    }
+
+    std::atomic<uint64_t> recordsPushed{0};
+    std::atomic<uint64_t> bytesPushed{0};
+    std::atomic<uint64_t> recordsPulled{0};
+    std::atomic<uint64_t> bytesPulled{0};
+    std::atomic<uint64_t> failedPushes{0};
+    std::atomic<uint64_t> flushes{0};
+    std::atomic<uint64_t> refills{0};
+    std::atomic<uint64_t> bytesSpilled{0};
+    std::atomic<uint64_t> bufferSizeHighWater{0};
+    std::atomic<uint64_t> splitFlushes{0};
+    std::atomic<uint64_t> splitChunks{0};
+    std::atomic<uint64_t> coalescedFlushes{0};
+    std::atomic<uint64_t> spillChunkSize{0};
+    std::atomic<uint64_t> spillOverhead{0};
+    std::atomic<uint64_t> spillBandwidth{0};
+    std::atomic<uint64_t> pressureReliefs{0};
+    std::atomic<uint64_t> bytesReleased{0};
+
+    LatencyHistogram flushDuration;
+    LatencyHistogram refillDuration;
+    LatencyHistogram residency;
+
+    std::vector<uint64_t> timestamps;
+    size_t head{0};
+    size_t tail{0};
+    size_t untimedRecords{0};
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "crc32c.h"
+
+// State of a file-backed ring as of the last checkpoint. Header page of the ring file holds
+// two of them which are written in turns, so a torn checkpoint leaves the previous one intact.
+struct RingCheckpoint
+{
+    static constexpr uint32_t ringMagic = 0x474e4952; // "RING"
+
+    uint32_t magic{ringMagic};
+    uint32_t reserved{0};
+    uint64_t generation{0};
+    uint64_t capacity{0};
+    uint64_t readOffset{0};
+    uint64_t size{0};
+    uint64_t records{0};
+    uint32_t reserved2{0};
+    uint32_t checkpointCrc{0};
+
+    void seal() noexcept
+    {
+        checkpointCrc = Crc32c::compute(0, this, offsetof(RingCheckpoint, checkpointCrc));
+    }
+
+    bool valid() const noexcept
+    {
+        return magic == ringMagic &&
+               checkpointCrc == Crc32c::compute(0, this, offsetof(RingCheckpoint, checkpointCrc));
+    }
+};
+
+struct RingHeader
+{
+    RingCheckpoint slots[2];
+
+    // the newest valid checkpoint or nullptr if ring was never checkpointed
+    const RingCheckpoint *latest() const noexcept
+    {
+        const RingCheckpoint *result = nullptr;
+        for (const auto &slot : slots)
+        {
+            if (slot.valid() && (result == nullptr || slot.generation > result->generation))
+            {
+                result = &slot;
+            }
+        }
+        return result;
+    }
+};
+
+static_assert(sizeof(RingHeader) == 112);
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+// Runs one snapshot at a time on a helper thread, see BasicDiskRepository::snapshot(). Owner
+// hands a job over with start(), which only takes a lock and wakes the thread up (it is
+// created by the first start()), and learns the outcome with wait(). busy() is what push()
+// checks to know whether bytes being written are still pinned, so it is a lone atomic load.
+class RingSnapshotter final
+{
+public:
+    // called on helper thread, must only read what the owner leaves alone while busy()
+    using Job = std::function<std::error_code()>;
+
+    RingSnapshotter() noexcept = default;
+
+    RingSnapshotter(const RingSnapshotter &) = delete;
+    RingSnapshotter &operator=(const RingSnapshotter &) = delete;
+
+    ~RingSnapshotter()
+    {
+        stop();
+    }
+
+    // false if the previous job is still running
+    bool start(Job _job)
+    {
+        {
+            std::lock_guard lock(mutex);
+            if (running.load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+
+            job = std::move(_job);
+            result = std::error_code();
+            running.store(true, std::memory_order_relaxed);
+        }
+
+        if (!worker.joinable())
+        {
+            stopping = false;
+            worker = std::thread([this] { run(); });
+        }
+        wakeup.notify_one();
+        return true;
+    }
+
+    // job is done with whatever it reads once this returns false
+    bool busy() const noexcept
+    {
+        return running.load(std::memory_order_acquire);
+    }
+
+    // waits for the running job, if any, and returns outcome of the last one
+    std::error_code wait()
+    {
+        std::unique_lock lock(mutex);
+        finished.wait(lock, [&] { return !running.load(std::memory_order_relaxed); });
+        return result;
+    }
+
+    // waits for the running job, then stops helper thread
+    void stop()
+    {
+        {
+            std::unique_lock lock(mutex);
+            finished.wait(lock, [&] { return !running.load(std::memory_order_relaxed); });
+            stopping = true;
+        }
+        wakeup.notify_one();
+
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock lock(mutex);
+        while (!stopping)
+        {
+            if (!running.load(std::memory_order_relaxed))
+            {
+                wakeup.wait(lock);
+                continue;
+            }
+
+            Job current = std::move(job);
+            lock.unlock();
+            std::error_code ec = current();
+            lock.lock();
+
+            result = ec;
+            running.store(false, std::memory_order_release);
+            finished.notify_all();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wakeup;   // new job or stop
+    std::condition_variable finished; // job done
+    Job job;
+    std::error_code result;
+    std::atomic<bool> running{false};
+    bool stopping{false};
+    std::thread worker;
+};
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+// Codec stage applied to every chunk on its way to/from the backup file.
+// Codec id 0 is reserved for chunks that are stored as is.
+class SpillCodec
+{
+public:
+    virtual ~SpillCodec() = default;
+
+    virtual uint8_t id() const noexcept = 0;
+
+    // upper bound of compress() output for an input of given size
+    virtual size_t maxCompressedSize(size_t size) const noexcept = 0;
+
+    // returns number of bytes written to dst or 0 if input doesn't fit into capacity
+    virtual size_t compress(
+        const char *src, size_t size, char *dst, size_t capacity) const noexcept = 0;
+
+    // dst must be exactly of original (uncompressed) size
+    [[nodiscard]] virtual bool decompress(
+        const char *src, size_t size, char *dst, size_t dstSize) const noexcept = 0;
+};
+
+// Byte-oriented LZ77 codec in the spirit of LZ4: a token holds literal and match lengths,
+// followed by literals, 16-bit match offset and length continuation bytes.
+// Last sequence of a block consists of literals only.
+class LzSpillCodec final : public SpillCodec
+{
+public:
+    static constexpr uint8_t codecId = 1;
+
+    uint8_t id() const noexcept override
+    {
+        return codecId;
+    }
+
+    size_t maxCompressedSize(size_t size) const noexcept override
+    {
+        return size + size / 255 + 16;
+    }
+
+    size_t compress(
+        const char *src, size_t size, char *dst, size_t capacity) const noexcept override
+    {
+        const auto *ip = reinterpret_cast<const uint8_t *>(src);
+        const auto *const base = ip;
+        const auto *const end = base + size;
+        const auto *anchor = ip;
+        auto *op = reinterpret_cast<uint8_t *>(dst);
+        auto *const opEnd = op + capacity;
+
+        if (size > lastLiterals + minMatch)
+        {
+            std::array<size_t, hashSize> table;
+            table.fill(0);
+
+            const auto *const matchLimit = end - lastLiterals;
+            const auto *const searchLimit = matchLimit - minMatch;
+
+            ++ip;
+            while (ip < searchLimit)
+            {
+                uint32_t sequence = read32(ip);
+                size_t &slot = table[hash(sequence)];
+                const auto *ref = base + slot;
+                slot = ip - base;
+
+                if (ref >= ip || static_cast<size_t>(ip - ref) > maxOffset ||
+                    read32(ref) != sequence)
+                {
+                    ++ip;
+                    continue;
+                }
+
+                const auto *matchEnd = ip + minMatch;
+                for (const auto *r = ref + minMatch; matchEnd < matchLimit && *matchEnd == *r;
+                     ++matchEnd, ++r)
+                {
+                }
+
+                if (!emitSequence(op, opEnd, anchor, ip - anchor, ip - ref, matchEnd - ip))
+                {
+                    return 0;
+                }
+
+                ip = matchEnd;
+                anchor = ip;
+            }
+        }
+
+        if (!emitLiterals(op, opEnd, anchor, end - anchor))
+        {
+            return 0;
+        }
+        return op - reinterpret_cast<uint8_t *>(dst);
+    }
+
+    [[nodiscard]] bool decompress(
+        const char *src, size_t size, char *dst, size_t dstSize) const noexcept override
+    {
+        const auto *ip = reinterpret_cast<const uint8_t *>(src);
+        const auto *const end = ip + size;
+        auto *op = reinterpret_cast<uint8_t *>(dst);
+        auto *const base = op;
+        auto *const opEnd = op + dstSize;
+
+        while (ip < end)
+        {
+            uint8_t token = *ip++;
+
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(ip, end, literals))
+            {
+                return false;
+            }
+            if (static_cast<size_t>(end - ip) < literals ||
+                static_cast<size_t>(opEnd - op) < literals)
+            {
+                return false;
+            }
+            std::memcpy(op, ip, literals);
+            ip += literals;
+            op += literals;
+
+            if (ip == end)
+            {
+                break;
+            }
+
+            if (end - ip < 2)
+            {
+                return false;
+            }
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if (offset == 0 || offset > static_cast<size_t>(op - base))
+            {
+                return false;
+            }
+
+            size_t length = token & 15;
+            if (length == 15 && !readLength(ip, end, length))
+            {
+                return false;
+            }
+            length += minMatch;
+            if (static_cast<size_t>(opEnd - op) < length)
+            {
+                return false;
+            }
+
+            const uint8_t *ref = op - offset;
+            if (offset >= length)
+            {
+                std::memcpy(op, ref, length);
+                op += length;
+            }
+            else
+            {
+                while (length-- > 0)
+                {
+                    *op++ = *ref++;
+                }
+            }
+        }
+
+        return op == opEnd;
+    }
+
+private:
+    static constexpr size_t minMatch = 4;
+    static constexpr size_t lastLiterals = 8;
+    static constexpr size_t maxOffset = 65535;
+    static constexpr size_t hashLog = 12;
+    static constexpr size_t hashSize = 1 << hashLog;
+
+    static uint32_t read32(const uint8_t *ptr) noexcept
+    {
+        uint32_t value;
+        std::memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+
+    static size_t hash(uint32_t sequence) noexcept
+    {
+        return (sequence * 2654435761u) >> (32 - hashLog);
+    }
+
+    static bool readLength(const uint8_t *&ip, const uint8_t *end, size_t &length) noexcept
+    {
+        uint8_t byte{0};
+        do
+        {
+            if (ip == end)
+            {
+                return false;
+            }
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    static bool writeLength(uint8_t *&op, uint8_t *opEnd, size_t length) noexcept
+    {
+        for (; length >= 255; length -= 255)
+        {
+            if (op == opEnd)
+            {
+                return false;
+            }
+            *op++ = 255;
+        }
+        if (op == opEnd)
+        {
+            return false;
+        }
+        *op++ = static_cast<uint8_t>(length);
+        return true;
+    }
+
+    static bool emitLiterals(
+        uint8_t *&op, uint8_t *opEnd, const uint8_t *literals, size_t count) noexcept
+    {
+        if (op == opEnd)
+        {
+            return false;
+        }
+        *op++ = static_cast<uint8_t>((count < 15 ? count : 15) << 4);
+        if (count >= 15 && !writeLength(op, opEnd, count - 15))
+        {
+            return false;
+        }
+        if (static_cast<size_t>(opEnd - op) < count)
+        {
+            return false;
+        }
+        std::memcpy(op, literals, count);
+        op += count;
+        return true;
+    }
+
+    static bool emitSequence(uint8_t *&op, uint8_t *opEnd, const uint8_t *literals,
+        size_t count, size_t offset, size_t length) noexcept
+    {
+        uint8_t *token = op;
+        if (!emitLiterals(op, opEnd, literals, count) || opEnd - op < 2)
+        {
+            return false;
+        }
+
+        *op++ = static_cast<uint8_t>(offset);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+
+        length -= minMatch;
+        *token |= static_cast<uint8_t>(length < 15 ? length : 15);
+        return length < 15 || writeLength(op, opEnd, length - 15);
+    }
+};
+
+inline const LzSpillCodec lzSpillCodec;
+
+// Maps codec ids stored in frame trailers back to codec instances on refill.
+// Built-in codecs are always registered, custom ones can be added by id.
+class SpillCodecRegistry final
+{
+public:
+    static const SpillCodec *find(uint8_t id) noexcept
+    {
+        return codecs()[id];
+    }
+
+    [[nodiscard]] static bool add(const SpillCodec *codec) noexcept
+    {
+        if (codec == nullptr || codec->id() == 0)
+        {
+            return false;
+        }
+
+        const SpillCodec *&slot = codecs()[codec->id()];
+        if (slot != nullptr && slot != codec)
+        {
+            return false;
+        }
+        slot = codec;
+        return true;
+    }
+
+private:
+    static std::array<const SpillCodec *, 256> &codecs() noexcept
+    {
+        static std::array<const SpillCodec *, 256> registry = [] {
+            std::array<const SpillCodec *, 256> result{};
+            result[LzSpillCodec::codecId] = &lzSpillCodec;
+            return result;
+        }();
+        return registry;
+    }
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "byteorder.h"
+#include "crc32c.h"
+
+// FNV-1a of a schema description, fields separated by commas: i1..i8 and u1..u8 for signed
+// and unsigned integers of that many bytes, b for bool, c for char, s for std::string,
+// v(...) for std::variant and t(...) for std::tuple of what is inside. E.g. "u4,s,i2" is
+// uint32_t, std::string, int16_t. Description can be hashed piece by piece with mix().
+struct SpillSchema
+{
+    static constexpr uint64_t basis = 14695981039346656037ull;
+
+    static constexpr uint64_t mix(uint64_t hash, std::string_view text) noexcept
+    {
+        for (char c : text)
+        {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static constexpr uint64_t fingerprint(std::string_view description) noexcept
+    {
+        return mix(basis, description);
+    }
+};
+
+// Backup file starts with this header, frames follow it. All integers in the file, records
+// included, are little-endian of fixed width (string lengths are uint64_t), so a file can be
+// read on any host by a repository of the same schema. Files without header are version 0,
+// written before it existed: frames start right at the beginning, integers are in host order.
+// Version 1 header is the first version1Size bytes of this one, with a 4 byte reserved field
+// and headerCrc where nextSequence is.
+struct SpillFileHeader
+{
+    static constexpr uint32_t fileMagic = 0x4c505344; // "DSPL"
+    static constexpr uint16_t currentVersion = 2;
+    static constexpr uint16_t sequenceVersion = 2; // first version keeping nextSequence
+    static constexpr size_t version1Size = 24;
+
+    uint32_t magic{fileMagic};
+    uint16_t version{currentVersion};
+    uint16_t headerSize{sizeof(SpillFileHeader)}; // frames start here
+    uint64_t schemaFingerprint{0};                // see SpillSchema
+    // Sequence number of the next spilled record at least, rewritten before refills cut
+    // chunks off the file, so numbers aren't given out again once their chunks are gone
+    uint64_t nextSequence{0};
+    uint32_t reserved{0};
+    uint32_t headerCrc{0}; // crc32c of all fields above
+
+    // fields are in host byte order, file holds them little-endian: header is written as
+    // fileImage() and converted with fromFile() after reading, checksum covers the file image
+    SpillFileHeader fileImage() const noexcept
+    {
+        SpillFileHeader image = *this;
+        image.swapBytes();
+        return image;
+    }
+
+    void fromFile() noexcept
+    {
+        swapBytes();
+    }
+
+    void seal() noexcept
+    {
+        headerCrc = checksum(offsetof(SpillFileHeader, headerCrc));
+    }
+
+    bool valid() const noexcept
+    {
+        if (version == 1)
+        {
+            // headerCrc of version 1 is what reads as the upper half of nextSequence
+            return magic == fileMagic &&
+                   uint32_t(nextSequence >> 32) == checksum(version1Size - sizeof(headerCrc));
+        }
+        return magic == fileMagic && headerCrc == checksum(offsetof(SpillFileHeader, headerCrc));
+    }
+
+    // bytes taken by fields of this version, frames can't start before
+    size_t fieldsSize() const noexcept
+    {
+        return version == 1 ? version1Size : sizeof(SpillFileHeader);
+    }
+
+    // what nextSequence tells of a valid() header, 0 for versions that don't keep it
+    uint64_t savedSequence() const noexcept
+    {
+        return version >= sequenceVersion ? nextSequence : 0;
+    }
+
+private:
+    uint32_t checksum(size_t size) const noexcept
+    {
+        SpillFileHeader image = fileImage();
+        return Crc32c::compute(0, &image, size);
+    }
+
+    void swapBytes() noexcept
+    {
+        magic = ByteOrder::little(magic);
+        version = ByteOrder::little(version);
+        headerSize = ByteOrder::little(headerSize);
+        schemaFingerprint = ByteOrder::little(schemaFingerprint);
+        nextSequence = ByteOrder::little(nextSequence);
+        reserved = ByteOrder::little(reserved);
+        headerCrc = ByteOrder::little(headerCrc);
+    }
+};
+
+static_assert(sizeof(SpillFileHeader) == 32);
+
+// Every spilled chunk is written as [payload][padding][SpillFrameTrailer]. Trailer sits after
+// the payload so the backup file can still be walked backwards from its end, chunk by chunk.
+// Padding is only used with direct I/O, where it makes every frame end on a block boundary.
+struct SpillFrameTrailer
+{
+    static constexpr uint32_t frameMagic = 0x4b4e4843; // "CHNK"
+    static constexpr uint8_t sortedFlag = 1; // records are ordered by a key, see flushSorted()
+    static constexpr uint8_t dictionaryFlag = 2; // strings are encoded with StringDictionary
+    static constexpr uint8_t columnarFlag = 4;   // records are transposed into columns
+
+    uint64_t storedSize{0}; // payload bytes on disk
+    uint64_t dataSize{0};   // payload bytes after decoding, i.e. what refill() puts into ring
+    uint64_t records{0};    // records in this chunk
+    uint64_t firstSequence{0}; // sequence number of the first record in this chunk
+
+    // running totals of the file up to and including this chunk, so the last trailer alone
+    // describes everything spilled and each chunk can be checked against its predecessor
+    uint64_t totalFrames{0};
+    uint64_t totalRecords{0};
+    uint64_t totalDataSize{0};
+
+    uint32_t payloadCrc{0}; // crc32c of stored payload bytes
+    uint8_t codec{0};       // SpillCodec id, 0 when payload is stored as is
+    uint8_t flags{0};
+    uint16_t padding{0};    // zero bytes between payload and trailer
+    uint32_t magic{frameMagic};
+    uint32_t trailerCrc{0}; // crc32c of all fields above, detects torn trailers
+
+    // fields are in host byte order, file holds them little-endian: trailer is written as
+    // fileImage() and converted with fromFile() after reading, checksum covers the file image
+    SpillFrameTrailer fileImage() const noexcept
+    {
+        SpillFrameTrailer image = *this;
+        image.swapBytes();
+        return image;
+    }
+
+    void fromFile() noexcept
+    {
+        swapBytes();
+    }
+
+    // payload, padding and trailer
+    uint64_t frameSize() const noexcept
+    {
+        return storedSize + padding + sizeof(SpillFrameTrailer);
+    }
+
+    void seal() noexcept
+    {
+        trailerCrc = checksum();
+    }
+
+    bool valid() const noexcept
+    {
+        return magic == frameMagic && trailerCrc == checksum();
+    }
+
+    // chunk right before this one, default constructed one for the first chunk in file
+    bool follows(const SpillFrameTrailer &previous) const noexcept
+    {
+        return firstSequence >= previous.firstSequence + previous.records &&
+               totalFrames == previous.totalFrames + 1 &&
+               totalRecords == previous.totalRecords + records &&
+               totalDataSize == previous.totalDataSize + dataSize;
+    }
+
+    // What recovery requires of the last chunk of a file, trailer being valid(): totals that
+    // follow the previous chunk and storedSize bytes of payload matching their checksum
+    bool intact(const SpillFrameTrailer &previous, const char *payload) const noexcept
+    {
+        return follows(previous) && Crc32c::compute(0, payload, storedSize) == payloadCrc;
+    }
+
+private:
+    uint32_t checksum() const noexcept
+    {
+        SpillFrameTrailer image = fileImage();
+        return Crc32c::compute(0, &image, offsetof(SpillFrameTrailer, trailerCrc));
+    }
+
+    void swapBytes() noexcept
+    {
+        storedSize = ByteOrder::little(storedSize);
+        dataSize = ByteOrder::little(dataSize);
+        records = ByteOrder::little(records);
+        firstSequence = ByteOrder::little(firstSequence);
+        totalFrames = ByteOrder::little(totalFrames);
+        totalRecords = ByteOrder::little(totalRecords);
+        totalDataSize = ByteOrder::little(totalDataSize);
+        payloadCrc = ByteOrder::little(payloadCrc);
+        padding = ByteOrder::little(padding);
+        magic = ByteOrder::little(magic);
+        trailerCrc = ByteOrder::little(trailerCrc);
+    }
+};
+
+static_assert(sizeof(SpillFrameTrailer) == 72);
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "byteorder.h"
+#include "crc32c.h"
+
+// One entry per spilled chunk, ordered as chunks are in backup file, so both sequences
+// and offsets are ascending and a record can be found by binary search.
+struct SpillIndexEntry
+{
+    uint64_t firstSequence{0};
+    uint64_t frameEnd{0}; // offset right past chunk trailer
+};
+
+static_assert(sizeof(SpillIndexEntry) == 16);
+
+// Index file is [SpillIndexEntry...][SpillIndexFooter], little-endian like backup file. It is
+// saved on close() and only trusted if it describes exactly the chunk found at the end of
+// backup file.
+struct SpillIndexFooter
+{
+    static constexpr uint32_t indexMagic = 0x58444e49; // "INDX"
+
+    uint64_t entries{0};
+    uint64_t lastFrameEnd{0};
+    uint32_t lastTrailerCrc{0};
+    uint32_t magic{indexMagic};
+    uint32_t entriesCrc{0};
+    uint32_t footerCrc{0};
+
+    // in host byte order like SpillFrameTrailer, written as fileImage(), read with fromFile()
+    SpillIndexFooter fileImage() const noexcept
+    {
+        SpillIndexFooter image = *this;
+        image.swapBytes();
+        return image;
+    }
+
+    void fromFile() noexcept
+    {
+        swapBytes();
+    }
+
+    void seal() noexcept
+    {
+        footerCrc = checksum();
+    }
+
+    bool valid() const noexcept
+    {
+        return magic == indexMagic && footerCrc == checksum();
+    }
+
+private:
+    uint32_t checksum() const noexcept
+    {
+        SpillIndexFooter image = fileImage();
+        return Crc32c::compute(0, &image, offsetof(SpillIndexFooter, footerCrc));
+    }
+
+    void swapBytes() noexcept
+    {
+        entries = ByteOrder::little(entries);
+        lastFrameEnd = ByteOrder::little(lastFrameEnd);
+        lastTrailerCrc = ByteOrder::little(lastTrailerCrc);
+        magic = ByteOrder::little(magic);
+        entriesCrc = ByteOrder::little(entriesCrc);
+        footerCrc = ByteOrder::little(footerCrc);
+    }
+};
+
+static_assert(sizeof(SpillIndexFooter) == 32);
+
+// last chunk starting at or before given sequence, 0 if sequence precedes all of them
+inline size_t findSpillChunk(const std::vector<SpillIndexEntry> &entries, uint64_t sequence)
+{
+    auto it = std::upper_bound(entries.begin(), entries.end(), sequence,
+        [](uint64_t value, const SpillIndexEntry &entry) { return value < entry.firstSequence; });
+    return it == entries.begin() ? 0 : it - entries.begin() - 1;
+}
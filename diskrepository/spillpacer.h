@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Models the time a chunk write takes as overhead + size / bandwidth, where overhead covers
+// syscall and sync round-trip, and fits both to the latest writes by least squares with
+// exponential forgetting, so the model follows the device as it gets busier or idle.
+// From the model it tells the largest chunk that fits a latency budget and the size below
+// which a write is mostly overhead.
+class SpillPacer final
+{
+public:
+    // chunks are never planned smaller than this, whatever the model says
+    static constexpr size_t minChunkSize = 64 << 10;
+
+    void configure(uint64_t _latencyTarget, size_t _maxChunkSize) noexcept
+    {
+        latencyTarget = _latencyTarget;
+        maxChunkSize = std::max(_maxChunkSize, minChunkSize);
+    }
+
+    // a chunk of bytes took nanoseconds to write
+    void record(size_t bytes, uint64_t nanoseconds) noexcept
+    {
+        double x = static_cast<double>(bytes);
+        double y = static_cast<double>(nanoseconds);
+        weight = weight * decay + 1;
+        sumX = sumX * decay + x;
+        sumY = sumY * decay + y;
+        sumXX = sumXX * decay + x * x;
+        sumXY = sumXY * decay + x * y;
+
+        double meanX = sumX / weight;
+        double meanY = sumY / weight;
+        double varianceX = sumXX / weight - meanX * meanX;
+        double covariance = sumXY / weight - meanX * meanY;
+
+        // Sizes that hardly differ can't tell overhead from bandwidth apart, which happens
+        // once chunks settle at the planned size, so overhead found before is kept then
+        if (varianceX > meanX * meanX / 64 && covariance > 0)
+        {
+            nanosecondsPerByte = covariance / varianceX;
+            overheadNanoseconds = meanY - nanosecondsPerByte * meanX;
+        }
+        overheadNanoseconds = std::clamp(overheadNanoseconds, 0.0, meanY);
+        if (meanX > 0)
+        {
+            nanosecondsPerByte = (meanY - overheadNanoseconds) / meanX;
+        }
+        measured = meanX > 0;
+    }
+
+    // Largest chunk expected to be written within latency target: the whole ring until
+    // anything is measured, or when overhead alone exceeds target and splitting won't help
+    size_t chunkSize() const noexcept
+    {
+        if (!measured || nanosecondsPerByte <= 0 ||
+            overheadNanoseconds >= static_cast<double>(latencyTarget))
+        {
+            return maxChunkSize;
+        }
+
+        double size = (static_cast<double>(latencyTarget) - overheadNanoseconds) /
+                      nanosecondsPerByte;
+        return static_cast<size_t>(
+            std::clamp(size, double(minChunkSize), double(maxChunkSize)));
+    }
+
+    // true when writing bytes would take more overhead than transfer, so they are better
+    // written along with the next ones
+    bool coalesce(size_t bytes) const noexcept
+    {
+        return measured && bytes < chunkSize() &&
+               static_cast<double>(bytes) * nanosecondsPerByte < overheadNanoseconds;
+    }
+
+    uint64_t overhead() const noexcept
+    {
+        return static_cast<uint64_t>(overheadNanoseconds);
+    }
+
+    // bytes per second, 0 until measured
+    uint64_t bandwidth() const noexcept
+    {
+        return nanosecondsPerByte > 0 ? static_cast<uint64_t>(1e9 / nanosecondsPerByte) : 0;
+    }
+
+private:
+    // weight of a write halves in about 11 writes
+    static constexpr double decay = 0.94;
+
+    uint64_t latencyTarget{0};
+    size_t maxChunkSize{minChunkSize};
+
+    double weight{0};
+    double sumX{0};
+    double sumY{0};
+    double sumXX{0};
+    double sumXY{0};
+
+    bool measured{false};
+    double overheadNanoseconds{0};
+    double nanosecondsPerByte{0};
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "pagebuffer.h"
+#include "spillframe.h"
+
+// Loads spilled chunks ahead of refill() on a helper thread, so draining the backup file
+// doesn't stall on a synchronous read every time the ring runs empty. Owner tells which
+// chunks it expects to refill next with schedule() and gets them with take(), which is a
+// memcpy of decoded payload when the chunk is staged, waits when it is being loaded and
+// fails otherwise, so the owner falls back to reading it itself.
+// Chunks are identified by their end offset and trailer, so a staged chunk stays valid as
+// long as it is in the file: chunks are only ever removed from the end by refill().
+class SpillPrefetcher final
+{
+public:
+    struct Request
+    {
+        off_t frameEnd{0};
+        SpillFrameTrailer trailer;
+    };
+
+    // Called on helper thread to decode chunk into ptr (trailer.dataSize bytes) with its own
+    // scratch buffers, must only use thread-safe file operations like pread
+    using Loader = std::function<std::error_code(const Request &request, char *ptr,
+        PageBuffer &codecBuffer, PageBuffer &readBuffer)>;
+
+    SpillPrefetcher() noexcept = default;
+
+    SpillPrefetcher(const SpillPrefetcher &) = delete;
+    SpillPrefetcher &operator=(const SpillPrefetcher &) = delete;
+
+    ~SpillPrefetcher()
+    {
+        stop();
+    }
+
+    // staged chunks never take more than budget bytes of decoded payload
+    void configure(Loader _loader, size_t _budget)
+    {
+        stop();
+        loader = std::move(_loader);
+        budget = _budget;
+    }
+
+    // Replaces the list of chunks expected next, in refill order. Staged chunks which are
+    // not in it anymore are dropped.
+    void schedule(std::vector<Request> requests)
+    {
+        {
+            std::lock_guard lock(mutex);
+            for (auto it = chunks.begin(); it != chunks.end();)
+            {
+                bool wanted = std::any_of(requests.begin(), requests.end(),
+                    [&](const Request &request) { return matches(*it, request); });
+                if (!wanted && it->state != Chunk::Loading)
+                {
+                    release(it++);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            pending = std::move(requests);
+        }
+
+        if (!worker.joinable())
+        {
+            stopping = false;
+            worker = std::thread([this] { run(); });
+        }
+        wakeup.notify_all();
+    }
+
+    // copies decoded payload of given chunk into ptr and forgets it
+    bool take(const Request &request, char *ptr)
+    {
+        std::unique_lock lock(mutex);
+        auto it = std::find_if(chunks.begin(), chunks.end(),
+            [&](const Chunk &chunk) { return matches(chunk, request); });
+        if (it == chunks.end())
+        {
+            return false;
+        }
+
+        loaded.wait(lock, [&] { return it->state != Chunk::Loading; });
+        bool ok = it->state == Chunk::Ready;
+        if (ok)
+        {
+            std::copy_n(it->data.data(), it->request.trailer.dataSize, ptr);
+        }
+        release(it);
+        wakeup.notify_all();
+        return ok;
+    }
+
+    // waits for a chunk being loaded, then stops helper thread and drops all chunks
+    void stop()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+            pending.clear();
+        }
+        wakeup.notify_all();
+
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+
+        std::lock_guard lock(mutex);
+        while (!chunks.empty())
+        {
+            release(chunks.begin());
+        }
+    }
+
+private:
+    struct Chunk
+    {
+        enum State
+        {
+            Loading,
+            Ready,
+            Failed,
+        };
+
+        Request request;
+        State state{Loading};
+        PageBuffer data;
+    };
+
+    static bool matches(const Chunk &chunk, const Request &request) noexcept
+    {
+        return chunk.request.frameEnd == request.frameEnd &&
+               chunk.request.trailer.trailerCrc == request.trailer.trailerCrc;
+    }
+
+    // called with mutex held
+    void release(std::list<Chunk>::iterator it)
+    {
+        staged -= it->request.trailer.dataSize;
+        spare.push_back(std::move(it->data));
+        chunks.erase(it);
+    }
+
+    // next pending chunk which is neither staged nor over budget, nullptr if none
+    Chunk *next()
+    {
+        while (!pending.empty())
+        {
+            const Request &request = pending.front();
+            bool known = std::any_of(chunks.begin(), chunks.end(),
+                [&](const Chunk &chunk) { return matches(chunk, request); });
+            if (known)
+            {
+                pending.erase(pending.begin());
+                continue;
+            }
+
+            // chunks are consumed in order, so there is no point in skipping to smaller ones
+            if (staged + request.trailer.dataSize > budget)
+            {
+                return nullptr;
+            }
+
+            auto &chunk = chunks.emplace_back();
+            chunk.request = request;
+            if (!spare.empty())
+            {
+                chunk.data = std::move(spare.back());
+                spare.pop_back();
+            }
+            staged += request.trailer.dataSize;
+            pending.erase(pending.begin());
+            return &chunk;
+        }
+        return nullptr;
+    }
+
+    void run()
+    {
+        PageBuffer codecBuffer;
+        PageBuffer readBuffer;
+        std::unique_lock lock(mutex);
+
+        while (!stopping)
+        {
+            Chunk *chunk = next();
+            if (chunk == nullptr)
+            {
+                wakeup.wait(lock);
+                continue;
+            }
+
+            // chunk stays in list while loading, only take() and stop() may remove it and
+            // both wait for it first
+            lock.unlock();
+            bool ok = chunk->data.reserve(chunk->request.trailer.dataSize) &&
+                      !loader(chunk->request, chunk->data.data(), codecBuffer, readBuffer);
+            lock.lock();
+
+            chunk->state = ok ? Chunk::Ready : Chunk::Failed;
+            loaded.notify_all();
+        }
+    }
+
+    Loader loader;
+    size_t budget{0};
+
+    std::mutex mutex;
+    std::condition_variable wakeup; // new requests, freed budget or stop
+    std::condition_variable loaded;
+    std::vector<Request> pending;
+    std::list<Chunk> chunks;
+    std::vector<PageBuffer> spare;
+    size_t staged{0};
+    bool stopping{false};
+    std::thread worker;
+};
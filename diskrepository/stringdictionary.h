@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// LEB128: 7 bits per byte, low bits first, high bit set on all bytes but the last
+struct Varint
+{
+    static constexpr size_t maxSize = 10;
+
+    // ptr must fit maxSize bytes, returns bytes written
+    static size_t encode(uint64_t value, char *ptr) noexcept
+    {
+        size_t size{0};
+        while (value >= 0x80)
+        {
+            ptr[size++] = static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        ptr[size++] = static_cast<char>(value);
+        return size;
+    }
+
+    // reads value at ptr + offset, false if it isn't whole within size bytes
+    static bool decode(const char *ptr, size_t &offset, size_t size, uint64_t &value) noexcept
+    {
+        value = 0;
+        for (size_t shift = 0; shift < 64 && offset < size; shift += 7)
+        {
+            auto byte = static_cast<uint8_t>(ptr[offset++]);
+            value |= uint64_t(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Dictionary encoding of string fields. Every string starts with a varint tag, id << 2 | kind:
+//   reference   string defined before under id, nothing follows
+//   definition  string becomes entry id, varint length and bytes follow
+//   literal     string isn't kept (too long or dictionary full), varint length and bytes follow
+// Definitions carry their id, so encoder may start over at any time and reuse ids: decoder
+// sees a definition before any reference to it and overwrites whatever the id meant before.
+// Encoded string is never longer than [uint64_t length][bytes].
+struct StringDictionary
+{
+    enum Kind : uint8_t
+    {
+        Reference,
+        Definition,
+        Literal,
+    };
+
+    static constexpr size_t maxEntries = 1 << 19; // tag fits 3 bytes
+    static constexpr size_t maxEntrySize = 256;   // longer strings are always literals
+};
+
+class StringDictionaryEncoder final
+{
+public:
+    explicit StringDictionaryEncoder(size_t _capacity = 0) noexcept
+        : capacity(std::min(_capacity, StringDictionary::maxEntries))
+    {
+    }
+
+    // Starts a record, entries it defines are forgotten by rollback() if it can't be stored.
+    // A full dictionary starts over here, so a record never refers to a dropped entry.
+    void begin() noexcept
+    {
+        if (byId.size() == capacity)
+        {
+            reset();
+        }
+        committed = byId.size();
+    }
+
+    void rollback() noexcept
+    {
+        while (byId.size() > committed)
+        {
+            ids.erase(*byId.back());
+            byId.pop_back();
+        }
+    }
+
+    void reset() noexcept
+    {
+        ids.clear();
+        byId.clear();
+        committed = 0;
+    }
+
+    // put(const char *, size_t) stores encoded bytes and returns false when they don't fit
+    template<typename Put>
+    [[nodiscard]] bool encode(const std::string &value, Put &&put) noexcept
+    {
+        char header[2 * Varint::maxSize];
+        if (auto it = ids.find(value); it != ids.end())
+        {
+            uint64_t tag = uint64_t(it->second) << 2 | StringDictionary::Reference;
+            return put(header, Varint::encode(tag, header));
+        }
+
+        uint64_t tag = StringDictionary::Literal;
+        if (value.size() <= StringDictionary::maxEntrySize && byId.size() < capacity)
+        {
+            uint32_t id = byId.size();
+            byId.push_back(&ids.emplace(value, id).first->first);
+            tag = uint64_t(id) << 2 | StringDictionary::Definition;
+        }
+
+        size_t size = Varint::encode(tag, header);
+        size += Varint::encode(value.size(), header + size);
+        return put(header, size) && put(value.data(), value.size());
+    }
+
+private:
+    size_t capacity{0};
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<const std::string *> byId; // keys of ids in id order
+    size_t committed{0};                   // entries defined before the current record
+};
+
+class StringDictionaryDecoder final
+{
+public:
+    // Reads string at ptr + offset, false if it isn't whole within size bytes or refers to
+    // an unknown entry. value points into dictionary or payload, valid till the next call.
+    // Decoding a definition again, e.g. a record retried once more bytes are available, is
+    // harmless: it stores the same entry under the same id.
+    [[nodiscard]] bool decode(
+        const char *ptr, size_t &offset, size_t size, std::string_view &value) noexcept
+    {
+        size_t position = offset;
+        uint64_t tag{0};
+        if (!Varint::decode(ptr, position, size, tag))
+        {
+            return false;
+        }
+
+        uint64_t id = tag >> 2;
+        auto kind = static_cast<uint8_t>(tag & 3);
+        if (kind == StringDictionary::Reference)
+        {
+            if (id >= entries.size())
+            {
+                return false;
+            }
+            value = entries[id];
+            offset = position;
+            return true;
+        }
+
+        uint64_t length{0};
+        if (kind > StringDictionary::Literal || !Varint::decode(ptr, position, size, length) ||
+            size - position < length)
+        {
+            return false;
+        }
+
+        value = std::string_view(ptr + position, length);
+        if (kind == StringDictionary::Definition)
+        {
+            if (id >= StringDictionary::maxEntries)
+            {
+                return false;
+            }
+
+            if (id >= entries.size())
+            {
+                entries.resize(id + 1);
+            }
+            entries[id].assign(value);
+            value = entries[id];
+        }
+        offset = position + length;
+        return true;
+    }
+
+    void reset() noexcept
+    {
+        entries.clear();
+    }
+
+private:
+    std::vector<std::string> entries;
+};
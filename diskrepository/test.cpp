@@ -0,0 +1,1372 @@
+#include "crc32c.h"
+#include "diskrepository.h"
+#include "prioritydiskrepository.h"
+
+#include <elf.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Regression tests run by ctest, each returns whether it passed:
+//   diskrepository_test [directory for spill files]
+
+namespace
+{
+
+#define CHECK(condition)                                                                 \
+    do                                                                                   \
+    {                                                                                    \
+        if (!(condition))                                                                \
+        {                                                                                \
+            std::fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #condition);  \
+            return false;                                                                \
+        }                                                                                \
+    } while (0)
+
+std::filesystem::path directory;
+
+void removeFiles(const std::filesystem::path &path)
+{
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    std::filesystem::remove(path.string() + ".idx", ec);
+}
+
+// Ring filled to the last byte is snapshotted and drained completely, so readOffset is back
+// where the snapshot started: the snapshotted bytes are still pinned and must reach the file
+// as they were when it was taken, however pushes that follow race with it.
+bool snapshotOfDrainedFullRing()
+{
+    constexpr size_t capacity = 1 << 16;
+    const auto spillPath = directory / "diskrepository_test.spill";
+    const auto snapshotPath = directory / "diskrepository_test.snapshot";
+
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    removeFiles(spillPath);
+    DiskRepository<false, uint64_t> repository(spillPath, capacity, options);
+    CHECK(!repository.open());
+
+    // ring is a whole number of pages, 8 byte records fill it up exactly
+    uint64_t next{0};
+    uint64_t records{0};
+    for (int round = 0; round < 64; ++round)
+    {
+        const uint64_t first = next;
+        while (repository.push(next))
+        {
+            ++next;
+        }
+        CHECK(next - first == (round == 0 ? next : records));
+        records = next - first;
+
+        removeFiles(snapshotPath);
+        CHECK(!repository.snapshot(snapshotPath));
+        uint64_t value{0};
+        for (uint64_t i = 0; i < records; ++i)
+        {
+            CHECK(repository.pull(value) && value == first + i);
+        }
+
+        // only bytes the snapshot is done with may be reused
+        uint64_t pushed{0};
+        while (pushed < records && repository.push(next + pushed))
+        {
+            ++pushed;
+        }
+        CHECK(!repository.waitSnapshot());
+        for (uint64_t i = 0; i < pushed; ++i)
+        {
+            CHECK(repository.pull(value) && value == next + i);
+        }
+        next += pushed;
+
+        DiskRepository<true, uint64_t> copy(snapshotPath, capacity, options);
+        CHECK(!copy.open());
+        auto [ec, size] = copy.tellDataSize();
+        CHECK(!ec && size == records * sizeof(uint64_t));
+        CHECK(!copy.refill(size));
+        for (uint64_t i = 0; i < records; ++i)
+        {
+            CHECK(copy.pull(value) && value == first + i);
+        }
+        CHECK(!copy.pull(value));
+        CHECK(!copy.close());
+    }
+
+    CHECK(!repository.close());
+    removeFiles(snapshotPath);
+    removeFiles(spillPath);
+    return true;
+}
+
+// LZ codec gives back what it was given, shrinks repetitive input and rejects truncated
+// input; chunks spilled with it are stored compressed and refilled as they were
+bool lzCodecRoundTrip()
+{
+    std::string random(1 << 16, '\0');
+    uint32_t state{7};
+    for (auto &c : random)
+    {
+        state = state * 1103515245 + 12345;
+        c = static_cast<char>(state >> 16);
+    }
+
+    std::string repetitive;
+    while (repetitive.size() < (1 << 17))
+    {
+        repetitive += "tenant-0042/host-" + std::to_string(repetitive.size() % 97) + ";";
+    }
+
+    for (const std::string &input :
+        {std::string(), std::string("short"), random, repetitive, random + repetitive})
+    {
+        std::vector<char> compressed(lzSpillCodec.maxCompressedSize(input.size()));
+        size_t size =
+            lzSpillCodec.compress(input.data(), input.size(), compressed.data(), compressed.size());
+        CHECK(size != 0 || input.empty());
+
+        std::string output(input.size(), '\0');
+        CHECK(lzSpillCodec.decompress(compressed.data(), size, output.data(), output.size()));
+        CHECK(output == input);
+        if (!input.empty())
+        {
+            CHECK(!lzSpillCodec.decompress(compressed.data(), size - 1, output.data(),
+                output.size()));
+        }
+    }
+
+    std::vector<char> compressed(lzSpillCodec.maxCompressedSize(repetitive.size()));
+    CHECK(lzSpillCodec.compress(repetitive.data(), repetitive.size(), compressed.data(),
+              compressed.size()) < repetitive.size() / 4);
+    CHECK(SpillCodecRegistry::find(LzSpillCodec::codecId) == &lzSpillCodec);
+
+    const auto spillPath = directory / "diskrepository_test.spill";
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    options.spillCodec = &lzSpillCodec;
+    removeFiles(spillPath);
+    DiskRepository<true, uint64_t, std::string> repository(spillPath, 1 << 20, options);
+    CHECK(!repository.open());
+
+    const std::string value = "tenant-0042/host-0007/metric";
+    uint64_t records{0};
+    while (repository.push(records, value))
+    {
+        ++records;
+    }
+    size_t dataSize = repository.size();
+    CHECK(!repository.flush());
+    CHECK(std::filesystem::file_size(spillPath) < dataSize / 4);
+
+    auto [ec, size] = repository.tellDataSize();
+    CHECK(!ec && size == dataSize && !repository.refill(size));
+    uint64_t key{0};
+    std::string out;
+    for (uint64_t i = 0; i < records; ++i)
+    {
+        CHECK(repository.pull(key, out) && key == i && out == value);
+    }
+    CHECK(!repository.pull(key, out));
+
+    CHECK(!repository.close());
+    removeFiles(spillPath);
+    return true;
+}
+
+// Hardware and slicing-by-8 paths agree with each other and with the check value of CRC-32C,
+// whatever the length and alignment of data and however it is split into pieces
+bool crc32cPathsAgree()
+{
+    CHECK(Crc32c::compute(0, "123456789", 9) == 0xe3069283);
+    CHECK(Crc32c::computeSoftware(0, reinterpret_cast<const uint8_t *>("123456789"), 9) ==
+          0xe3069283);
+
+    std::vector<uint8_t> data(3 * 8192 * 2 + 100);
+    uint32_t state{1};
+    for (auto &byte : data)
+    {
+        state = state * 1103515245 + 12345;
+        byte = static_cast<uint8_t>(state >> 16);
+    }
+
+    for (size_t offset : {0, 1, 7})
+    {
+        for (size_t size : {0, 1, 8, 63, 256 * 3, 256 * 3 + 5, 8192 * 3, 8192 * 3 * 2 + 9})
+        {
+            const uint8_t *ptr = data.data() + offset;
+            uint32_t software = Crc32c::computeSoftware(0, ptr, size);
+            CHECK(Crc32c::computeHardware(0, ptr, size) == software);
+            CHECK(Crc32c::compute(Crc32c::compute(0, ptr, size / 3), ptr + size / 3,
+                      size - size / 3) == software);
+        }
+    }
+    return true;
+}
+
+void resizeFile(const std::filesystem::path &path, uintmax_t size, char fill)
+{
+    uintmax_t from = std::filesystem::file_size(path);
+    std::filesystem::resize_file(path, size);
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(from);
+    for (uintmax_t i = from; i < size; ++i)
+    {
+        file.put(fill);
+    }
+}
+
+// open() cuts a torn tail off behind the last intact chunk, or behind the header, and leaves
+// a file it doesn't recognise as it is
+bool recoveryCutsOnlyTornTail()
+{
+    const auto spillPath = directory / "diskrepository_test.spill";
+
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    removeFiles(spillPath);
+    {
+        DiskRepository<true, uint64_t> repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+        for (uint64_t chunk = 0; chunk < 3; ++chunk)
+        {
+            for (uint64_t i = 0; i < 10; ++i)
+            {
+                CHECK(repository.push(chunk * 10 + i));
+            }
+            CHECK(!repository.flush());
+        }
+        CHECK(!repository.close());
+    }
+
+    // half written chunk
+    const uintmax_t fileSize = std::filesystem::file_size(spillPath);
+    resizeFile(spillPath, fileSize + 100, 'x');
+    {
+        DiskRepository<true, uint64_t> repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+        CHECK(repository.recovery().frames == 3 && repository.recovery().records == 30);
+        CHECK(repository.recovery().truncatedSize == 100);
+        CHECK(std::filesystem::file_size(spillPath) == fileSize);
+        CHECK(!repository.close());
+    }
+
+    // last chunk with a payload that doesn't match its checksum
+    {
+        std::fstream file(spillPath, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(fileSize - sizeof(SpillFrameTrailer) - 1);
+        file.put('x');
+    }
+    {
+        DiskRepository<true, uint64_t> repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+        CHECK(repository.recovery().frames == 2 && repository.recovery().records == 20);
+        uint64_t value{0};
+        auto [ec, size] = repository.tellDataSize();
+        CHECK(!ec && !repository.refill(size));
+        for (uint64_t i = 10; i < 20; ++i)
+        {
+            CHECK(repository.pull(value) && value == i);
+        }
+        CHECK(!repository.close());
+    }
+
+    // header torn while file was created
+    std::filesystem::resize_file(spillPath, 10);
+    {
+        DiskRepository<true, uint64_t> repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+        CHECK(std::filesystem::file_size(spillPath) == sizeof(SpillFileHeader));
+        CHECK(!repository.close());
+    }
+
+    // [bytes][size_t] chunks of a file written before chunks had trailers, a short file
+    for (uintmax_t size : {178, 10})
+    {
+        removeFiles(spillPath);
+        {
+            std::ofstream file(spillPath, std::ios::binary);
+        }
+        resizeFile(spillPath, size, 'y');
+        DiskRepository<true, uint64_t> repository(spillPath, 1 << 16, options);
+        CHECK(repository.open() == std::errc::bad_message);
+        CHECK(std::filesystem::file_size(spillPath) == size);
+    }
+
+    removeFiles(spillPath);
+    return true;
+}
+
+// Ring backed by a file comes back as of its last checkpoint after a restart, records that
+// wrapped around its end included: ones pulled since are delivered again, ones pushed since
+// are gone. close() checkpoints.
+bool persistentRingRestoresCheckpoint()
+{
+    const auto ringPath = directory / "diskrepository_test.ring";
+    std::filesystem::remove(ringPath);
+
+    DiskRepositoryOptions options;
+    options.ringFilename = ringPath;
+    constexpr size_t capacity = 1 << 16;
+
+    // repository left without close() stands for a process that died
+    uint64_t records{0};
+    uint64_t value{0};
+    {
+        DiskRepository<false, uint64_t> crashed("", capacity, options);
+        CHECK(!crashed.open());
+        while (crashed.push(records))
+        {
+            ++records;
+        }
+        for (uint64_t i = 0; i < records / 2; ++i)
+        {
+            CHECK(crashed.pull(value) && value == i);
+        }
+        CHECK(!crashed.push(records));
+        CHECK(!crashed.checkpoint());
+        for (uint64_t i = records; i < records + records / 2; ++i)
+        {
+            CHECK(crashed.push(i));
+        }
+        CHECK(!crashed.checkpoint());
+
+        // ring is full as of the checkpoint, the pulled record's bytes stay
+        CHECK(crashed.pull(value) && value == records / 2);
+        CHECK(!crashed.push(records + records / 2));
+    }
+
+    {
+        DiskRepository<false, uint64_t> repository("", capacity, options);
+        CHECK(!repository.open());
+        for (uint64_t i = records / 2; i < records + records / 2; ++i)
+        {
+            CHECK(repository.pull(value) && value == i);
+            if (i == records)
+            {
+                CHECK(!repository.close());
+                CHECK(!repository.open());
+            }
+        }
+        CHECK(!repository.pull(value));
+        CHECK(!repository.close());
+    }
+
+    DiskRepository<false, uint64_t> resized("", capacity * 2, options);
+    CHECK(resized.open() == std::errc::invalid_argument);
+
+    std::filesystem::remove(ringPath);
+    return true;
+}
+
+// Spilled records are numbered, replay() starts from any number; numbers of chunks refilled
+// and cut off the file aren't given out again, reopened or not
+bool sequenceNumbersSurviveRefillAndReopen()
+{
+    const auto spillPath = directory / "diskrepository_test.spill";
+
+    for (bool directSpill : {false, true})
+    {
+        DiskRepositoryOptions options;
+        options.syncSpill = false;
+        options.directSpill = directSpill;
+        removeFiles(spillPath);
+        {
+            DiskRepository<true, uint64_t> repository(spillPath, 1 << 16, options);
+            CHECK(!repository.open());
+            for (uint64_t chunk = 0; chunk < 2; ++chunk)
+            {
+                for (uint64_t i = 0; i < 10; ++i)
+                {
+                    CHECK(repository.push(100 + chunk * 10 + i));
+                }
+                CHECK(!repository.flush());
+            }
+            CHECK(repository.nextSequence() == 20);
+
+            std::vector<std::pair<uint64_t, uint64_t>> replayed;
+            CHECK(!repository.replay(5, [&](uint64_t sequence, uint64_t value) {
+                replayed.emplace_back(sequence, value);
+                return true;
+            }));
+            CHECK(replayed.size() == 15);
+            for (uint64_t i = 0; i < replayed.size(); ++i)
+            {
+                CHECK(replayed[i].first == 5 + i && replayed[i].second == 105 + i);
+            }
+
+            auto [ec, size] = repository.tellDataSize();
+            CHECK(!ec && !repository.refill(size));
+            CHECK(repository.nextSequence() == 20);
+            CHECK(!repository.close());
+        }
+
+        DiskRepository<true, uint64_t> repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+        CHECK(repository.recovery().records == 10);
+        CHECK(repository.nextSequence() == 20);
+        CHECK(repository.push(200) && !repository.flush());
+
+        std::vector<uint64_t> sequences;
+        CHECK(!repository.replay(0, [&](uint64_t sequence, uint64_t) {
+            sequences.push_back(sequence);
+            return true;
+        }));
+        CHECK(sequences.size() == 11 && sequences[9] == 9 && sequences[10] == 20);
+        CHECK(!repository.close());
+    }
+
+    removeFiles(spillPath);
+    return true;
+}
+
+// Instrumented repository counts records and bytes both ways, failed pushes, flushes with
+// the bytes they wrote and refills; histograms bound every value within one bucket
+bool statsCountTraffic()
+{
+    const auto spillPath = directory / "diskrepository_test.spill";
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    removeFiles(spillPath);
+    InstrumentedDiskRepository<true, uint64_t> repository(spillPath, 1 << 16, options);
+    CHECK(!repository.open());
+
+    uint64_t pushed{0};
+    while (repository.push(pushed))
+    {
+        ++pushed;
+    }
+    auto stats = repository.stats().snapshot();
+    CHECK(stats.recordsPushed == pushed && stats.failedPushes == 1);
+    CHECK(stats.bytesPushed >= pushed * sizeof(uint64_t));
+    CHECK(stats.bufferSizeHighWater == stats.bytesPushed);
+
+    CHECK(!repository.flush());
+    stats = repository.stats().snapshot();
+    CHECK(stats.flushes == 1 && stats.flushDuration.count == 1);
+    CHECK(stats.bytesSpilled + sizeof(SpillFileHeader) == std::filesystem::file_size(spillPath));
+
+    auto [ec, size] = repository.tellDataSize();
+    CHECK(!ec && !repository.refill(size));
+    uint64_t value{0};
+    for (uint64_t i = 0; i < pushed; ++i)
+    {
+        CHECK(repository.pull(value) && value == i);
+    }
+    stats = repository.stats().snapshot();
+    CHECK(stats.refills == 1 && stats.refillDuration.count == 1);
+    CHECK(stats.recordsPulled == pushed && stats.bytesPulled == stats.bytesPushed);
+    // refilled records have no push time
+    CHECK(stats.residency.count == 0);
+
+    CHECK(repository.push(pushed) && repository.pull(value) && value == pushed);
+    CHECK(repository.stats().snapshot().residency.count == 1);
+
+    LatencyHistogram histogram;
+    for (uint64_t sample : {0ull, 7ull, 8ull, 1000ull, 123456789ull, ~0ull})
+    {
+        size_t index = LatencyHistogram::indexOf(sample);
+        CHECK(index < LatencyHistogram::buckets);
+        CHECK(LatencyHistogram::upperBound(index) >= sample);
+        CHECK(index == 0 || LatencyHistogram::upperBound(index - 1) < sample);
+        histogram.record(sample);
+    }
+    auto snapshot = histogram.snapshot();
+    CHECK(snapshot.count == 6 && snapshot.max == ~0ull);
+    CHECK(snapshot.percentile(0) == 0 && snapshot.percentile(1) == ~0ull);
+    CHECK(snapshot.percentile(0.5) >= 8 && snapshot.percentile(0.5) < 10);
+
+    CHECK(!repository.close());
+    removeFiles(spillPath);
+    return true;
+}
+
+// Build with probes carries a .note.stapsdt entry of provider diskrepository for each probe
+// the tracers attach to, build without them carries none
+bool probesAreListedInNotes()
+{
+    std::ifstream file("/proc/self/exe", std::ios::binary);
+    std::string image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    CHECK(image.size() >= sizeof(Elf64_Ehdr) && image.compare(0, SELFMAG, ELFMAG) == 0);
+
+    Elf64_Ehdr elfHeader;
+    std::memcpy(&elfHeader, image.data(), sizeof(elfHeader));
+    CHECK(elfHeader.e_ident[EI_CLASS] == ELFCLASS64);
+    CHECK(elfHeader.e_shoff + elfHeader.e_shnum * sizeof(Elf64_Shdr) <= image.size());
+    std::vector<Elf64_Shdr> sections(elfHeader.e_shnum);
+    std::memcpy(sections.data(), image.data() + elfHeader.e_shoff,
+        sections.size() * sizeof(Elf64_Shdr));
+    const char *names = image.data() + sections.at(elfHeader.e_shstrndx).sh_offset;
+
+    std::vector<std::string> probes;
+    for (const Elf64_Shdr &section : sections)
+    {
+        if (std::string_view(names + section.sh_name) != ".note.stapsdt")
+        {
+            continue;
+        }
+
+        // note header, "stapsdt" owner, then pc, base and semaphore addresses followed by
+        // provider, probe name and argument strings
+        for (size_t offset = 0; offset + sizeof(Elf64_Nhdr) <= section.sh_size;)
+        {
+            Elf64_Nhdr note;
+            const char *entry = image.data() + section.sh_offset + offset;
+            std::memcpy(&note, entry, sizeof(note));
+            const char *owner = entry + sizeof(note);
+            const char *description = owner + ((note.n_namesz + 3) & ~3u);
+            CHECK(note.n_type == 3 && std::string_view(owner) == "stapsdt");
+
+            std::string_view provider(description + 3 * sizeof(uint64_t));
+            if (provider == "diskrepository")
+            {
+                probes.emplace_back(provider.data() + provider.size() + 1);
+            }
+            offset += sizeof(note) + ((note.n_namesz + 3) & ~3u) + ((note.n_descsz + 3) & ~3u);
+        }
+    }
+
+#ifdef DISKREPOSITORY_PROBE_ASM
+    for (const char *name : {"push_full", "pull_empty", "flush_begin", "flush_end",
+             "refill_begin", "refill_end", "snapshot_begin", "snapshot_end", "buffer_grow"})
+    {
+        CHECK(std::find(probes.begin(), probes.end(), name) != probes.end());
+    }
+#else
+    CHECK(probes.empty());
+#endif
+    return true;
+}
+
+// Direct spill pads every frame to a whole block, the file included, and gets chunks of any
+// size back as they were, ring ones and single records, before and after a reopen
+bool directSpillKeepsBlocksWhole()
+{
+    using Repository = DiskRepository<true, uint64_t, std::string>;
+    const auto spillPath = directory / "diskrepository_test.spill";
+
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    options.directSpill = true;
+    removeFiles(spillPath);
+    auto text = [](uint64_t i) { return std::string(i % 37, char('a' + i % 26)); };
+
+    const std::vector<uint64_t> chunks{1, 3, 700};
+    {
+        Repository repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+        uint64_t next{0};
+        for (uint64_t records : chunks)
+        {
+            for (uint64_t i = 0; i < records; ++i, ++next)
+            {
+                CHECK(repository.push(next, text(next)));
+            }
+            CHECK(!repository.flush());
+        }
+        CHECK(!repository.flush(next, text(next)));
+        CHECK(!repository.close());
+    }
+
+    struct stat st;
+    CHECK(::stat(spillPath.c_str(), &st) == 0);
+    const size_t blockSize = std::clamp<size_t>(st.st_blksize, 512, 1 << 15);
+    CHECK(st.st_size % blockSize == 0 && size_t(st.st_size) >= 4 * blockSize);
+
+    Repository repository(spillPath, 1 << 16, options);
+    CHECK(!repository.open());
+    CHECK(repository.recovery().frames == 4 && repository.recovery().records == 705);
+
+    uint64_t value{0};
+    std::string string;
+    auto [ec, size] = repository.tellDataSize();
+    CHECK(!ec && !repository.refill(size, value, string));
+    CHECK(value == 704 && string == text(704));
+
+    uint64_t next{704};
+    for (auto records = chunks.rbegin(); records != chunks.rend(); ++records)
+    {
+        next -= *records;
+        std::tie(ec, size) = repository.tellDataSize();
+        CHECK(!ec && !repository.refill(size));
+        for (uint64_t i = 0; i < *records; ++i)
+        {
+            CHECK(repository.pull(value, string) && value == next + i && string == text(value));
+        }
+    }
+    CHECK(!repository.pull(value, string));
+    CHECK(!repository.close());
+    CHECK(std::filesystem::file_size(spillPath) == sizeof(SpillFileHeader));
+    removeFiles(spillPath);
+    return true;
+}
+
+// Prefetcher stages scheduled chunks in order within its budget and hands each out once;
+// a repository prefetching compressed chunks refills all of them as they were
+bool prefetchStagesChunksInOrder()
+{
+    std::atomic<int> calls{0};
+    SpillPrefetcher prefetcher;
+    prefetcher.configure(
+        [&](const SpillPrefetcher::Request &request, char *ptr, PageBuffer &, PageBuffer &) {
+            std::fill_n(ptr, request.trailer.dataSize, char(request.frameEnd));
+            ++calls;
+            return request.frameEnd == 99 ? std::make_error_code(std::errc::io_error)
+                                          : std::error_code();
+        },
+        250);
+    auto request = [](off_t frameEnd) {
+        SpillPrefetcher::Request result{frameEnd, {}};
+        result.trailer.dataSize = 100;
+        return result;
+    };
+
+    std::string data(100, 0);
+    prefetcher.schedule({request(1), request(2), request(3)});
+    while (calls < 2)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(prefetcher.take(request(1), data.data()) && data == std::string(100, 1));
+    CHECK(!prefetcher.take(request(1), data.data()));
+    // taking the first one made room for the third
+    while (calls < 3)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(prefetcher.take(request(3), data.data()) && data == std::string(100, 3));
+    CHECK(prefetcher.take(request(2), data.data()) && data == std::string(100, 2));
+
+    prefetcher.schedule({request(99)});
+    while (calls < 4)
+    {
+        std::this_thread::yield();
+    }
+    CHECK(!prefetcher.take(request(99), data.data()));
+    prefetcher.stop();
+
+    const auto spillPath = directory / "diskrepository_test.spill";
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    options.spillCodec = &lzSpillCodec;
+    options.prefetchDepth = 2;
+    options.prefetchBudget = 4 << 10;
+    removeFiles(spillPath);
+    DiskRepository<true, uint64_t> repository(spillPath, 1 << 16, options);
+    CHECK(!repository.open());
+    for (uint64_t chunk = 0; chunk < 8; ++chunk)
+    {
+        for (uint64_t i = 0; i < 100 * (chunk + 1); ++i)
+        {
+            CHECK(repository.push(chunk << 32 | i));
+        }
+        CHECK(!repository.flush());
+    }
+
+    CHECK(!repository.prefetch());
+    uint64_t value{0};
+    for (uint64_t chunk = 8; chunk-- > 0;)
+    {
+        auto [ec, size] = repository.tellDataSize();
+        CHECK(!ec && !repository.refill(size));
+        for (uint64_t i = 0; i < 100 * (chunk + 1); ++i)
+        {
+            CHECK(repository.pull(value) && value == (chunk << 32 | i));
+        }
+    }
+    CHECK(!repository.pull(value));
+    CHECK(!repository.close());
+    removeFiles(spillPath);
+    return true;
+}
+
+// Chunks written by flushSorted() are ordered by key, equal keys in push order, and
+// mergeSorted() visits records of all of them in key order, stored as is, compressed or
+// dictionary encoded; it stops when asked to and refuses chunks written by flush()
+bool mergeSortedVisitsAllChunksInOrder()
+{
+    using Repository = DiskRepository<true, uint32_t, std::string>;
+    using Record = std::pair<uint32_t, std::string>;
+    const auto spillPath = directory / "diskrepository_test.spill";
+    auto key = [](uint32_t key, const std::string &) { return key; };
+
+    for (int variant = 0; variant < 3; ++variant)
+    {
+        DiskRepositoryOptions options;
+        options.syncSpill = false;
+        options.spillCodec = variant == 1 ? &lzSpillCodec : nullptr;
+        options.stringDictionary = variant == 2 ? 64 : 0;
+        removeFiles(spillPath);
+        Repository repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+
+        std::vector<Record> pushed;
+        uint32_t seed{1};
+        for (int chunk = 0; chunk < 4; ++chunk)
+        {
+            for (int i = 0; i < 500; ++i)
+            {
+                seed = seed * 1103515245 + 12345;
+                pushed.emplace_back(seed % 300, "value" + std::to_string(seed % 7));
+                pushed.back().second += ' ' + std::to_string(pushed.size());
+                CHECK(repository.push(pushed.back().first, pushed.back().second));
+            }
+            CHECK(!repository.flushSorted(key));
+        }
+
+        std::vector<Record> merged;
+        CHECK(!repository.mergeSorted(key, [&](uint32_t key, const std::string &value) {
+            merged.emplace_back(key, value);
+            return true;
+        }));
+        CHECK(merged.size() == pushed.size());
+        CHECK(std::is_sorted(merged.begin(), merged.end(),
+            [](const Record &a, const Record &b) { return a.first < b.first; }));
+        std::vector<Record> expected = pushed;
+        std::sort(expected.begin(), expected.end());
+        std::sort(merged.begin(), merged.end());
+        CHECK(merged == expected);
+
+        size_t visited{0};
+        CHECK(!repository.mergeSorted(key, [&](uint32_t, const std::string &) {
+            return ++visited < 10;
+        }));
+        CHECK(visited == 10);
+
+        // last chunk comes back sorted, records with equal keys as they were pushed
+        auto [ec, size] = repository.tellDataSize();
+        CHECK(!ec && !repository.refill(size));
+        expected.assign(pushed.end() - 500, pushed.end());
+        std::stable_sort(expected.begin(), expected.end(),
+            [](const Record &a, const Record &b) { return a.first < b.first; });
+        Record record;
+        for (const Record &next : expected)
+        {
+            CHECK(repository.pull(record.first, record.second) && record == next);
+        }
+
+        CHECK(repository.push(0, "unsorted") && !repository.flush());
+        CHECK(repository.mergeSorted(key, [](uint32_t, const std::string &) {
+            return true;
+        }) == std::errc::invalid_argument);
+        CHECK(!repository.close());
+    }
+
+    removeFiles(spillPath);
+    return true;
+}
+
+// Records of a variant repository come back as the alternative they were pushed as, with
+// pull() or pullVisit(), from ring or from a refilled chunk, dictionary encoded or not
+bool variantRecordsKeepAlternative()
+{
+    using Record = std::variant<uint32_t, std::string, std::tuple<int16_t, std::string>>;
+    const auto spillPath = directory / "diskrepository_test.spill";
+    auto make = [](uint32_t i) -> Record {
+        switch (i % 3)
+        {
+        case 0:
+            return i;
+        case 1:
+            return "string " + std::to_string(i % 5);
+        default:
+            return std::make_tuple(int16_t(-int(i)), std::string(i % 11, 'x'));
+        }
+    };
+
+    for (size_t stringDictionary : {0, 16})
+    {
+        DiskRepositoryOptions options;
+        options.syncSpill = false;
+        options.stringDictionary = stringDictionary;
+        removeFiles(spillPath);
+        DiskRepository<true, Record> repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+
+        for (uint32_t i = 0; i < 300; ++i)
+        {
+            CHECK(repository.push(make(i)));
+        }
+        Record record;
+        for (uint32_t i = 0; i < 100; ++i)
+        {
+            CHECK(repository.pull(record) && record == make(i));
+        }
+
+        CHECK(!repository.flush());
+        auto [ec, size] = repository.tellDataSize();
+        CHECK(!ec && !repository.refill(size));
+        for (uint32_t i = 100; i < 300; ++i)
+        {
+            bool same{false};
+            CHECK(repository.pullVisit([&](const auto &alternative) {
+                same = Record(alternative) == make(i);
+            }));
+            CHECK(same);
+        }
+        CHECK(!repository.pullVisit([](const auto &) {}));
+        CHECK(!repository.close());
+    }
+
+    removeFiles(spillPath);
+    return true;
+}
+
+// Dictionary encoding shrinks repetitive strings in ring and on disk and keeps every string
+// as it was: repeated, too long to keep or pushed after the dictionary filled up; each chunk
+// decodes on its own, so any of them can be refilled or replayed
+bool stringDictionaryRoundTrip()
+{
+    using Repository = DiskRepository<true, uint32_t, std::string>;
+    const auto spillPath = directory / "diskrepository_test.spill";
+    const std::string names[] = {"alpha", "beta", "gamma"};
+    auto text = [&](uint32_t i) {
+        if (i % 50 == 49)
+        {
+            return std::string(300, 'z');
+        }
+        return i % 10 == 9 ? "distinct " + std::to_string(i) : names[i % 3];
+    };
+
+    size_t fileSizes[2]{};
+    for (size_t stringDictionary : {0, 8})
+    {
+        DiskRepositoryOptions options;
+        options.syncSpill = false;
+        options.stringDictionary = stringDictionary;
+        removeFiles(spillPath);
+        Repository repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+
+        uint32_t value{0};
+        std::string string;
+        for (uint32_t chunk = 0; chunk < 3; ++chunk)
+        {
+            for (uint32_t i = chunk * 100; i < chunk * 100 + 100; ++i)
+            {
+                CHECK(repository.push(i, text(i)));
+            }
+            CHECK(repository.pull(value, string) && value == chunk * 100);
+            CHECK(string == text(value));
+            CHECK(!repository.flush());
+        }
+        fileSizes[stringDictionary != 0] = std::filesystem::file_size(spillPath);
+
+        uint32_t replayed{0};
+        // pulled records aren't spilled, sequence n is value n + 1 + n / 99
+        auto visitor = [&](uint64_t sequence, uint32_t value, const std::string &string) {
+            replayed += sequence == 150 + replayed && value == sequence + 1 + sequence / 99 &&
+                        string == text(value);
+            return true;
+        };
+        CHECK(!repository.replay(150, visitor));
+        CHECK(replayed == 147);
+
+        auto [ec, size] = repository.tellDataSize();
+        CHECK(!ec && !repository.refill(size));
+        for (uint32_t i = 201; i < 300; ++i)
+        {
+            CHECK(repository.pull(value, string) && value == i && string == text(i));
+        }
+        CHECK(!repository.close());
+    }
+    CHECK(fileSizes[1] < fileSizes[0] * 2 / 3);
+
+    removeFiles(spillPath);
+    return true;
+}
+
+// Backup file is little-endian whatever the host: header with the fingerprint of the schema
+// as documented, records in fixed width; a repository of another schema refuses the file.
+// Byte swaps of arrays agree with swapping value by value at any length and alignment.
+bool spillFileIsLittleEndian()
+{
+    const auto spillPath = directory / "diskrepository_test.spill";
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    removeFiles(spillPath);
+    {
+        DiskRepository<true, uint32_t, std::string> repository(spillPath, 1 << 16, options);
+        CHECK(!repository.open());
+        CHECK(repository.push(0x01020304, "ab") && !repository.flush());
+        CHECK(!repository.close());
+    }
+
+    std::ifstream file(spillPath, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto little = [&](size_t offset, size_t size) {
+        uint64_t value{0};
+        for (size_t i = size; i-- > 0;)
+        {
+            value = value << 8 | uint8_t(bytes.at(offset + i));
+        }
+        return value;
+    };
+    CHECK(bytes.compare(0, 4, "DSPL") == 0);
+    CHECK(little(4, 2) == SpillFileHeader::currentVersion);
+    CHECK(little(6, 2) == sizeof(SpillFileHeader));
+    CHECK(little(8, 8) == SpillSchema::fingerprint("u4,s"));
+    // uint32_t, then uint64_t length and bytes of the string
+    CHECK(little(32, 4) == 0x01020304 && little(36, 8) == 2);
+    CHECK(bytes.compare(44, 2, "ab") == 0);
+
+    DiskRepository<true, uint64_t, std::string> other(spillPath, 1 << 16, options);
+    CHECK(other.open() == std::errc::invalid_argument);
+
+    std::vector<char> data(8 * 100 + 1);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = char(i * 7 + 1);
+    }
+    auto check = [&](size_t size, size_t offset, size_t count) {
+        std::vector<char> swapped(data);
+        std::vector<char> expected(data);
+        char *ptr = swapped.data() + offset;
+        if (size == 2)
+        {
+            ByteOrder::swapArray<2>(ptr, count);
+        }
+        else if (size == 4)
+        {
+            ByteOrder::swapArray<4>(ptr, count);
+        }
+        else
+        {
+            ByteOrder::swapArray<8>(ptr, count);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto value = expected.begin() + offset + i * size;
+            std::reverse(value, value + size);
+        }
+        return swapped == expected;
+    };
+    for (size_t count : {0, 1, 3, 15, 16, 17, 33, 100})
+    {
+        for (size_t offset : {0, 1})
+        {
+            CHECK(check(2, offset, count) && check(4, offset, count) && check(8, offset, count));
+        }
+    }
+
+    removeFiles(spillPath);
+    return true;
+}
+
+// Pacer fits overhead and bandwidth to the writes it is shown and plans chunks that fit the
+// target; a repository spilling with a target writes records in as many chunks as stats say
+// and gets all of them back, a flush left in ring included
+bool pacedSpillSplitsChunks()
+{
+    SpillPacer pacer;
+    pacer.configure(1000000, 16 << 20);
+    CHECK(pacer.chunkSize() == 16 << 20 && !pacer.coalesce(1));
+    // 100us per write and 1ns per byte
+    for (size_t bytes : {100000, 400000, 200000, 800000, 300000, 600000})
+    {
+        pacer.record(bytes, 100000 + bytes);
+    }
+    CHECK(pacer.overhead() > 99000 && pacer.overhead() < 101000);
+    CHECK(pacer.bandwidth() > 990000000 && pacer.bandwidth() < 1010000000);
+    CHECK(pacer.chunkSize() > 890000 && pacer.chunkSize() < 910000);
+    CHECK(pacer.coalesce(10000) && !pacer.coalesce(200000));
+    // overhead alone misses target, splitting won't help
+    pacer.configure(50000, 16 << 20);
+    CHECK(pacer.chunkSize() == 16 << 20);
+
+    const auto spillPath = directory / "diskrepository_test.spill";
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    options.spillLatencyTarget = 100000;
+    options.coalesceSpill = true;
+    removeFiles(spillPath);
+    InstrumentedDiskRepository<true, uint64_t> repository(spillPath, 4 << 20, options);
+    CHECK(!repository.open());
+
+    uint64_t next{0};
+    for (int round = 0; round < 8; ++round)
+    {
+        while (repository.push(next))
+        {
+            ++next;
+        }
+        CHECK(!repository.flush());
+    }
+    auto stats = repository.stats().snapshot();
+    CHECK(stats.flushes == 8 && stats.spillChunkSize >= SpillPacer::minChunkSize);
+    CHECK(stats.splitFlushes != 0 || stats.spillChunkSize >= 4 << 20);
+
+    // a single record is mostly overhead, it stays in ring if the model says so
+    CHECK(repository.push(next) && !repository.flush());
+    stats = repository.stats().snapshot();
+    bool coalesced = stats.coalescedFlushes == 1;
+    uint64_t value{0};
+    CHECK(repository.pull(value) == coalesced && (!coalesced || value == next));
+    next += !coalesced;
+
+    // chunks come back last first, records of each in order
+    std::vector<bool> seen(next);
+    size_t frames{0};
+    for (auto [ec, size] = repository.tellDataSize(); size != 0;
+         std::tie(ec, size) = repository.tellDataSize())
+    {
+        CHECK(!ec && !repository.refill(size) && repository.pull(value) && value < next);
+        ++frames;
+        seen[value] = true;
+        for (uint64_t previous = value; repository.pull(value); previous = value)
+        {
+            CHECK(value == previous + 1 && !seen[value]);
+            seen[value] = true;
+        }
+    }
+    CHECK(std::find(seen.begin(), seen.end(), false) == seen.end());
+    CHECK(frames == stats.flushes - stats.splitFlushes + stats.splitChunks);
+    CHECK(!repository.close());
+    removeFiles(spillPath);
+    return true;
+}
+
+// Under memory pressure push() spills ring content once it reaches pressureSpillSize and
+// free ring pages are punched out of the file behind the ring; records in ring, and ones
+// pulled since the last checkpoint of a persistent ring, are kept as they were
+bool memoryPressureReleasesFreeRing()
+{
+    const auto spillPath = directory / "diskrepository_test.spill";
+    const auto ringPath = directory / "diskrepository_test.ring";
+    constexpr size_t capacity = 1 << 20;
+    ManualMemoryPressure pressure;
+
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    options.memoryPressure = &pressure;
+    options.pressureSpillSize = 1 << 16;
+    removeFiles(spillPath);
+    {
+        InstrumentedDiskRepository<true, uint64_t> repository(spillPath, capacity, options);
+        CHECK(!repository.open());
+
+        // pressure is only looked at every so many pushes
+        uint64_t next{0};
+        for (; next < 1000; ++next)
+        {
+            CHECK(repository.push(next));
+        }
+        pressure.set(true);
+        for (; next < 4000; ++next)
+        {
+            CHECK(repository.push(next));
+        }
+        auto stats = repository.stats().snapshot();
+        CHECK(stats.pressureReliefs != 0 && stats.bytesReleased > capacity / 2);
+        CHECK(stats.flushes == 0);
+
+        while (repository.stats().snapshot().flushes == 0)
+        {
+            CHECK(repository.push(next++));
+        }
+        auto [ec, size] = repository.tellDataSize();
+        CHECK(!ec && size >= options.pressureSpillSize);
+        pressure.set(false);
+
+        uint64_t value{0};
+        uint64_t spilled = size / sizeof(uint64_t);
+        for (uint64_t i = spilled; i < next; ++i)
+        {
+            CHECK(repository.pull(value) && value == i);
+        }
+        CHECK(!repository.refill(size));
+        for (uint64_t i = 0; i < spilled; ++i)
+        {
+            CHECK(repository.pull(value) && value == i);
+        }
+        CHECK(!repository.close());
+    }
+    removeFiles(spillPath);
+
+    DiskRepositoryOptions ringOptions;
+    ringOptions.ringFilename = ringPath;
+    std::filesystem::remove(ringPath);
+    auto allocated = [&] {
+        struct stat st;
+        return ::stat(ringPath.c_str(), &st) == 0 ? size_t(st.st_blocks) * 512 : 0;
+    };
+    uint64_t records{0};
+    uint64_t value{0};
+    {
+        // left without close(), see persistentRingRestoresCheckpoint()
+        DiskRepository<false, uint64_t> crashed("", capacity, ringOptions);
+        CHECK(!crashed.open());
+        while (crashed.push(records))
+        {
+            ++records;
+        }
+        CHECK(!crashed.checkpoint());
+        CHECK(allocated() >= capacity);
+        for (uint64_t i = 0; i < records; ++i)
+        {
+            CHECK(crashed.pull(value) && value == i);
+        }
+        CHECK(!crashed.relieveMemoryPressure() && allocated() >= capacity);
+        CHECK(!crashed.checkpoint() && !crashed.relieveMemoryPressure());
+        CHECK(allocated() < capacity / 2);
+        for (uint64_t i = 0; i < records / 2; ++i)
+        {
+            CHECK(crashed.push(i));
+        }
+        CHECK(!crashed.checkpoint());
+        CHECK(crashed.pull(value) && value == 0 && !crashed.relieveMemoryPressure());
+    }
+
+    DiskRepository<false, uint64_t> repository("", capacity, ringOptions);
+    CHECK(!repository.open());
+    for (uint64_t i = 0; i < records / 2; ++i)
+    {
+        CHECK(repository.pull(value) && value == i);
+    }
+    CHECK(!repository.pull(value) && !repository.close());
+    std::filesystem::remove(ringPath);
+    return true;
+}
+
+// columns hold strings in full, so chunks of a ring encoded with a dictionary may not fit it
+bool columnarSpillWithDictionaryRejected()
+{
+    const auto spillPath = directory / "diskrepository_test.spill";
+
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    options.columnarSpill = true;
+    options.stringDictionary = 16;
+    removeFiles(spillPath);
+    DiskRepository<true, uint32_t, std::string> repository(spillPath, 1 << 16, options);
+    CHECK(repository.open() == std::errc::invalid_argument);
+    removeFiles(spillPath);
+    return true;
+}
+
+// Records refilled from disk have no push time, pushed ones do: both keep theirs when
+// transferIf() moves them to another ring or rotates them to the back of their own
+bool transferredRecordsKeepPushTimes()
+{
+    using Repository = BasicDiskRepository<true, RepositoryStats, uint64_t>;
+    const auto spillPath = directory / "diskrepository_test.spill";
+    const auto otherPath = directory / "diskrepository_test.other.spill";
+
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    removeFiles(spillPath);
+    removeFiles(otherPath);
+    Repository repository(spillPath, 1 << 16, options);
+    Repository other(otherPath, 1 << 16, options);
+    CHECK(!repository.open());
+    CHECK(!other.open());
+
+    for (uint64_t i = 0; i < 8; ++i)
+    {
+        CHECK(repository.push(i));
+    }
+    CHECK(!repository.flush());
+    auto [ec, size] = repository.tellDataSize();
+    CHECK(!ec && !repository.refill(size));
+    for (uint64_t i = 8; i < 16; ++i)
+    {
+        CHECK(repository.push(i));
+    }
+
+    auto [transferEc, moved] =
+        repository.transferIf(other, [](uint64_t value) { return value % 2 == 0; });
+    CHECK(!transferEc && moved == 8);
+
+    uint64_t value{0};
+    for (uint64_t i = 0; i < 8; ++i)
+    {
+        CHECK(repository.pull(value) && value == 2 * i + 1);
+        CHECK(other.pull(value) && value == 2 * i);
+    }
+    CHECK(repository.stats().snapshot().residency.count == 4);
+    CHECK(other.stats().snapshot().residency.count == 4);
+
+    CHECK(!repository.close());
+    CHECK(!other.close());
+    removeFiles(spillPath);
+    removeFiles(otherPath);
+    return true;
+}
+
+// Lanes share one ring and one spill file: bulk records are spilled around control ones,
+// which stay in ring, and come back once control lanes are drained
+bool priorityLanesShareRingAndSpillFile()
+{
+    const auto spillPath = directory / "diskrepository_test.spill";
+    removeFiles(spillPath);
+
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    // lane 0 delivers up to 3 records in a row while lane 1 waits
+    PriorityDiskRepository<2, 1, uint64_t> repository(spillPath, 9 * 100, {3, 0, 0}, options);
+    CHECK(!repository.open());
+
+    for (uint64_t i = 0; i < 50; ++i)
+    {
+        CHECK(repository.push(2, 1000 + i));
+    }
+    CHECK(repository.push(1, 1));
+    for (uint64_t i = 50; i < 99; ++i)
+    {
+        CHECK(repository.push(2, 1000 + i));
+    }
+    // spills all bulk records, lane 1 one stays
+    CHECK(repository.push(0, 2));
+    CHECK(repository.size() == 2 * 9);
+    CHECK(std::filesystem::file_size(spillPath) > 99 * 9);
+    for (uint64_t i = 3; i < 9; ++i)
+    {
+        CHECK(repository.push(i % 2 == 0 ? 0 : 1, i));
+    }
+
+    // lane 0 holds 2, 4, 6, 8 and lane 1 holds 1, 3, 5, 7
+    const std::pair<size_t, uint64_t> expected[] = {
+        {0, 2}, {0, 4}, {0, 6}, {1, 1}, {0, 8}, {1, 3}, {1, 5}, {1, 7}};
+    size_t lane{0};
+    uint64_t value{0};
+    for (const auto &[expectedLane, expectedValue] : expected)
+    {
+        CHECK(repository.pull(lane, value) && lane == expectedLane && value == expectedValue);
+    }
+    CHECK(repository.size() == 0);
+
+    for (uint64_t i = 0; i < 99; ++i)
+    {
+        CHECK(repository.pull(lane, value) && lane == 2 && value == 1000 + i);
+    }
+    CHECK(!repository.pull(lane, value));
+    CHECK(!repository.error());
+
+    CHECK(!repository.push(3, 0));
+    CHECK(repository.queuedRecords(3) == 0);
+
+    // control lanes can't go over budget
+    for (uint64_t i = 0; i < 100; ++i)
+    {
+        CHECK(repository.push(1, i));
+    }
+    CHECK(!repository.push(0, 0));
+
+    CHECK(!repository.close());
+    removeFiles(spillPath);
+    return true;
+}
+
+// A batch stops at the first record that doesn't fit, records before it are pushed and
+// committed together
+bool pushBatchStopsAtFirstMiss()
+{
+    using Repository = BasicDiskRepository<false, RepositoryStats, uint32_t, std::string>;
+    const auto spillPath = directory / "diskrepository_test.spill";
+
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    removeFiles(spillPath);
+    Repository repository(spillPath, 1 << 20, options);
+    CHECK(!repository.open());
+
+    const std::string names[] = {"a", "b", std::string(2 << 20, 'c'), "d"};
+    CHECK(repository.pushBatch(4, [&](size_t index) {
+        return std::tuple<uint32_t, const std::string &>(index, names[index]);
+    }) == 2);
+    CHECK(repository.stats().snapshot().recordsPushed == 2);
+    CHECK(repository.stats().snapshot().failedPushes == 2);
+
+    uint32_t value{0};
+    std::string name;
+    CHECK(repository.pull(value, name) && value == 0 && name == "a");
+    CHECK(repository.pull(value, name) && value == 1 && name == "b");
+    CHECK(!repository.pull(value, name));
+    CHECK(repository.stats().snapshot().residency.count == 2);
+
+    CHECK(!repository.close());
+    removeFiles(spillPath);
+    return true;
+}
+
+// arena that runs out of memory fails the pull and record stays for the next one
+bool arenaPullLeavesRecordOnFailure()
+{
+    const auto spillPath = directory / "diskrepository_test.spill";
+
+    DiskRepositoryOptions options;
+    options.syncSpill = false;
+    removeFiles(spillPath);
+    DiskRepository<false, uint32_t, std::string> repository(spillPath, 1 << 16, options);
+    CHECK(!repository.open());
+    CHECK(repository.push(1, "name"));
+
+    uint32_t value{0};
+    std::string_view name;
+    CHECK(!repository.pull(*std::pmr::null_memory_resource(), value, name));
+    CHECK(repository.size() != 0);
+
+    std::pmr::monotonic_buffer_resource arena;
+    CHECK(repository.pull(arena, value, name) && value == 1 && name == "name");
+    CHECK(repository.size() == 0);
+
+    CHECK(!repository.close());
+    removeFiles(spillPath);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    directory = argc > 1 ? argv[1] : std::filesystem::temp_directory_path();
+
+    const std::pair<const char *, bool (*)()> tests[] = {
+        {"lzCodecRoundTrip", lzCodecRoundTrip},
+        {"crc32cPathsAgree", crc32cPathsAgree},
+        {"snapshotOfDrainedFullRing", snapshotOfDrainedFullRing},
+        {"recoveryCutsOnlyTornTail", recoveryCutsOnlyTornTail},
+        {"persistentRingRestoresCheckpoint", persistentRingRestoresCheckpoint},
+        {"sequenceNumbersSurviveRefillAndReopen", sequenceNumbersSurviveRefillAndReopen},
+        {"statsCountTraffic", statsCountTraffic},
+        {"probesAreListedInNotes", probesAreListedInNotes},
+        {"directSpillKeepsBlocksWhole", directSpillKeepsBlocksWhole},
+        {"prefetchStagesChunksInOrder", prefetchStagesChunksInOrder},
+        {"mergeSortedVisitsAllChunksInOrder", mergeSortedVisitsAllChunksInOrder},
+        {"variantRecordsKeepAlternative", variantRecordsKeepAlternative},
+        {"stringDictionaryRoundTrip", stringDictionaryRoundTrip},
+        {"spillFileIsLittleEndian", spillFileIsLittleEndian},
+        {"pacedSpillSplitsChunks", pacedSpillSplitsChunks},
+        {"memoryPressureReleasesFreeRing", memoryPressureReleasesFreeRing},
+        {"columnarSpillWithDictionaryRejected", columnarSpillWithDictionaryRejected},
+        {"transferredRecordsKeepPushTimes", transferredRecordsKeepPushTimes},
+        {"priorityLanesShareRingAndSpillFile", priorityLanesShareRingAndSpillFile},
+        {"pushBatchStopsAtFirstMiss", pushBatchStopsAtFirstMiss},
+        {"arenaPullLeavesRecordOnFailure", arenaPullLeavesRecordOnFailure},
+    };
+
+    int failed{0};
+    for (const auto &[name, test] : tests)
+    {
+        const bool passed = test();
+        std::printf("%s %s\n", passed ? "passed" : "FAILED", name);
+        failed += passed ? 0 : 1;
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+// USDT probes in the format of systemtap's <sys/sdt.h>, which isn't required to build:
+// each probe is a single nop plus a .note.stapsdt entry telling perf, bpftrace or
+// systemtap where it is and where to find its arguments, e.g.
+//   bpftrace -e 'usdt:./app:diskrepository:flush_end { @[arg2] = hist(arg1); }'
+// Attaching replaces the nop with a breakpoint, so a detached probe costs one nop.
+// Arguments are evaluated even when nobody listens, keep them to values at hand.
+// Probes are emitted when DISKREPOSITORY_PROBES is defined (the CMake option of the same name).
+
+#if defined(DISKREPOSITORY_PROBES) && defined(__linux__) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+
+#define DISKREPOSITORY_PROBE_ASM(name, args)                                                   \
+    "990: nop\n"                                                                               \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                              \
+    ".balign 4\n"                                                                              \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                                         \
+    "991: .asciz \"stapsdt\"\n"                                                                \
+    "992: .balign 4\n"                                                                         \
+    "993: .8byte 990b\n"                                                                       \
+    ".8byte _.stapsdt.base\n"                                                                  \
+    ".8byte 0\n"                                                                               \
+    ".asciz \"diskrepository\"\n"                                                              \
+    ".asciz \"" #name "\"\n"                                                                   \
+    ".asciz \"" args "\"\n"                                                                    \
+    "994: .balign 4\n"                                                                         \
+    ".popsection\n"                                                                            \
+    ".ifndef _.stapsdt.base\n"                                                                 \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"                    \
+    ".weak _.stapsdt.base\n"                                                                   \
+    ".hidden _.stapsdt.base\n"                                                                 \
+    "_.stapsdt.base: .space 1\n"                                                               \
+    ".size _.stapsdt.base, 1\n"                                                                \
+    ".popsection\n"                                                                            \
+    ".endif\n"
+
+// all arguments are passed as unsigned 64-bit values
+#define DISKREPOSITORY_PROBE0(name) __asm__ __volatile__(DISKREPOSITORY_PROBE_ASM(name, ""))
+#define DISKREPOSITORY_PROBE1(name, a)                                                         \
+    __asm__ __volatile__(DISKREPOSITORY_PROBE_ASM(name, "8@%0")                                \
+                         :                                                                     \
+                         : "nor"(static_cast<uint64_t>(a)))
+#define DISKREPOSITORY_PROBE2(name, a, b)                                                      \
+    __asm__ __volatile__(DISKREPOSITORY_PROBE_ASM(name, "8@%0 8@%1")                           \
+                         :                                                                     \
+                         : "nor"(static_cast<uint64_t>(a)), "nor"(static_cast<uint64_t>(b)))
+#define DISKREPOSITORY_PROBE3(name, a, b, c)                                                   \
+    __asm__ __volatile__(DISKREPOSITORY_PROBE_ASM(name, "8@%0 8@%1 8@%2")                      \
+                         :                                                                     \
+                         : "nor"(static_cast<uint64_t>(a)), "nor"(static_cast<uint64_t>(b)),   \
+                         "nor"(static_cast<uint64_t>(c)))
+
+#else
+
+#define DISKREPOSITORY_PROBE0(name) do {} while (false)
+#define DISKREPOSITORY_PROBE1(name, a) do {} while (false)
+#define DISKREPOSITORY_PROBE2(name, a, b) do {} while (false)
+#define DISKREPOSITORY_PROBE3(name, a, b, c) do {} while (false)
+
+#endif